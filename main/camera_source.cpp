@@ -0,0 +1,41 @@
+#include "camera_source.h"
+#include <atomic>
+
+// Device backend: a thin pass-through to the esp32-camera driver
+
+static std::atomic<uint32_t> frames_delivered{0};
+static std::atomic<uint32_t> get_timeouts{0};
+
+esp_err_t camera_source_init(const camera_config_t *config)
+{
+    return esp_camera_init(config);
+}
+
+camera_fb_t *camera_source_fb_get(void)
+{
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb) {
+        frames_delivered.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        get_timeouts.fetch_add(1, std::memory_order_relaxed);
+    }
+    return fb;
+}
+
+void camera_source_fb_return(camera_fb_t *fb)
+{
+    esp_camera_fb_return(fb);
+}
+
+sensor_t *camera_source_sensor_get(void)
+{
+    return esp_camera_sensor_get();
+}
+
+void camera_source_get_stats(camera_source_stats_t *stats)
+{
+    stats->frames_captured = 0;
+    stats->frames_dropped = 0;
+    stats->frames_delivered = frames_delivered.load(std::memory_order_relaxed);
+    stats->get_timeouts = get_timeouts.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,46 @@
+#ifndef CAMERA_SOURCE_H
+#define CAMERA_SOURCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+
+// Frame source behind the esp32-camera camera_fb_t contract. The device build
+// forwards to the sensor driver; the linux target build plays back recorded
+// JPEG frames instead (camera_source_host.cpp). Frames from camera_source_fb_get
+// must be handed back with camera_source_fb_return, exactly as with esp_camera.
+
+esp_err_t camera_source_init(const camera_config_t *config);
+camera_fb_t *camera_source_fb_get(void);
+void camera_source_fb_return(camera_fb_t *fb);
+sensor_t *camera_source_sensor_get(void);
+
+typedef struct {
+    uint32_t frames_captured;   // Frames written into a buffer by the sensor side
+    uint32_t frames_dropped;    // Frames lost because no buffer was free (or overwritten in GRAB_LATEST)
+    uint32_t frames_delivered;  // Frames handed out by camera_source_fb_get
+    uint32_t get_timeouts;      // camera_source_fb_get calls that returned NULL
+} camera_source_stats_t;
+
+// Counters since init. The device backend only knows the delivery side.
+void camera_source_get_stats(camera_source_stats_t *stats);
+
+#if CONFIG_IDF_TARGET_LINUX
+// Playback settings for the host backend, to be called before camera_source_init.
+// path is a directory of .jpg/.jpeg files (played in name order) or a file of
+// concatenated JPEGs such as a saved MJPEG stream. fps 0 plays as fast as frames
+// are consumed. Defaults come from CAMERA_SOURCE_PATH, CAMERA_SOURCE_FPS and
+// CAMERA_SOURCE_LOOP in the environment.
+void camera_source_host_set_playback(const char *path, int fps, bool loop);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAMERA_SOURCE_H
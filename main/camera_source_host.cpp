@@ -0,0 +1,440 @@
+#include "camera_source.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+// Host backend: plays back recorded JPEG frames through the same buffer pool
+// model as esp32-camera. A playback task stands in for the sensor and DMA: on
+// every frame period it needs a free buffer to write the next frame into.
+//  - CAMERA_GRAB_WHEN_EMPTY: if the application holds every buffer the frame is
+//    lost, and filled buffers wait in the queue however old they get. With
+//    fb_count 1 the application therefore receives the frame captured right
+//    after its previous return, not the current one.
+//  - CAMERA_GRAB_LATEST: the oldest unread frame is overwritten instead.
+// With fps 0 the playback task waits for a free buffer rather than dropping, so
+// the pipeline runs as fast as it consumes frames.
+
+static const char *TAG = "camera_host";
+
+#define CAMERA_HOST_MAX_FB 4
+#define CAMERA_HOST_GET_TIMEOUT_MS 4000  // Same as the esp32-camera driver
+#define CAMERA_HOST_DEFAULT_FPS 15
+
+// One frame of the recording: a file of its own, or a slice of the MJPEG file
+typedef struct {
+    char *path;     // Directory playback, NULL for MJPEG
+    size_t offset;  // MJPEG playback
+    size_t len;
+} host_frame_t;
+
+static char playback_path[256];
+static int playback_fps = CAMERA_HOST_DEFAULT_FPS;
+static bool playback_loop = true;
+static bool playback_configured = false;
+
+static host_frame_t *frames = NULL;
+static int frame_count = 0;
+static uint8_t *mjpeg_data = NULL;
+static size_t mjpeg_len = 0;
+
+static camera_fb_t fbs[CAMERA_HOST_MAX_FB];
+static size_t fb_capacity[CAMERA_HOST_MAX_FB];
+static int fb_count = 0;
+static camera_grab_mode_t grab_mode = CAMERA_GRAB_WHEN_EMPTY;
+static QueueHandle_t free_queue = NULL;   // Buffers the playback task may fill
+static QueueHandle_t ready_queue = NULL;  // Filled buffers, oldest first
+static std::atomic<bool> playback_done{false};
+static sensor_t host_sensor;
+
+static std::atomic<uint32_t> frames_captured{0};
+static std::atomic<uint32_t> frames_dropped{0};
+static std::atomic<uint32_t> frames_delivered{0};
+static std::atomic<uint32_t> get_timeouts{0};
+
+void camera_source_host_set_playback(const char *path, int fps, bool loop)
+{
+    snprintf(playback_path, sizeof(playback_path), "%s", path);
+    playback_fps = fps;
+    playback_loop = loop;
+    playback_configured = true;
+}
+
+static bool is_sof_marker(uint8_t m)
+{
+    return m >= 0xC0 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC;
+}
+
+// Walk the marker segments of the JPEG at p. Returns its length up to and
+// including EOI, or 0 if it is truncated or malformed. Segment lengths are
+// followed, so thumbnails embedded in APP segments do not end the frame early.
+static size_t jpeg_scan(const uint8_t *p, size_t len, size_t *width, size_t *height)
+{
+    if (len < 4 || p[0] != 0xFF || p[1] != 0xD8) {
+        return 0;
+    }
+
+    size_t pos = 2;
+    while (pos + 2 <= len) {
+        if (p[pos] != 0xFF) {
+            return 0;
+        }
+        uint8_t marker = p[pos + 1];
+        if (marker == 0xFF) {
+            pos++;  // Fill byte
+            continue;
+        }
+        if (marker == 0xD9) {
+            return pos + 2;
+        }
+        if ((marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) {
+            pos += 2;  // No payload
+            continue;
+        }
+        if (pos + 4 > len) {
+            return 0;
+        }
+        size_t seg_len = ((size_t)p[pos + 2] << 8) | p[pos + 3];
+        if (is_sof_marker(marker) && pos + 9 <= len) {
+            if (height) {
+                *height = ((size_t)p[pos + 5] << 8) | p[pos + 6];
+            }
+            if (width) {
+                *width = ((size_t)p[pos + 7] << 8) | p[pos + 8];
+            }
+        }
+        pos += 2 + seg_len;
+        if (marker == 0xDA) {
+            // Entropy-coded data runs to the next marker that is neither a
+            // stuffed 0xFF00 nor a restart marker
+            while (pos + 1 < len) {
+                if (p[pos] == 0xFF && p[pos + 1] != 0x00 && !(p[pos + 1] >= 0xD0 && p[pos + 1] <= 0xD7)) {
+                    break;
+                }
+                pos++;
+            }
+        }
+    }
+    return 0;
+}
+
+static bool add_frame(char *path, size_t offset, size_t len)
+{
+    host_frame_t *grown = (host_frame_t *)realloc(frames, (frame_count + 1) * sizeof(host_frame_t));
+    if (grown == NULL) {
+        return false;
+    }
+    frames = grown;
+    frames[frame_count].path = path;
+    frames[frame_count].offset = offset;
+    frames[frame_count].len = len;
+    frame_count++;
+    return true;
+}
+
+static bool has_jpeg_extension(const char *name)
+{
+    const char *dot = strrchr(name, '.');
+    return dot && (strcasecmp(dot, ".jpg") == 0 || strcasecmp(dot, ".jpeg") == 0);
+}
+
+static int compare_frame_paths(const void *a, const void *b)
+{
+    return strcmp(((const host_frame_t *)a)->path, ((const host_frame_t *)b)->path);
+}
+
+static esp_err_t index_directory(const char *dir_path)
+{
+    DIR *dir = opendir(dir_path);
+    if (dir == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (!has_jpeg_extension(entry->d_name)) {
+            continue;
+        }
+        size_t path_len = strlen(dir_path) + strlen(entry->d_name) + 2;
+        char *path = (char *)malloc(path_len);
+        if (path == NULL || !add_frame(path, 0, 0)) {
+            free(path);
+            closedir(dir);
+            return ESP_ERR_NO_MEM;
+        }
+        snprintf(path, path_len, "%s/%s", dir_path, entry->d_name);
+    }
+    closedir(dir);
+
+    qsort(frames, frame_count, sizeof(host_frame_t), compare_frame_paths);
+    return ESP_OK;
+}
+
+static esp_err_t index_mjpeg(const char *file_path)
+{
+    FILE *f = fopen(file_path, "rb");
+    if (f == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    mjpeg_data = (uint8_t *)malloc(size > 0 ? size : 1);
+    if (mjpeg_data == NULL) {
+        fclose(f);
+        return ESP_ERR_NO_MEM;
+    }
+    mjpeg_len = fread(mjpeg_data, 1, size, f);
+    fclose(f);
+
+    // Anything between frames (multipart boundaries and part headers of a
+    // recorded /stream) is skipped
+    size_t pos = 0;
+    while (pos + 3 < mjpeg_len) {
+        if (mjpeg_data[pos] != 0xFF || mjpeg_data[pos + 1] != 0xD8 || mjpeg_data[pos + 2] != 0xFF) {
+            pos++;
+            continue;
+        }
+        size_t len = jpeg_scan(mjpeg_data + pos, mjpeg_len - pos, NULL, NULL);
+        if (len == 0) {
+            pos += 2;
+            continue;
+        }
+        if (!add_frame(NULL, pos, len)) {
+            return ESP_ERR_NO_MEM;
+        }
+        pos += len;
+    }
+    return ESP_OK;
+}
+
+static bool ensure_capacity(int fb_index, size_t len)
+{
+    if (fb_capacity[fb_index] >= len) {
+        return true;
+    }
+    uint8_t *buf = (uint8_t *)realloc(fbs[fb_index].buf, len);
+    if (buf == NULL) {
+        return false;
+    }
+    fbs[fb_index].buf = buf;
+    fb_capacity[fb_index] = len;
+    return true;
+}
+
+static bool fill_fb(camera_fb_t *fb, const host_frame_t *frame)
+{
+    int fb_index = fb - fbs;
+
+    if (frame->path) {
+        FILE *f = fopen(frame->path, "rb");
+        if (f == NULL) {
+            ESP_LOGW(TAG, "Failed to open %s", frame->path);
+            return false;
+        }
+        struct stat st;
+        bool ok = fstat(fileno(f), &st) == 0 && ensure_capacity(fb_index, st.st_size);
+        fb->len = ok ? fread(fb->buf, 1, st.st_size, f) : 0;
+        fclose(f);
+    } else {
+        if (!ensure_capacity(fb_index, frame->len)) {
+            return false;
+        }
+        memcpy(fb->buf, mjpeg_data + frame->offset, frame->len);
+        fb->len = frame->len;
+    }
+
+    fb->width = 0;
+    fb->height = 0;
+    if (fb->len == 0 || jpeg_scan(fb->buf, fb->len, &fb->width, &fb->height) == 0) {
+        ESP_LOGW(TAG, "Skipping frame that is not a complete JPEG");
+        return false;
+    }
+    fb->format = PIXFORMAT_JPEG;
+
+    int64_t now = esp_timer_get_time();
+    fb->timestamp.tv_sec = now / 1000000;
+    fb->timestamp.tv_usec = now % 1000000;
+    return true;
+}
+
+static void playback_task(void *arg)
+{
+    TickType_t period = 0;
+    if (playback_fps > 0) {
+        period = pdMS_TO_TICKS(1000 / playback_fps);
+        if (period == 0) {
+            period = 1;  // Capped at the tick rate
+        }
+    }
+    TickType_t last_wake = xTaskGetTickCount();
+    int next = 0;
+
+    while (true) {
+        if (next == frame_count) {
+            if (!playback_loop) {
+                break;
+            }
+            next = 0;
+        }
+
+        camera_fb_t *fb = NULL;
+        if (period == 0) {
+            xQueueReceive(free_queue, &fb, portMAX_DELAY);
+        } else {
+            xTaskDelayUntil(&last_wake, period);
+            if (xQueueReceive(free_queue, &fb, 0) != pdTRUE) {
+                frames_dropped.fetch_add(1, std::memory_order_relaxed);
+                if (grab_mode != CAMERA_GRAB_LATEST || xQueueReceive(ready_queue, &fb, 0) != pdTRUE) {
+                    next++;  // Every buffer is held by the application
+                    continue;
+                }
+            }
+        }
+
+        if (!fill_fb(fb, &frames[next++])) {
+            xQueueSend(free_queue, &fb, 0);
+            continue;
+        }
+        frames_captured.fetch_add(1, std::memory_order_relaxed);
+        xQueueSend(ready_queue, &fb, 0);
+    }
+
+    playback_done.store(true);
+    ESP_LOGI(TAG, "Playback finished after %lu frames", (unsigned long)frames_captured.load());
+    vTaskDelete(NULL);
+}
+
+static int sensor_set_framesize(sensor_t *sensor, framesize_t framesize)
+{
+    // The recording decides the real frame size; only remember the request
+    sensor->status.framesize = framesize;
+    return 0;
+}
+
+static int sensor_set_quality(sensor_t *sensor, int quality)
+{
+    sensor->status.quality = quality;
+    return 0;
+}
+
+static int sensor_set_pixformat(sensor_t *sensor, pixformat_t pixformat)
+{
+    return pixformat == PIXFORMAT_JPEG ? 0 : -1;
+}
+
+static int sensor_set_ignored(sensor_t *sensor, int value)
+{
+    return 0;
+}
+
+esp_err_t camera_source_init(const camera_config_t *config)
+{
+    if (free_queue != NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (config->pixel_format != PIXFORMAT_JPEG) {
+        ESP_LOGE(TAG, "Only JPEG playback is supported");
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (!playback_configured) {
+        const char *path = getenv("CAMERA_SOURCE_PATH");
+        const char *fps = getenv("CAMERA_SOURCE_FPS");
+        const char *loop = getenv("CAMERA_SOURCE_LOOP");
+        camera_source_host_set_playback(path ? path : "", fps ? atoi(fps) : CAMERA_HOST_DEFAULT_FPS,
+                                        loop ? atoi(loop) != 0 : true);
+    }
+    if (playback_path[0] == '\0') {
+        ESP_LOGE(TAG, "No recording given, set CAMERA_SOURCE_PATH");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct stat st;
+    if (stat(playback_path, &st) != 0) {
+        ESP_LOGE(TAG, "%s not found", playback_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    esp_err_t err = S_ISDIR(st.st_mode) ? index_directory(playback_path) : index_mjpeg(playback_path);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (frame_count == 0) {
+        ESP_LOGE(TAG, "No JPEG frames in %s", playback_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    fb_count = config->fb_count < 1 ? 1 : (config->fb_count > CAMERA_HOST_MAX_FB ? CAMERA_HOST_MAX_FB : config->fb_count);
+    grab_mode = config->grab_mode;
+    free_queue = xQueueCreate(fb_count, sizeof(camera_fb_t *));
+    ready_queue = xQueueCreate(fb_count, sizeof(camera_fb_t *));
+    if (free_queue == NULL || ready_queue == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < fb_count; i++) {
+        camera_fb_t *fb = &fbs[i];
+        xQueueSend(free_queue, &fb, 0);
+    }
+
+    memset(&host_sensor, 0, sizeof(host_sensor));
+    host_sensor.pixformat = PIXFORMAT_JPEG;
+    host_sensor.status.framesize = config->frame_size;
+    host_sensor.status.quality = config->jpeg_quality;
+    host_sensor.set_pixformat = sensor_set_pixformat;
+    host_sensor.set_framesize = sensor_set_framesize;
+    host_sensor.set_quality = sensor_set_quality;
+    host_sensor.set_brightness = sensor_set_ignored;
+    host_sensor.set_contrast = sensor_set_ignored;
+    host_sensor.set_saturation = sensor_set_ignored;
+    host_sensor.set_hmirror = sensor_set_ignored;
+    host_sensor.set_vflip = sensor_set_ignored;
+
+    if (xTaskCreate(playback_task, "camera_host", 4096, NULL, 6, NULL) != pdPASS) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "Playing %d frames from %s at %s%d fps, %d buffer(s), %s", frame_count, playback_path,
+             playback_fps > 0 ? "" : "max ", playback_fps, fb_count,
+             grab_mode == CAMERA_GRAB_LATEST ? "grab latest" : "grab when empty");
+    return ESP_OK;
+}
+
+camera_fb_t *camera_source_fb_get(void)
+{
+    camera_fb_t *fb = NULL;
+    TickType_t wait = playback_done.load() ? 0 : pdMS_TO_TICKS(CAMERA_HOST_GET_TIMEOUT_MS);
+    if (ready_queue == NULL || xQueueReceive(ready_queue, &fb, wait) != pdTRUE) {
+        get_timeouts.fetch_add(1, std::memory_order_relaxed);
+        return NULL;
+    }
+    frames_delivered.fetch_add(1, std::memory_order_relaxed);
+    return fb;
+}
+
+void camera_source_fb_return(camera_fb_t *fb)
+{
+    if (fb) {
+        xQueueSend(free_queue, &fb, 0);
+    }
+}
+
+sensor_t *camera_source_sensor_get(void)
+{
+    return free_queue ? &host_sensor : NULL;
+}
+
+void camera_source_get_stats(camera_source_stats_t *stats)
+{
+    stats->frames_captured = frames_captured.load(std::memory_order_relaxed);
+    stats->frames_dropped = frames_dropped.load(std::memory_order_relaxed);
+    stats->frames_delivered = frames_delivered.load(std::memory_order_relaxed);
+    stats->get_timeouts = get_timeouts.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,126 @@
+#include "capture_profile.h"
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "camera_source.h"
+#include "trace.h"
+
+static const char *TAG = "capture_profile";
+
+static capture_profile_settings_t settings[CAPTURE_PROFILE_COUNT];
+static sensor_t *sensor = NULL;                  // NULL until init, then profiles are applied
+static std::atomic<int64_t> burst_until_us{0};
+
+// Written by the task holding the camera, read by the stats
+static capture_profile_stats_t stats = {};
+static int64_t entered_us = 0;                   // When the current profile was applied
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Called with the camera held
+static void apply(capture_profile_t profile)
+{
+    const capture_profile_settings_t *s = &settings[profile];
+    if (sensor->set_framesize(sensor, s->framesize) != 0 || sensor->set_quality(sensor, s->quality) != 0) {
+        ESP_LOGW(TAG, "Sensor rejected the %s profile", capture_profile_name(profile));
+    }
+}
+
+esp_err_t capture_profile_init(const capture_profile_settings_t profiles[CAPTURE_PROFILE_COUNT])
+{
+    sensor = camera_source_sensor_get();
+    if (!sensor) {
+        ESP_LOGE(TAG, "No sensor, capture profiles are disabled");
+        return ESP_ERR_INVALID_STATE;
+    }
+    for (int p = 0; p < CAPTURE_PROFILE_COUNT; p++) {
+        settings[p] = profiles[p];
+    }
+    apply(CAPTURE_PROFILE_WATCH);
+    entered_us = esp_timer_get_time();
+    stats.current = CAPTURE_PROFILE_WATCH;
+    ESP_LOGI(TAG, "Capture profiles: watch framesize %d quality %d, burst framesize %d quality %d",
+             settings[CAPTURE_PROFILE_WATCH].framesize, settings[CAPTURE_PROFILE_WATCH].quality,
+             settings[CAPTURE_PROFILE_BURST].framesize, settings[CAPTURE_PROFILE_BURST].quality);
+    return ESP_OK;
+}
+
+void capture_profile_burst(int ms)
+{
+    int64_t until = esp_timer_get_time() + ms * 1000LL;
+    int64_t current = burst_until_us.load(std::memory_order_relaxed);
+    while (current < until && !burst_until_us.compare_exchange_weak(current, until, std::memory_order_relaxed)) {
+    }
+}
+
+capture_profile_t capture_profile_get(void)
+{
+    portENTER_CRITICAL(&stats_lock);
+    capture_profile_t current = stats.current;
+    portEXIT_CRITICAL(&stats_lock);
+    return current;
+}
+
+camera_fb_t *capture_profile_fb_get(void)
+{
+    if (!sensor) {
+        return camera_source_fb_get();
+    }
+
+    int64_t start = esp_timer_get_time();
+    capture_profile_t due = start < burst_until_us.load(std::memory_order_relaxed) ? CAPTURE_PROFILE_BURST
+                                                                                   : CAPTURE_PROFILE_WATCH;
+    bool switched = due != stats.current;
+    if (switched) {
+        apply(due);
+        portENTER_CRITICAL(&stats_lock);
+        stats.residency_us[stats.current] += start - entered_us;
+        stats.current = due;
+        entered_us = start;
+        portEXIT_CRITICAL(&stats_lock);
+    }
+
+    camera_fb_t *fb = camera_source_fb_get();
+    if (switched) {
+        // The driver may still hold a frame from before the switch
+        for (int i = 0; fb && i < CAPTURE_PROFILE_MAX_STALE_FRAMES && trace_fb_capture_us(fb) < start; i++) {
+            camera_source_fb_return(fb);
+            fb = camera_source_fb_get();
+        }
+        int64_t latency = esp_timer_get_time() - start;
+        portENTER_CRITICAL(&stats_lock);
+        stats.switches++;
+        stats.last_switch_us = latency;
+        stats.max_switch_us = latency > stats.max_switch_us ? latency : stats.max_switch_us;
+        stats.total_switch_us += latency;
+        portEXIT_CRITICAL(&stats_lock);
+        ESP_LOGD(TAG, "Switched to %s in %lld ms", capture_profile_name(due), latency / 1000);
+    }
+    if (fb) {
+        portENTER_CRITICAL(&stats_lock);
+        stats.frames[due]++;
+        portEXIT_CRITICAL(&stats_lock);
+    }
+    return fb;
+}
+
+void capture_profile_get_stats(capture_profile_stats_t *out)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    if (sensor) {
+        out->residency_us[stats.current] += now - entered_us;
+    }
+    portEXIT_CRITICAL(&stats_lock);
+}
+
+const char *capture_profile_name(capture_profile_t profile)
+{
+    switch (profile) {
+        case CAPTURE_PROFILE_WATCH: return "watch";
+        case CAPTURE_PROFILE_BURST: return "burst";
+        default: break;
+    }
+    return "?";
+}
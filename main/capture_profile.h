@@ -0,0 +1,64 @@
+#ifndef CAPTURE_PROFILE_H
+#define CAPTURE_PROFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_camera.h"
+
+// Capture profiles: the camera idles at a low resolution that is cheap to
+// decode and detect in, and switches to a high resolution only for a burst of
+// frames while a face is being recognized or enrolled. Anyone who wants the
+// high resolution asks for a burst; the switch itself happens right before the
+// next frame is grabbed, by whoever holds the camera.
+
+#define CAPTURE_PROFILE_MAX_STALE_FRAMES 2  // Frames dropped after a switch, captured with the old settings
+
+typedef enum {
+    CAPTURE_PROFILE_WATCH = 0,  // Between faces
+    CAPTURE_PROFILE_BURST,      // While a face is recognized or enrolled
+    CAPTURE_PROFILE_COUNT,
+} capture_profile_t;
+
+typedef struct {
+    framesize_t framesize;
+    int quality;  // JPEG quality, lower is better
+} capture_profile_settings_t;
+
+typedef struct {
+    capture_profile_t current;
+    uint32_t switches;
+    int64_t last_switch_us;  // From the switch to the first frame with the new settings
+    int64_t max_switch_us;
+    int64_t total_switch_us;
+    int64_t residency_us[CAPTURE_PROFILE_COUNT];  // Time spent in each profile since init
+    uint32_t frames[CAPTURE_PROFILE_COUNT];       // Frames grabbed in each profile
+} capture_profile_stats_t;
+
+// Take the settings of every profile and switch to WATCH. The camera must have
+// been initialized with the largest frame size of the profiles, the driver
+// sizes its frame buffers for it.
+esp_err_t capture_profile_init(const capture_profile_settings_t profiles[CAPTURE_PROFILE_COUNT]);
+
+// Keep the BURST profile for at least ms from now
+void capture_profile_burst(int ms);
+
+capture_profile_t capture_profile_get(void);
+
+// Grab a frame in the profile due now, switching the sensor first if needed.
+// Only call with the camera to yourself; return the frame with camera_source_fb_return.
+camera_fb_t *capture_profile_fb_get(void);
+
+// Counters since init, the residency of the current profile included
+void capture_profile_get_stats(capture_profile_stats_t *stats);
+
+const char *capture_profile_name(capture_profile_t profile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CAPTURE_PROFILE_H
@@ -0,0 +1,183 @@
+#include "clip_recorder.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+static const char *TAG = "clip_recorder";
+
+static clip_recorder_config_t config;
+static SemaphoreHandle_t recorder_mutex = NULL;  // Guards everything below, held only briefly
+
+// Pre-roll ring, oldest first from ring_head
+static frame_cache_entry_t *ring[CLIP_RECORDER_MAX_FRAMES];
+static int ring_head = 0;
+static int ring_count = 0;
+static size_t ring_bytes = 0;
+static uint32_t last_seq = 0;
+
+static clip_t *recording = NULL;    // Collecting its post-roll
+static int64_t recording_until_us = 0;
+static clip_t *finished = NULL;     // Latest complete clip, one reference held here
+static uint32_t next_clip_id = 1;
+static bool holding = false;        // Keeping the frame cache open for the pre-roll
+
+esp_err_t clip_recorder_init(const clip_recorder_config_t *cfg)
+{
+    if (!recorder_mutex) {
+        recorder_mutex = xSemaphoreCreateMutex();
+        if (!recorder_mutex) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    config = *cfg;
+    // The pre-roll needs every frame cached, whether anyone polls /capture or not
+    bool hold = config.budget_bytes > 0;
+    if (hold != holding) {
+        frame_cache_hold(hold);
+        holding = hold;
+    }
+    ESP_LOGI(TAG, "Clip recorder ready: %d ms pre-roll, %d ms post-roll, %u KB budget", config.pre_roll_ms,
+             config.post_roll_ms, (unsigned)(config.budget_bytes / 1024));
+    return ESP_OK;
+}
+
+bool clip_recorder_enabled(void)
+{
+    return holding;
+}
+
+static void free_clip(clip_t *clip)
+{
+    for (int i = 0; i < clip->count; i++) {
+        frame_cache_release(clip->frames[i]);
+    }
+    heap_caps_free(clip);
+}
+
+// Drop the oldest pre-roll frame. Called with recorder_mutex held.
+static void ring_pop(void)
+{
+    frame_cache_entry_t *oldest = ring[ring_head];
+    ring_head = (ring_head + 1) % CLIP_RECORDER_MAX_FRAMES;
+    ring_count--;
+    ring_bytes -= oldest->len;
+    frame_cache_release(oldest);
+}
+
+// Append to a clip within its budget. Returns false once it is full.
+// Called with recorder_mutex held.
+static bool clip_append(clip_t *clip, frame_cache_entry_t *frame)
+{
+    if (clip->count == CLIP_RECORDER_MAX_FRAMES || clip->bytes + frame->len > config.budget_bytes) {
+        return false;
+    }
+    clip->frames[clip->count++] = frame_cache_ref(frame);
+    clip->bytes += frame->len;
+    return true;
+}
+
+void clip_recorder_push(frame_cache_entry_t *frame)
+{
+    if (!frame || !recorder_mutex) {
+        return;
+    }
+
+    clip_t *done = NULL;
+    xSemaphoreTake(recorder_mutex, portMAX_DELAY);
+    if (frame->seq <= last_seq) {
+        xSemaphoreGive(recorder_mutex);
+        return;
+    }
+    last_seq = frame->seq;
+
+    // Keep only the pre-roll window within the budget
+    while (ring_count > 0 &&
+           (ring_count == CLIP_RECORDER_MAX_FRAMES || ring_bytes + frame->len > config.budget_bytes ||
+            ring[ring_head]->capture_us < frame->capture_us - config.pre_roll_ms * 1000LL)) {
+        ring_pop();
+    }
+    if (frame->len <= config.budget_bytes) {
+        ring[(ring_head + ring_count++) % CLIP_RECORDER_MAX_FRAMES] = frame_cache_ref(frame);
+        ring_bytes += frame->len;
+    }
+
+    if (recording && (!clip_append(recording, frame) || frame->capture_us >= recording_until_us)) {
+        done = finished;
+        finished = recording;
+        recording = NULL;
+        ESP_LOGI(TAG, "Clip %lu (%s) done: %d frames, %u KB", (unsigned long)finished->id, finished->label,
+                 finished->count, (unsigned)(finished->bytes / 1024));
+    }
+    xSemaphoreGive(recorder_mutex);
+
+    // The previous clip goes once its readers are done with it
+    clip_recorder_release(done);
+}
+
+bool clip_recorder_trigger(const char *label)
+{
+    if (!recorder_mutex) {
+        return false;
+    }
+
+    xSemaphoreTake(recorder_mutex, portMAX_DELAY);
+    if (recording) {
+        xSemaphoreGive(recorder_mutex);
+        return false;
+    }
+    // Header and frame list in one PSRAM block
+    clip_t *clip = (clip_t *)heap_caps_calloc(1, sizeof(clip_t) + CLIP_RECORDER_MAX_FRAMES * sizeof(frame_cache_entry_t *),
+                                             MALLOC_CAP_SPIRAM);
+    if (!clip) {
+        xSemaphoreGive(recorder_mutex);
+        ESP_LOGW(TAG, "No memory for a clip");
+        return false;
+    }
+    clip->frames = (frame_cache_entry_t **)(clip + 1);
+    clip->id = next_clip_id++;
+    snprintf(clip->label, sizeof(clip->label), "%s", label);
+    clip->wall_time = time(NULL);
+    clip->refs = 1;
+
+    // Freeze the pre-roll: the clip's references keep the frames after the ring drops them
+    for (int i = 0; i < ring_count; i++) {
+        clip_append(clip, ring[(ring_head + i) % CLIP_RECORDER_MAX_FRAMES]);
+    }
+    recording = clip;
+    recording_until_us = esp_timer_get_time() + config.post_roll_ms * 1000LL;
+    xSemaphoreGive(recorder_mutex);
+
+    ESP_LOGI(TAG, "Clip %lu (%s) started with %d pre-roll frames", (unsigned long)clip->id, clip->label,
+             clip->count);
+    return true;
+}
+
+clip_t *clip_recorder_get(void)
+{
+    if (!recorder_mutex) {
+        return NULL;
+    }
+    xSemaphoreTake(recorder_mutex, portMAX_DELAY);
+    clip_t *clip = finished;
+    if (clip) {
+        clip->refs++;
+    }
+    xSemaphoreGive(recorder_mutex);
+    return clip;
+}
+
+void clip_recorder_release(clip_t *clip)
+{
+    if (!clip) {
+        return;
+    }
+    xSemaphoreTake(recorder_mutex, portMAX_DELAY);
+    bool last = --clip->refs == 0;
+    xSemaphoreGive(recorder_mutex);
+    if (last) {
+        free_clip(clip);
+    }
+}
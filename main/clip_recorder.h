@@ -0,0 +1,67 @@
+#ifndef CLIP_RECORDER_H
+#define CLIP_RECORDER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include "esp_err.h"
+#include "frame_cache.h"
+
+// Event clips built from the frames the capture pipeline caches anyway. The
+// recorder keeps references to the last few seconds of cached JPEG frames (the
+// pre-roll); a trigger freezes them into a clip, which then collects frames for
+// the post-roll. Nothing is copied or re-encoded, and pushing a frame never waits
+// on a reader of a clip.
+//
+// Frames are counted against budget_bytes twice: once for the pre-roll ring and
+// once per clip. With one clip recording and the previous one still held, at most
+// three budgets of JPEG data are referenced, less when they share frames.
+
+#define CLIP_RECORDER_MAX_FRAMES 128  // Per clip and in the pre-roll ring
+#define CLIP_LABEL_LEN 48
+
+typedef struct {
+    size_t budget_bytes;  // JPEG bytes in the pre-roll ring, and in one clip
+    int pre_roll_ms;
+    int post_roll_ms;
+} clip_recorder_config_t;
+
+// A finished clip, frames in capture order. Owned by clip_recorder.cpp.
+typedef struct {
+    uint32_t id;                   // Increments with every clip
+    char label[CLIP_LABEL_LEN];    // What triggered it
+    time_t wall_time;              // When it was triggered
+    int count;
+    size_t bytes;
+    frame_cache_entry_t **frames;  // A reference is held on each
+    int refs;
+} clip_t;
+
+esp_err_t clip_recorder_init(const clip_recorder_config_t *config);
+
+// Whether clips are recorded, so the capture loops should keep frames coming
+// at a useful rate even when they have nothing else to do with them
+bool clip_recorder_enabled(void);
+
+// Offer a cached frame; the recorder takes its own reference. Frames already
+// seen (by sequence number) are ignored, so every capture path may call this.
+void clip_recorder_push(frame_cache_entry_t *frame);
+
+// Start a clip with the current pre-roll. Returns false if one is still
+// recording, in which case the event is covered by that clip.
+bool clip_recorder_trigger(const char *label);
+
+// Latest finished clip with a reference taken, NULL if none. Release it when done.
+clip_t *clip_recorder_get(void);
+void clip_recorder_release(clip_t *clip);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // CLIP_RECORDER_H
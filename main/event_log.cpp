@@ -0,0 +1,626 @@
+#include "event_log.h"
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/param.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_partition.h"
+#include "esp_timer.h"
+
+// The log partition is used as a ring of 4 KB sectors. Slot 0 of every sector holds a
+// header with a sector sequence number, the remaining slots hold 32-byte records that
+// are appended in order. Sectors are erased strictly round-robin, so every sector sees
+// the same number of erase cycles. After a reboot the sector with the highest sequence
+// number is the one being written.
+
+static const char *TAG = "event_log";
+
+#define EVENT_LOG_MAGIC 0x474C5645  // "EVLG"
+#define SECTOR_SIZE 4096
+#define PAGE_SIZE 256
+#define SLOT_SIZE sizeof(event_record_t)
+#define SLOTS_PER_SECTOR (SECTOR_SIZE / SLOT_SIZE)
+#define SLOTS_PER_PAGE (PAGE_SIZE / SLOT_SIZE)
+#define WALL_CLOCK_VALID 1577836800  // 2020-01-01, anything earlier means time was never set
+#define BOOT_ANCHORS 32              // Anchored boots remembered from the log at startup
+
+static_assert(sizeof(event_record_t) == 32, "event_record_t must fill exactly one slot");
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t sector_seq;
+    uint8_t reserved[23];
+    uint8_t crc;
+} sector_header_t;
+
+static_assert(sizeof(sector_header_t) == SLOT_SIZE, "sector_header_t must fill exactly one slot");
+
+// Per-sector summary kept in RAM so that queries can skip sectors without reading them
+typedef struct {
+    uint32_t sector_seq;  // 0 if the sector holds no valid header
+    uint32_t t_min;
+    uint32_t t_max;
+    uint32_t id_mask;     // Bit (face_id + 1) % 32 is set for every identity in the sector
+    uint16_t count;       // Events, anchors are not indexed
+    uint16_t wall_count;  // Events stored in Unix time by older firmware
+    uint16_t boot_min;
+    uint16_t boot_max;
+} sector_index_t;
+
+// Unix time at which an earlier boot started, from its anchor record
+typedef struct {
+    uint16_t boot_id;
+    uint32_t boot_time;
+} boot_anchor_t;
+
+static const esp_partition_t *partition = NULL;
+static sector_index_t *sector_index = NULL;
+static uint32_t sector_count = 0;
+static uint32_t cur_sector = 0;
+static uint32_t cur_slot = SLOTS_PER_SECTOR;
+static uint32_t next_sector_seq = 1;
+static uint16_t boot_id = 0;
+static SemaphoreHandle_t flash_mutex = NULL;
+static TaskHandle_t writer_task_handle = NULL;
+
+// Filled by the scan at init, read-only afterwards
+static boot_anchor_t anchors[BOOT_ANCHORS];
+static uint32_t anchor_count = 0;
+static bool anchored = false;  // This boot's anchor is queued, only touched by the writer task
+
+// RAM batch, filled by event_log_append() and drained by the writer task
+static portMUX_TYPE batch_lock = portMUX_INITIALIZER_UNLOCKED;
+static event_record_t batch[EVENT_LOG_BATCH_RECORDS];
+static uint32_t batch_head = 0;
+static uint32_t batch_count = 0;
+static uint32_t next_record_seq = 0;
+static uint32_t dropped = 0;
+
+static uint8_t crc8(const uint8_t *data, size_t len)
+{
+    uint8_t crc = 0xFF;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) {
+            crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x31) : (uint8_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+static bool slot_is_erased(const void *slot)
+{
+    const uint32_t *words = (const uint32_t *)slot;
+    for (size_t i = 0; i < SLOT_SIZE / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool record_is_valid(const event_record_t *rec)
+{
+    return rec->crc == crc8((const uint8_t *)rec, SLOT_SIZE - 1);
+}
+
+static uint32_t id_bit(int face_id)
+{
+    return 1u << ((uint32_t)(face_id + 1) % 32);
+}
+
+static void index_add(sector_index_t *idx, const event_record_t *rec)
+{
+    if (rec->flags & EVENT_FLAG_ANCHOR) {
+        return;
+    }
+    if (idx->count == 0 || rec->boot_id < idx->boot_min) {
+        idx->boot_min = rec->boot_id;
+    }
+    if (idx->count == 0 || rec->boot_id > idx->boot_max) {
+        idx->boot_max = rec->boot_id;
+    }
+    if (rec->flags & EVENT_FLAG_WALL_CLOCK) {
+        idx->wall_count++;
+    }
+    if (idx->count == 0 || rec->timestamp < idx->t_min) {
+        idx->t_min = rec->timestamp;
+    }
+    if (idx->count == 0 || rec->timestamp > idx->t_max) {
+        idx->t_max = rec->timestamp;
+    }
+    idx->id_mask |= id_bit(rec->face_id);
+    idx->count++;
+}
+
+// Erase a sector and stamp it with a new header. Caller holds flash_mutex.
+static esp_err_t start_sector(uint32_t sector)
+{
+    sector_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = EVENT_LOG_MAGIC;
+    hdr.sector_seq = next_sector_seq++;
+    hdr.crc = crc8((const uint8_t *)&hdr, sizeof(hdr) - 1);
+
+    memset(&sector_index[sector], 0, sizeof(sector_index_t));
+
+    esp_err_t err = esp_partition_erase_range(partition, sector * SECTOR_SIZE, SECTOR_SIZE);
+    if (err == ESP_OK) {
+        err = esp_partition_write(partition, sector * SECTOR_SIZE, &hdr, sizeof(hdr));
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start sector %u (%s)", sector, esp_err_to_name(err));
+        return err;
+    }
+
+    sector_index[sector].sector_seq = hdr.sector_seq;
+    cur_sector = sector;
+    cur_slot = 1;
+    return ESP_OK;
+}
+
+// Remember the start of an earlier boot, keeping the most recent boots
+static void anchor_add(const event_record_t *rec)
+{
+    uint32_t boot_time = rec->wall_time - rec->timestamp;
+    uint32_t slot = anchor_count;
+    for (uint32_t i = 0; i < anchor_count; i++) {
+        if (anchors[i].boot_id == rec->boot_id) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == BOOT_ANCHORS) {
+        slot = 0;
+        for (uint32_t i = 1; i < BOOT_ANCHORS; i++) {
+            if (anchors[i].boot_id < anchors[slot].boot_id) {
+                slot = i;
+            }
+        }
+        if (anchors[slot].boot_id > rec->boot_id) {
+            return;
+        }
+    } else if (slot == anchor_count) {
+        anchor_count++;
+    }
+    anchors[slot].boot_id = rec->boot_id;
+    anchors[slot].boot_time = boot_time;
+}
+
+// Read every sector once to rebuild the index and find the write position
+static esp_err_t scan_partition(void)
+{
+    uint8_t *buf = (uint8_t *)malloc(SECTOR_SIZE);
+    if (!buf) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint32_t newest_seq = 0;
+    uint32_t newest_sector = 0;
+    uint32_t newest_free_slot = SLOTS_PER_SECTOR;
+    uint32_t max_record_seq = 0;
+    uint16_t max_boot_id = 0;
+    bool any_record = false;
+
+    for (uint32_t s = 0; s < sector_count; s++) {
+        sector_index_t *idx = &sector_index[s];
+        memset(idx, 0, sizeof(*idx));
+
+        if (esp_partition_read(partition, s * SECTOR_SIZE, buf, SECTOR_SIZE) != ESP_OK) {
+            continue;
+        }
+
+        const sector_header_t *hdr = (const sector_header_t *)buf;
+        if (hdr->magic != EVENT_LOG_MAGIC || hdr->crc != crc8(buf, sizeof(*hdr) - 1)) {
+            continue;
+        }
+        idx->sector_seq = hdr->sector_seq;
+
+        uint32_t slot = 1;
+        for (; slot < SLOTS_PER_SECTOR; slot++) {
+            const event_record_t *rec = (const event_record_t *)(buf + slot * SLOT_SIZE);
+            if (slot_is_erased(rec)) {
+                break;
+            }
+            if (!record_is_valid(rec)) {
+                continue;  // Torn write, skip it
+            }
+            index_add(idx, rec);
+            if (rec->flags & EVENT_FLAG_ANCHOR) {
+                anchor_add(rec);
+            }
+            if (!any_record || rec->seq > max_record_seq) {
+                max_record_seq = rec->seq;
+            }
+            if (rec->boot_id > max_boot_id) {
+                max_boot_id = rec->boot_id;
+            }
+            any_record = true;
+        }
+
+        if (idx->sector_seq > newest_seq) {
+            newest_seq = idx->sector_seq;
+            newest_sector = s;
+            newest_free_slot = slot;
+        }
+    }
+
+    free(buf);
+
+    next_record_seq = any_record ? max_record_seq + 1 : 0;
+    boot_id = max_boot_id + 1;
+    next_sector_seq = newest_seq + 1;
+
+    if (newest_seq == 0) {
+        ESP_LOGI(TAG, "Empty log, formatting");
+        return start_sector(0);
+    }
+
+    cur_sector = newest_sector;
+    cur_slot = newest_free_slot;
+    return ESP_OK;
+}
+
+static void flush_batch(void)
+{
+    event_record_t page[SLOTS_PER_PAGE];
+
+    while (true) {
+        xSemaphoreTake(flash_mutex, portMAX_DELAY);
+
+        if (cur_slot >= SLOTS_PER_SECTOR) {
+            if (start_sector((cur_sector + 1) % sector_count) != ESP_OK) {
+                xSemaphoreGive(flash_mutex);
+                return;
+            }
+        }
+
+        // Never cross a flash page boundary so every write is a single page program
+        uint32_t room = SLOTS_PER_PAGE - (cur_slot % SLOTS_PER_PAGE);
+        uint32_t n = 0;
+
+        portENTER_CRITICAL(&batch_lock);
+        while (n < room && batch_count > 0) {
+            page[n++] = batch[batch_head];
+            batch_head = (batch_head + 1) % EVENT_LOG_BATCH_RECORDS;
+            batch_count--;
+        }
+        portEXIT_CRITICAL(&batch_lock);
+
+        if (n == 0) {
+            xSemaphoreGive(flash_mutex);
+            return;
+        }
+
+        for (uint32_t i = 0; i < n; i++) {
+            page[i].crc = crc8((const uint8_t *)&page[i], SLOT_SIZE - 1);
+        }
+
+        esp_err_t err = esp_partition_write(partition, cur_sector * SECTOR_SIZE + cur_slot * SLOT_SIZE,
+                                            page, n * SLOT_SIZE);
+        if (err == ESP_OK) {
+            for (uint32_t i = 0; i < n; i++) {
+                index_add(&sector_index[cur_sector], &page[i]);
+            }
+        } else {
+            ESP_LOGE(TAG, "Failed to write %u records (%s)", n, esp_err_to_name(err));
+        }
+        // Skip the slots either way; a failed write must not be retried over programmed bits
+        cur_slot += n;
+
+        xSemaphoreGive(flash_mutex);
+    }
+}
+
+// Copy a record into the RAM batch. Returns false and counts it dropped if the batch is full.
+static bool batch_push(event_record_t *rec)
+{
+    bool page_ready;
+    portENTER_CRITICAL(&batch_lock);
+    if (batch_count == EVENT_LOG_BATCH_RECORDS) {
+        dropped++;
+        portEXIT_CRITICAL(&batch_lock);
+        return false;
+    }
+    rec->seq = next_record_seq++;
+    batch[(batch_head + batch_count) % EVENT_LOG_BATCH_RECORDS] = *rec;
+    batch_count++;
+    page_ready = (batch_count >= SLOTS_PER_PAGE);
+    portEXIT_CRITICAL(&batch_lock);
+
+    if (page_ready) {
+        xTaskNotifyGive(writer_task_handle);
+    }
+    return true;
+}
+
+// Tie this boot to the wall clock once it is set, so its events can be converted
+static void queue_anchor(void)
+{
+    time_t now = time(NULL);
+    if (now < WALL_CLOCK_VALID) {
+        return;
+    }
+    event_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.timestamp = (uint32_t)(esp_timer_get_time() / 1000000);
+    rec.wall_time = (uint32_t)now;
+    rec.boot_id = boot_id;
+    rec.face_id = -1;
+    rec.flags = EVENT_FLAG_ANCHOR;
+    anchored = batch_push(&rec);
+}
+
+static void event_log_writer_task(void *param)
+{
+    while (true) {
+        // Woken early when a full page is waiting, otherwise flush whatever is pending
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(EVENT_LOG_FLUSH_INTERVAL_MS));
+        if (!anchored) {
+            queue_anchor();
+        }
+        flush_batch();
+    }
+}
+
+esp_err_t event_log_init(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY,
+                                         EVENT_LOG_PARTITION_LABEL);
+    if (!partition) {
+        ESP_LOGE(TAG, "Partition '%s' not found", EVENT_LOG_PARTITION_LABEL);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    sector_count = partition->size / SECTOR_SIZE;
+    if (sector_count < 2) {
+        ESP_LOGE(TAG, "Partition too small (%u bytes)", partition->size);
+        partition = NULL;
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    sector_index = (sector_index_t *)calloc(sector_count, sizeof(sector_index_t));
+    flash_mutex = xSemaphoreCreateMutex();
+    if (!sector_index || !flash_mutex) {
+        ESP_LOGE(TAG, "Failed to allocate event log state");
+        partition = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = scan_partition();
+    if (err != ESP_OK) {
+        partition = NULL;
+        return err;
+    }
+
+    // Lower priority than recognition so flash writes only use idle time
+    if (xTaskCreate(event_log_writer_task, "event_log", 4096, NULL, 2, &writer_task_handle) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create writer task");
+        partition = NULL;
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Event log ready: %u sectors, next seq %u, boot %u (scan took %lld ms)",
+             sector_count, next_record_seq, boot_id, (esp_timer_get_time() - start) / 1000);
+    return ESP_OK;
+}
+
+void event_log_append(int face_id, float similarity, const int box[4])
+{
+    if (!writer_task_handle) {
+        return;
+    }
+
+    event_record_t rec;
+    memset(&rec, 0, sizeof(rec));
+
+    rec.timestamp = (uint32_t)(esp_timer_get_time() / 1000000);
+    rec.boot_id = boot_id;
+    rec.face_id = (int16_t)face_id;
+    if (similarity < 0.0f) {
+        similarity = 0.0f;
+    } else if (similarity > 1.0f) {
+        similarity = 1.0f;
+    }
+    rec.similarity = (uint16_t)(similarity * 10000.0f);
+    for (int i = 0; i < 4; i++) {
+        rec.box[i] = (uint16_t)(box[i] < 0 ? 0 : box[i]);
+    }
+
+    batch_push(&rec);
+}
+
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+    int face_id;
+    bool bounded;        // Events of unanchored boots only match unbounded queries
+    uint32_t boot_time;  // Unix time this boot started, 0 while the clock is not set
+} query_t;
+
+// Unix time at which a boot started, 0 if that boot never learned the wall clock
+static uint32_t boot_start(uint16_t id, const query_t *q)
+{
+    if (id == boot_id) {
+        return q->boot_time;
+    }
+    for (uint32_t i = 0; i < anchor_count; i++) {
+        if (anchors[i].boot_id == id) {
+            return anchors[i].boot_time;
+        }
+    }
+    return 0;
+}
+
+// Unix time range of a sector's events, false if it is not known without reading them
+static bool sector_wall_range(const sector_index_t *idx, const query_t *q, uint32_t *lo, uint32_t *hi)
+{
+    uint32_t base = 0;
+    if (idx->wall_count != idx->count) {
+        if (idx->wall_count != 0 || idx->boot_min != idx->boot_max) {
+            return false;
+        }
+        base = boot_start(idx->boot_min, q);
+        if (base == 0) {
+            return false;
+        }
+    }
+    *lo = idx->t_min + base;
+    *hi = idx->t_max + base;
+    return true;
+}
+
+// Convert an event to Unix time in place and check it against the query
+static bool record_matches(event_record_t *rec, const query_t *q)
+{
+    if (rec->flags & EVENT_FLAG_ANCHOR) {
+        return false;
+    }
+    if (q->face_id != EVENT_LOG_ANY_ID && rec->face_id != q->face_id) {
+        return false;
+    }
+    if (!(rec->flags & EVENT_FLAG_WALL_CLOCK)) {
+        uint32_t base = boot_start(rec->boot_id, q);
+        if (base == 0) {
+            return !q->bounded;
+        }
+        rec->timestamp += base;
+        rec->flags |= EVENT_FLAG_WALL_CLOCK;
+    }
+    return rec->timestamp >= q->from && rec->timestamp <= q->to;
+}
+
+esp_err_t event_log_query(uint32_t from, uint32_t to, int face_id, event_log_cb_t cb, void *arg)
+{
+    if (!partition || !cb) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    query_t q = {};
+    q.from = from;
+    q.to = to;
+    q.face_id = face_id;
+    q.bounded = from != 0 || to != UINT32_MAX;
+    time_t now = time(NULL);
+    if (now >= WALL_CLOCK_VALID) {
+        q.boot_time = (uint32_t)(now - esp_timer_get_time() / 1000000);
+    }
+
+    uint32_t want_mask = (face_id == EVENT_LOG_ANY_ID) ? 0xFFFFFFFF : id_bit(face_id);
+    event_record_t page[SLOTS_PER_PAGE];
+    uint32_t last_seq = 0;
+    bool any_seen = false;
+
+    xSemaphoreTake(flash_mutex, portMAX_DELAY);
+    uint32_t newest = cur_sector;
+    xSemaphoreGive(flash_mutex);
+
+    // Walk from the oldest sector (the one after the newest) up to the newest
+    for (uint32_t i = 1; i <= sector_count; i++) {
+        uint32_t s = (newest + i) % sector_count;
+
+        xSemaphoreTake(flash_mutex, portMAX_DELAY);
+        sector_index_t idx = sector_index[s];
+        xSemaphoreGive(flash_mutex);
+
+        uint32_t lo, hi;
+        if (idx.sector_seq == 0 || idx.count == 0 || !(idx.id_mask & want_mask) ||
+            (sector_wall_range(&idx, &q, &lo, &hi) && (hi < from || lo > to))) {
+            continue;
+        }
+
+        bool sector_done = false;
+        for (uint32_t base = 0; base < SLOTS_PER_SECTOR && !sector_done; base += SLOTS_PER_PAGE) {
+            xSemaphoreTake(flash_mutex, portMAX_DELAY);
+            // The writer may have recycled the sector since the index was copied
+            bool recycled = (sector_index[s].sector_seq != idx.sector_seq);
+            esp_err_t err = recycled ? ESP_OK :
+                esp_partition_read(partition, s * SECTOR_SIZE + base * SLOT_SIZE, page, sizeof(page));
+            xSemaphoreGive(flash_mutex);
+            if (recycled || err != ESP_OK) {
+                break;
+            }
+
+            for (uint32_t j = 0; j < SLOTS_PER_PAGE; j++) {
+                if (base + j == 0) {
+                    continue;  // Sector header
+                }
+                if (slot_is_erased(&page[j])) {
+                    sector_done = true;
+                    break;
+                }
+                if (!record_is_valid(&page[j])) {
+                    continue;
+                }
+                last_seq = page[j].seq;
+                any_seen = true;
+                if (record_matches(&page[j], &q) && !cb(&page[j], arg)) {
+                    return ESP_OK;
+                }
+            }
+        }
+    }
+
+    // Finish with what the writer flushed during the walk, then with the records still
+    // in RAM. Both are copied under flash_mutex: the writer only moves records from the
+    // batch to flash while holding it, so none can slip between the two.
+    uint32_t pos_sector = newest;
+    uint32_t pos_slot = 1;
+    while (true) {
+        uint32_t n = 0;
+        xSemaphoreTake(flash_mutex, portMAX_DELAY);
+        while (n == 0 && (pos_sector != cur_sector || pos_slot < cur_slot)) {
+            if (pos_slot >= SLOTS_PER_SECTOR) {
+                pos_sector = (pos_sector + 1) % sector_count;
+                pos_slot = 1;
+                continue;
+            }
+            uint32_t end = (pos_sector == cur_sector) ? cur_slot : SLOTS_PER_SECTOR;
+            uint32_t k = MIN(end - pos_slot, (uint32_t)SLOTS_PER_PAGE);
+            esp_err_t err = esp_partition_read(partition, pos_sector * SECTOR_SIZE + pos_slot * SLOT_SIZE,
+                                               page, k * SLOT_SIZE);
+            pos_slot += k;
+            for (uint32_t j = 0; err == ESP_OK && j < k; j++) {
+                if (!slot_is_erased(&page[j]) && record_is_valid(&page[j]) &&
+                    (!any_seen || (int32_t)(page[j].seq - last_seq) > 0)) {
+                    page[n++] = page[j];
+                    last_seq = page[j].seq;
+                    any_seen = true;
+                }
+            }
+        }
+        if (n == 0) {
+            portENTER_CRITICAL(&batch_lock);
+            for (uint32_t k = 0; k < batch_count && n < SLOTS_PER_PAGE; k++) {
+                const event_record_t *rec = &batch[(batch_head + k) % EVENT_LOG_BATCH_RECORDS];
+                if (!any_seen || (int32_t)(rec->seq - last_seq) > 0) {
+                    page[n++] = *rec;
+                    last_seq = rec->seq;
+                    any_seen = true;
+                }
+            }
+            portEXIT_CRITICAL(&batch_lock);
+        }
+        xSemaphoreGive(flash_mutex);
+
+        if (n == 0) {
+            break;
+        }
+        for (uint32_t j = 0; j < n; j++) {
+            if (record_matches(&page[j], &q) && !cb(&page[j], arg)) {
+                return ESP_OK;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+uint32_t event_log_get_dropped(void)
+{
+    return dropped;
+}
@@ -0,0 +1,62 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+#define EVENT_LOG_PARTITION_LABEL "evlog"
+#define EVENT_LOG_BATCH_RECORDS 64     // Records buffered in RAM before they are dropped
+#define EVENT_LOG_FLUSH_INTERVAL_MS 1000  // Partial pages are flushed at least this often
+
+#define EVENT_LOG_ANY_ID -2  // Query wildcard for face_id
+
+#define EVENT_FLAG_WALL_CLOCK 0x01  // timestamp is Unix time, otherwise seconds since boot
+#define EVENT_FLAG_ANCHOR 0x02      // Ties boot_id to the wall clock, not an event
+
+// Events are stored in seconds since boot. Once the wall clock is set, an anchor
+// record with both times is written for the boot, and queries convert every event
+// of an anchored boot to Unix time. Records with EVENT_FLAG_WALL_CLOCK come from
+// older firmware that stored Unix time directly.
+
+// One recognition event, stored as a 32-byte slot in the log partition
+typedef struct __attribute__((packed)) {
+    uint32_t seq;         // Monotonic record sequence number
+    uint32_t timestamp;   // Seconds, see EVENT_FLAG_WALL_CLOCK
+    uint16_t boot_id;     // Incremented on every boot
+    int16_t face_id;      // Recognized face ID, -1 for an unknown face
+    uint16_t similarity;  // Similarity * 10000
+    uint16_t box[4];      // Face box [x1, y1, x2, y2]
+    uint8_t flags;
+    uint32_t wall_time;   // Unix time at timestamp, anchors only
+    uint8_t reserved[4];
+    uint8_t crc;          // CRC-8 over the preceding bytes
+} event_record_t;
+
+// Called for every record matching a query; return false to stop the query
+typedef bool (*event_log_cb_t)(const event_record_t *rec, void *arg);
+
+// Mount the log partition, rebuild the sector index and start the writer task
+esp_err_t event_log_init(void);
+
+// Queue an event for writing. Never blocks; drops the event if the RAM batch is full
+void event_log_append(int face_id, float similarity, const int box[4]);
+
+// Visit events in chronological order with from <= Unix time <= to. The callback
+// gets events of anchored boots converted to Unix time with EVENT_FLAG_WALL_CLOCK
+// set; events whose boot never learned the wall clock only match when from is 0
+// and to is UINT32_MAX. Pass EVENT_LOG_ANY_ID as face_id to match every identity.
+esp_err_t event_log_query(uint32_t from, uint32_t to, int face_id, event_log_cb_t cb, void *arg);
+
+// Number of events dropped because the RAM batch was full
+uint32_t event_log_get_dropped(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // EVENT_LOG_H
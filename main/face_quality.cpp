@@ -0,0 +1,177 @@
+#include "face_quality.h"
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+// Faces are sampled down to at most this many pixels per side before the blur
+// measure, so the cost is bounded and scores are comparable between face sizes
+#define BLUR_SAMPLE_SIZE 64
+
+// Landmark layout of MSRMNP results: left eye, left mouth corner, nose, right eye,
+// right mouth corner, as (x, y) pairs
+#define KP_LEFT_EYE 0
+#define KP_NOSE 4
+#define KP_RIGHT_EYE 6
+
+const face_quality_thresholds_t face_quality_recognize_thresholds = {
+    .min_size = FACE_QUALITY_RECOGNIZE_MIN_SIZE,
+    .max_yaw = FACE_QUALITY_RECOGNIZE_MAX_YAW,
+    .max_roll = FACE_QUALITY_RECOGNIZE_MAX_ROLL,
+    .min_blur = FACE_QUALITY_RECOGNIZE_MIN_BLUR,
+};
+
+const face_quality_thresholds_t face_quality_enroll_thresholds = {
+    .min_size = FACE_QUALITY_ENROLL_MIN_SIZE,
+    .max_yaw = FACE_QUALITY_ENROLL_MAX_YAW,
+    .max_roll = FACE_QUALITY_ENROLL_MAX_ROLL,
+    .min_blur = FACE_QUALITY_ENROLL_MIN_BLUR,
+};
+
+// Sample one row of the crop as 8-bit luma
+static inline void sample_gray_row(const uint8_t *rgb, int img_width, int y, int x0, int step, int n,
+                                   uint8_t *out)
+{
+    const uint8_t *p = rgb + ((size_t)y * img_width + x0) * 3;
+    const int stride = step * 3;
+    for (int i = 0; i < n; i++, p += stride) {
+        out[i] = (uint8_t)((p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8);
+    }
+}
+
+// Variance of the 4-neighbour Laplacian over the face box. Only three sampled rows
+// are kept at a time, and the inner loop works on whole rows of independent pixels
+// four at a time so the compiler can keep everything in registers.
+static float laplacian_variance(const dl::image::img_t &img, int x1, int y1, int x2, int y2)
+{
+    int w = x2 - x1;
+    int h = y2 - y1;
+    int step = (std::max(w, h) + BLUR_SAMPLE_SIZE - 1) / BLUR_SAMPLE_SIZE;
+    if (step < 1) {
+        step = 1;
+    }
+    int cols = w / step;
+    int rows = h / step;
+    if (cols < 3 || rows < 3) {
+        return 0.0f;
+    }
+
+    const uint8_t *rgb = (const uint8_t *)img.data;
+    uint8_t row_buf[3][BLUR_SAMPLE_SIZE + 1];
+    uint8_t *up = row_buf[0];
+    uint8_t *mid = row_buf[1];
+    uint8_t *down = row_buf[2];
+
+    sample_gray_row(rgb, img.width, y1, x1, step, cols, up);
+    sample_gray_row(rgb, img.width, y1 + step, x1, step, cols, mid);
+
+    int64_t sum = 0;
+    int64_t sum_sq = 0;
+    int count = 0;
+
+    for (int r = 2; r < rows; r++) {
+        sample_gray_row(rgb, img.width, y1 + r * step, x1, step, cols, down);
+
+        int32_t s = 0;
+        int32_t sq = 0;
+        int x = 1;
+        for (; x + 4 <= cols - 1; x += 4) {
+            int l0 = 4 * mid[x] - mid[x - 1] - mid[x + 1] - up[x] - down[x];
+            int l1 = 4 * mid[x + 1] - mid[x] - mid[x + 2] - up[x + 1] - down[x + 1];
+            int l2 = 4 * mid[x + 2] - mid[x + 1] - mid[x + 3] - up[x + 2] - down[x + 2];
+            int l3 = 4 * mid[x + 3] - mid[x + 2] - mid[x + 4] - up[x + 3] - down[x + 3];
+            s += l0 + l1 + l2 + l3;
+            sq += l0 * l0 + l1 * l1 + l2 * l2 + l3 * l3;
+        }
+        for (; x < cols - 1; x++) {
+            int l = 4 * mid[x] - mid[x - 1] - mid[x + 1] - up[x] - down[x];
+            s += l;
+            sq += l * l;
+        }
+        sum += s;
+        sum_sq += sq;
+        count += cols - 2;
+
+        // Rotate the row buffers
+        uint8_t *tmp = up;
+        up = mid;
+        mid = down;
+        down = tmp;
+    }
+
+    float mean = (float)sum / count;
+    return (float)sum_sq / count - mean * mean;
+}
+
+face_quality_reason_t face_quality_assess(const dl::image::img_t &img, const dl::detect::result_t &face,
+                                          const face_quality_thresholds_t &thr, face_quality_t *out)
+{
+    face_quality_t q;
+    memset(&q, 0, sizeof(q));
+
+    int x1 = std::max(face.box[0], 0);
+    int y1 = std::max(face.box[1], 0);
+    int x2 = std::min(face.box[2], (int)img.width);
+    int y2 = std::min(face.box[3], (int)img.height);
+    q.width = std::max(x2 - x1, 0);
+    q.height = std::max(y2 - y1, 0);
+
+    if (std::min(q.width, q.height) < thr.min_size) {
+        q.reason = FACE_QUALITY_TOO_SMALL;
+    } else if (face.keypoint.size() < 10) {
+        q.reason = FACE_QUALITY_NO_LANDMARKS;
+    } else {
+        // Order the eyes by x so a mirrored sensor gives the same angles
+        int lx = face.keypoint[KP_LEFT_EYE], ly = face.keypoint[KP_LEFT_EYE + 1];
+        int rx = face.keypoint[KP_RIGHT_EYE], ry = face.keypoint[KP_RIGHT_EYE + 1];
+        if (lx > rx) {
+            std::swap(lx, rx);
+            std::swap(ly, ry);
+        }
+        float half_eye_dist = std::max((rx - lx) / 2.0f, 1.0f);
+        q.yaw = (face.keypoint[KP_NOSE] - (lx + rx) / 2.0f) / half_eye_dist;
+        q.roll = atan2f((float)(ry - ly), (float)(rx - lx)) * 180.0f / (float)M_PI;
+
+        if (fabsf(q.yaw) > thr.max_yaw) {
+            q.reason = FACE_QUALITY_YAW;
+        } else if (fabsf(q.roll) > thr.max_roll) {
+            q.reason = FACE_QUALITY_ROLL;
+        } else {
+            q.blur = laplacian_variance(img, x1, y1, x2, y2);
+            if (q.blur < thr.min_blur) {
+                q.reason = FACE_QUALITY_BLURRY;
+            }
+        }
+    }
+
+    if (q.reason == FACE_QUALITY_OK) {
+        float size_score = fminf(1.0f, std::min(q.width, q.height) / (2.0f * thr.min_size));
+        float pose_score = (1.0f - fabsf(q.yaw) / thr.max_yaw) * (1.0f - fabsf(q.roll) / thr.max_roll);
+        float blur_score = fminf(1.0f, q.blur / (4.0f * thr.min_blur));
+        q.score = size_score * (0.5f + 0.5f * pose_score) * (0.5f + 0.5f * blur_score);
+    }
+
+    if (out) {
+        *out = q;
+    }
+    return q.reason;
+}
+
+const char *face_quality_reason_str(face_quality_reason_t reason)
+{
+    switch (reason) {
+        case FACE_QUALITY_OK:
+            return "OK";
+        case FACE_QUALITY_TOO_SMALL:
+            return "Face too small, move closer to the camera";
+        case FACE_QUALITY_NO_LANDMARKS:
+            return "Face landmarks not found";
+        case FACE_QUALITY_YAW:
+            return "Face turned sideways, look at the camera";
+        case FACE_QUALITY_ROLL:
+            return "Head tilted, keep your head level";
+        case FACE_QUALITY_BLURRY:
+            return "Image too blurry, hold still or improve lighting";
+    }
+    return "Unknown";
+}
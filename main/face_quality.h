@@ -0,0 +1,57 @@
+#ifndef FACE_QUALITY_H
+#define FACE_QUALITY_H
+
+#include "dl_image_define.hpp"
+#include "dl_detect_define.hpp"
+
+// Thresholds for faces that are worth embedding during live recognition
+#define FACE_QUALITY_RECOGNIZE_MIN_SIZE 40     // Pixels, shorter side of the box
+#define FACE_QUALITY_RECOGNIZE_MAX_YAW 0.6f    // Nose offset relative to half the eye distance
+#define FACE_QUALITY_RECOGNIZE_MAX_ROLL 30.0f  // Degrees
+#define FACE_QUALITY_RECOGNIZE_MIN_BLUR 15.0f  // Laplacian variance
+
+// Stricter thresholds for faces that become stored templates
+#define FACE_QUALITY_ENROLL_MIN_SIZE 80
+#define FACE_QUALITY_ENROLL_MAX_YAW 0.35f
+#define FACE_QUALITY_ENROLL_MAX_ROLL 15.0f
+#define FACE_QUALITY_ENROLL_MIN_BLUR 30.0f
+
+typedef enum {
+    FACE_QUALITY_OK = 0,
+    FACE_QUALITY_TOO_SMALL,
+    FACE_QUALITY_NO_LANDMARKS,
+    FACE_QUALITY_YAW,
+    FACE_QUALITY_ROLL,
+    FACE_QUALITY_BLURRY,
+} face_quality_reason_t;
+
+typedef struct {
+    int min_size;
+    float max_yaw;
+    float max_roll;
+    float min_blur;
+} face_quality_thresholds_t;
+
+typedef struct {
+    int width;      // Box size in pixels
+    int height;
+    float yaw;      // Signed, 0 is frontal
+    float roll;     // Degrees, 0 is level eyes
+    float blur;     // Laplacian variance of the face crop, higher is sharper
+    float score;    // Combined 0..1 score for ranking faces
+    face_quality_reason_t reason;
+} face_quality_t;
+
+extern const face_quality_thresholds_t face_quality_recognize_thresholds;
+extern const face_quality_thresholds_t face_quality_enroll_thresholds;
+
+// Score a detected face on an RGB888 image. The cheap geometric checks run first and
+// the blur measure is only computed when they pass. Returns FACE_QUALITY_OK if the
+// face meets every threshold.
+face_quality_reason_t face_quality_assess(const dl::image::img_t &img, const dl::detect::result_t &face,
+                                          const face_quality_thresholds_t &thr, face_quality_t *out);
+
+// Human readable reason, suitable for API responses
+const char *face_quality_reason_str(face_quality_reason_t reason);
+
+#endif // FACE_QUALITY_H
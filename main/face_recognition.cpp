@@ -5,89 +5,597 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include <atomic>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
 #include "esp_spiffs.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 #include "nvs_flash.h"
 #include "nvs.h"
 #include "dl_image_jpeg.hpp"
 #include "human_face_detect.hpp"
 #include "human_face_recognition.hpp"
+#include "face_quality.h"
+#include "face_store.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "roi.h"
+#include "rcu.h"
+#include "inference.h"
 
 static const char *TAG = "face_recognition";
 
+// Tiled detection. MSR works on a small fixed input, so a whole frame is scaled
+// down until distant faces vanish. Tiles of at most FACE_TILE_WIDTH x
+// FACE_TILE_HEIGHT are scaled down far less, and an overview of the whole frame,
+// sampled down to about one tile, finds the faces too large for a tile.
+#define FACE_TILE_WIDTH 352
+#define FACE_TILE_HEIGHT 272
+#define FACE_TILE_OVERLAP 64      // Faces up to this size lie wholly inside some tile
+#define FACE_TILE_MAX_GRID 3      // Tiles per row and column, larger frames get larger tiles
+#define FACE_TILE_CONTAINED 0.7f  // A box this much inside a better one is a cut-off copy of it
+#define FACE_MAX_REGIONS (FACE_TILE_MAX_GRID * FACE_TILE_MAX_GRID + 1)
+
+static_assert(FACE_MAX_REGIONS >= ROI_MAX_COUNT && FACE_MAX_REGIONS - 1 <= ROI_DECODE_MAX_RECTS,
+              "region arrays hold the tiles, the overview and the regions of interest");
+
 // High-level wrapper classes - much simpler!
 static human_face_detect::MSRMNP *face_detector = nullptr;
-static HumanFaceRecognizer *face_recognizer = nullptr;
+static HumanFaceFeat *face_feat = nullptr;
+static human_face_detect::MSR *presence_detector = nullptr;  // Created on first use of presence mode
 
-static face_id_t face_database[MAX_FACE_ID_COUNT];
-static int32_t enrolled_count = 0;
-static const char *db_path = "/spiflash/face.db";
+// Metadata by slot. face_id_t.id is the stable ID the rest of the firmware and the
+// API see; it owns the templates in face_store and is never handed out twice.
+typedef struct {
+    face_id_t faces[MAX_FACE_ID_COUNT];
+    int32_t enrolled_count;
+    int32_t next_face_id;
+} face_directory_t;
+
+// The current directory is never changed in place. Readers use it inside an RCU
+// read section without locks; writers take directory_mutex, change a copy in the
+// other buffer and publish it, then wait out the readers of the old one before
+// the next writer may reuse it. So recognition always sees one consistent version
+// and never waits for an enrollment, delete or reset on another task.
+static face_directory_t directories[2];
+static std::atomic<face_directory_t *> directory{&directories[0]};
+static SemaphoreHandle_t directory_mutex = NULL;  // Serializes writers
+static const char *legacy_db_path = "/spiflash/face.db";
+static const char *legacy_db_done_path = "/spiflash/face.db.old";      // Kept after the import
+static const char *legacy_metadata_path = "/spiflash/face_meta.old";  // Names of the legacy faces
+static const char *templates_path = "/spiflash/face_feat.dat";
 static const char *nvs_namespace = "face_db";
 static const char *metadata_path = "/spiflash/face_meta.dat";
+static const char *metadata_tmp_path = "/spiflash/face_meta.tmp";
+static const char *last_error = "";
+static const char *pipeline_nvs_key = "pipeline";
+static const char *duplicate_nvs_key = "duplicates";
+static char last_error_buf[64];  // For messages that name a face
+
+static const char *msr_model = "human_face_detect_msr_s8_v1.espdl";
+static const char *mnp_model = "human_face_detect_mnp_s8_v1.espdl";
+
+// Pipeline mode and thresholds. Set from any task, applied to the detectors by
+// the task that runs them, right before the next frame.
+static face_pipeline_config_t pipeline_config = {
+    .mode = FACE_PIPELINE_FULL,
+    .msr_score_thr = 0.3f,
+    .msr_nms_thr = 0.3f,
+    .mnp_score_thr = 0.3f,
+    .mnp_nms_thr = 0.3f,
+    .tiled = false,
+};
+static bool pipeline_dirty = false;
+static portMUX_TYPE pipeline_lock = portMUX_INITIALIZER_UNLOCKED;
+static face_warmup_stats_t warmup_stats = {};
+static face_duplicate_config_t duplicate_config = {
+    .policy = FACE_DUPLICATE_REJECT,
+    .threshold = FACE_DUPLICATE_DEFAULT_THRESHOLD,
+};
+static int duplicate_id = -1;  // Enrolled ID the last enrollment matched
+static int last_face_count = 0;        // Faces in the previous recognition frame
+static bool identify_pending = false;  // A new face appeared and has not been identified yet
+
+// Candidate face collected during a burst enrollment
+typedef struct {
+    float score;  // Quality score of the face
+    float *feat;  // Normalized embedding, row of face_burst::feats
+} burst_candidate_t;
+
+struct face_burst {
+    int max_frames;
+    int frames;                 // Frames offered so far
+    int count;                  // Frames that produced a usable face
+    const char *reject_reason;  // Why the last unusable frame was rejected
+    float *feats;               // max_frames rows of FACE_FEAT_MAX_LEN
+    burst_candidate_t candidates[FACE_BURST_MAX_FRAMES];
+};
+
+// The current directory, valid until directory_read_end
+static const face_directory_t *directory_read_begin(uint32_t *rcu)
+{
+    *rcu = rcu_read_lock();
+    return directory.load(std::memory_order_acquire);
+}
+
+static void directory_read_end(uint32_t rcu)
+{
+    rcu_read_unlock(rcu);
+}
+
+// Private copy of the current directory to change. Other writers wait until it
+// is published with directory_publish or dropped with directory_abort.
+static face_directory_t *directory_edit(void)
+{
+    xSemaphoreTake(directory_mutex, portMAX_DELAY);
+    const face_directory_t *current = directory.load(std::memory_order_relaxed);
+    face_directory_t *next = current == &directories[0] ? &directories[1] : &directories[0];
+    *next = *current;
+    return next;
+}
+
+static void directory_publish(face_directory_t *dir)
+{
+    directory.store(dir, std::memory_order_release);
+    rcu_synchronize();
+    xSemaphoreGive(directory_mutex);
+}
+
+static void directory_abort(void)
+{
+    xSemaphoreGive(directory_mutex);
+}
 
 // Save face metadata to file
-static esp_err_t save_face_metadata(void)
+static esp_err_t save_face_metadata(const face_directory_t *dir)
 {
-    FILE *f = fopen(metadata_path, "wb");
+    FILE *f = fopen(metadata_tmp_path, "wb");
     if (f == NULL) {
         ESP_LOGE(TAG, "Failed to open metadata file for writing");
         return ESP_FAIL;
     }
-    
+
     // Write enrolled count
-    fwrite(&enrolled_count, sizeof(enrolled_count), 1, f);
-    
+    bool ok = fwrite(&dir->enrolled_count, sizeof(dir->enrolled_count), 1, f) == 1;
+
     // Write face database
-    fwrite(face_database, sizeof(face_database), 1, f);
-    
-    fclose(f);
-    ESP_LOGI(TAG, "Face metadata saved (%d faces)", enrolled_count);
+    ok = ok && fwrite(dir->faces, sizeof(dir->faces), 1, f) == 1;
+    ok = ok && fwrite(&dir->next_face_id, sizeof(dir->next_face_id), 1, f) == 1;
+
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || face_store_replace_file(metadata_tmp_path, metadata_path) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to write metadata file");
+        unlink(metadata_tmp_path);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Face metadata saved (%d faces)", (int)dir->enrolled_count);
     return ESP_OK;
 }
 
 // Load face metadata from file
-static esp_err_t load_face_metadata(void)
+static esp_err_t load_face_metadata(face_directory_t *dir)
 {
-    FILE *f = fopen(metadata_path, "rb");
+    FILE *f = face_store_open_latest(metadata_path, metadata_tmp_path);
     if (f == NULL) {
         ESP_LOGI(TAG, "No metadata file found, starting fresh");
         return ESP_ERR_NOT_FOUND;
     }
-    
+
     // Read enrolled count
-    size_t count_read = fread(&enrolled_count, sizeof(enrolled_count), 1, f);
+    size_t count_read = fread(&dir->enrolled_count, sizeof(dir->enrolled_count), 1, f);
     if (count_read != 1) {
         ESP_LOGE(TAG, "Failed to read enrolled count");
         fclose(f);
         return ESP_FAIL;
     }
-    
+
     // Read face database
-    size_t db_read = fread(face_database, sizeof(face_database), 1, f);
+    size_t db_read = fread(dir->faces, sizeof(dir->faces), 1, f);
     if (db_read != 1) {
         ESP_LOGE(TAG, "Failed to read face database");
         fclose(f);
         return ESP_FAIL;
     }
-    
+
+    // Files written before IDs were stable end here; their IDs are the slots
+    if (fread(&dir->next_face_id, sizeof(dir->next_face_id), 1, f) != 1) {
+        dir->next_face_id = 0;
+        for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+            if (dir->faces[i].enrolled) {
+                dir->next_face_id = std::max<int32_t>(dir->next_face_id, dir->faces[i].id + 1);
+            }
+        }
+    }
+
     fclose(f);
-    ESP_LOGI(TAG, "Face metadata loaded (%d faces)", enrolled_count);
-    
+    ESP_LOGI(TAG, "Face metadata loaded (%d faces, next ID %d)", (int)dir->enrolled_count, (int)dir->next_face_id);
+
     // Log loaded faces
     for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
-        if (face_database[i].enrolled) {
-            ESP_LOGI(TAG, "  - ID %d: %s", face_database[i].id, face_database[i].name);
+        if (dir->faces[i].enrolled) {
+            ESP_LOGI(TAG, "  - ID %d: %s", dir->faces[i].id, dir->faces[i].name);
+        }
+    }
+
+    return ESP_OK;
+}
+
+// Slot of an enrolled face ID, -1 if there is none
+static int find_slot(const face_directory_t *dir, int id)
+{
+    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+        if (dir->faces[i].enrolled && dir->faces[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Make metadata and templates agree. Metadata is written last, so templates without
+// an enrolled owner are left over from an interrupted enrollment and are dropped,
+// and faces without templates are left over from an interrupted delete.
+static void reconcile_database(face_directory_t *dir)
+{
+    int ids[MAX_FACE_ID_COUNT];
+    int n = 0;
+    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+        if (dir->faces[i].enrolled) {
+            ids[n++] = dir->faces[i].id;
+        }
+    }
+    face_store_retain(ids, n);
+
+    dir->enrolled_count = 0;
+    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+        face_id_t *face = &dir->faces[i];
+        if (!face->enrolled) {
+            continue;
+        }
+        face->template_count = face_store_count_owner(face->id);
+        if (face->template_count == 0) {
+            ESP_LOGW(TAG, "Face '%s' (ID %d) has no templates, removing it", face->name, face->id);
+            memset(face, 0, sizeof(face_id_t));
+            continue;
+        }
+        dir->enrolled_count++;
+    }
+}
+
+static float dot(const float *a, const float *b, int len)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < len; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Header of the recognizer's database file, followed by num_feats_total entries
+// of a uint16_t ID (0 once deleted, else counting from 1) and feat_len floats
+typedef struct __attribute__((packed)) {
+    uint16_t num_feats_total;
+    uint16_t num_feats_valid;
+    uint16_t feat_len;
+} legacy_db_header_t;
+
+// Move the metadata of the recognizer's database aside before metadata in the new
+// format can be written in its place
+static void stash_legacy_metadata(void)
+{
+    struct stat st;
+    if (stat(legacy_db_path, &st) != 0 || stat(legacy_metadata_path, &st) == 0 || stat(metadata_path, &st) != 0) {
+        return;
+    }
+    if (rename(metadata_path, legacy_metadata_path) != 0) {
+        ESP_LOGE(TAG, "Failed to move the legacy metadata aside");
+    }
+}
+
+// Import the faces of the recognizer's database as single-template faces. The
+// old files are kept; the database is renamed once its faces are saved in the
+// new store, so an import interrupted before that is repeated, skipping the
+// names it already enrolled.
+static void import_legacy_database(face_directory_t *dir)
+{
+    struct stat st;
+    if (stat(legacy_db_path, &st) != 0) {
+        return;
+    }
+
+    FILE *f = fopen(legacy_db_path, "rb");
+    legacy_db_header_t hdr;
+    if (!f || fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.feat_len == 0 || hdr.feat_len > FACE_FEAT_MAX_LEN ||
+        (face_store_get_feat_len() != hdr.feat_len && face_store_set_feat_len(hdr.feat_len) != ESP_OK)) {
+        ESP_LOGE(TAG, "Legacy face database %s not imported (unreadable or other model), left in place",
+                 legacy_db_path);
+        if (f) {
+            fclose(f);
+        }
+        return;
+    }
+
+    // Names by slot; the old firmware stored the face with recognizer ID k in slot k - 1
+    face_id_t *names = (face_id_t *)calloc(MAX_FACE_ID_COUNT, sizeof(face_id_t));
+    FILE *mf = fopen(legacy_metadata_path, "rb");
+    int32_t legacy_count;
+    if (names && mf && (fread(&legacy_count, sizeof(legacy_count), 1, mf) != 1 ||
+                        fread(names, sizeof(face_id_t), MAX_FACE_ID_COUNT, mf) != MAX_FACE_ID_COUNT)) {
+        memset(names, 0, MAX_FACE_ID_COUNT * sizeof(face_id_t));
+    }
+    if (mf) {
+        fclose(mf);
+    }
+    float *feat = (float *)heap_caps_malloc(hdr.feat_len * sizeof(float), MALLOC_CAP_SPIRAM);
+    if (!names || !feat) {
+        ESP_LOGE(TAG, "Legacy face database %s not imported (out of memory), left in place", legacy_db_path);
+        fclose(f);
+        free(names);
+        heap_caps_free(feat);
+        return;
+    }
+
+    int imported = 0;
+    bool ok = true;
+    for (int i = 0; i < hdr.num_feats_total && ok; i++) {
+        uint16_t legacy_id;
+        if (fread(&legacy_id, sizeof(legacy_id), 1, f) != 1 || fread(feat, sizeof(float), hdr.feat_len, f) != hdr.feat_len) {
+            ok = false;
+            break;
+        }
+        if (legacy_id == 0) {
+            continue;  // Deleted
+        }
+
+        char name[MAX_NAME_LENGTH];
+        int named = legacy_id - 1;
+        if (named < MAX_FACE_ID_COUNT && names[named].enrolled && names[named].name[0]) {
+            snprintf(name, sizeof(name), "%s", names[named].name);
+        } else {
+            snprintf(name, sizeof(name), "Face %u", legacy_id);
+        }
+        bool present = false;
+        int slot = -1;
+        for (int j = 0; j < MAX_FACE_ID_COUNT; j++) {
+            present = present || (dir->faces[j].enrolled && strcmp(dir->faces[j].name, name) == 0);
+            if (slot < 0 && !dir->faces[j].enrolled) {
+                slot = j;
+            }
+        }
+        if (present) {
+            continue;
+        }
+
+        float norm = sqrtf(dot(feat, feat, hdr.feat_len));
+        if (slot < 0 || norm == 0.0f) {
+            ESP_LOGW(TAG, "Legacy face '%s' not imported (%s)", name, slot < 0 ? "directory full" : "empty template");
+            continue;
+        }
+        for (int k = 0; k < hdr.feat_len; k++) {
+            feat[k] /= norm;
+        }
+        const float *feats[1] = {feat};
+        int id = dir->next_face_id;
+        if (face_store_add(id, feats, 1) != ESP_OK) {
+            ok = false;
+            break;
+        }
+        face_id_t *face = &dir->faces[slot];
+        face->id = id;
+        face->enrolled = true;
+        snprintf(face->name, sizeof(face->name), "%s", name);
+        face->template_count = 1;
+        dir->enrolled_count++;
+        dir->next_face_id++;
+        imported++;
+    }
+    fclose(f);
+    free(names);
+    heap_caps_free(feat);
+
+    // Templates first and metadata last, as for enrollment
+    ok = ok && (imported == 0 || (face_store_save() == ESP_OK && save_face_metadata(dir) == ESP_OK));
+    if (!ok || rename(legacy_db_path, legacy_db_done_path) != 0) {
+        ESP_LOGE(TAG, "Legacy face database %s not fully imported (%d faces so far), left in place and retried "
+                 "at the next boot", legacy_db_path, imported);
+        return;
+    }
+    ESP_LOGW(TAG, "Imported %d face(s) from the legacy face database, kept as %s and %s", imported,
+             legacy_db_done_path, legacy_metadata_path);
+}
+
+static bool pipeline_config_valid(const face_pipeline_config_t *config)
+{
+    auto in_range = [](float thr) { return thr > 0.0f && thr < 1.0f; };
+    return config->mode >= FACE_PIPELINE_PRESENCE && config->mode <= FACE_PIPELINE_FULL &&
+           in_range(config->msr_score_thr) && in_range(config->msr_nms_thr) &&
+           in_range(config->mnp_score_thr) && in_range(config->mnp_nms_thr);
+}
+
+// Read a settings blob from NVS, false if it is missing or has another size
+static bool load_settings(const char *key, void *data, size_t size)
+{
+    nvs_handle_t handle;
+    if (nvs_open(nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t len = size;
+    bool ok = nvs_get_blob(handle, key, data, &len) == ESP_OK && len == size;
+    nvs_close(handle);
+    return ok;
+}
+
+static esp_err_t save_settings(const char *key, const void *data, size_t size)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(nvs_namespace, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, key, data, size);
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    return err;
+}
+
+static void load_pipeline_config(void)
+{
+    face_pipeline_config_t stored = {};
+    // Settings saved before tiled detection existed lack the last field
+    if ((load_settings(pipeline_nvs_key, &stored, sizeof(stored)) ||
+         load_settings(pipeline_nvs_key, &stored, offsetof(face_pipeline_config_t, tiled))) &&
+        pipeline_config_valid(&stored)) {
+        pipeline_config = stored;
+        ESP_LOGI(TAG, "Pipeline mode %s", face_pipeline_mode_name(stored.mode));
+    }
+}
+
+static bool duplicate_config_valid(const face_duplicate_config_t *config)
+{
+    return config->policy >= FACE_DUPLICATE_ALLOW && config->policy <= FACE_DUPLICATE_REJECT &&
+           config->threshold > 0.0f && config->threshold < 1.0f;
+}
+
+static void load_duplicate_config(void)
+{
+    face_duplicate_config_t stored;
+    if (load_settings(duplicate_nvs_key, &stored, sizeof(stored)) && duplicate_config_valid(&stored)) {
+        duplicate_config = stored;
+    }
+}
+
+void face_recognition_get_duplicate_config(face_duplicate_config_t *config)
+{
+    *config = duplicate_config;
+}
+
+esp_err_t face_recognition_set_duplicate_config(const face_duplicate_config_t *config)
+{
+    if (!duplicate_config_valid(config)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    duplicate_config = *config;
+    esp_err_t err = save_settings(duplicate_nvs_key, config, sizeof(*config));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Duplicate policy applied but not saved (%s)", esp_err_to_name(err));
+    }
+    ESP_LOGI(TAG, "Duplicate policy %s above %.2f", face_duplicate_policy_name(config->policy), config->threshold);
+    return ESP_OK;
+}
+
+const char *face_duplicate_policy_name(face_duplicate_policy_t policy)
+{
+    switch (policy) {
+        case FACE_DUPLICATE_ALLOW: return "allow";
+        case FACE_DUPLICATE_ATTACH: return "attach";
+        case FACE_DUPLICATE_REJECT: return "reject";
+    }
+    return "?";
+}
+
+bool face_duplicate_policy_parse(const char *name, face_duplicate_policy_t *policy)
+{
+    for (int p = FACE_DUPLICATE_ALLOW; p <= FACE_DUPLICATE_REJECT; p++) {
+        if (strcmp(name, face_duplicate_policy_name((face_duplicate_policy_t)p)) == 0) {
+            *policy = (face_duplicate_policy_t)p;
+            return true;
         }
     }
-    
+    return false;
+}
+
+int face_recognition_get_duplicate_id(void)
+{
+    return duplicate_id;
+}
+
+void face_recognition_get_pipeline(face_pipeline_config_t *config)
+{
+    portENTER_CRITICAL(&pipeline_lock);
+    *config = pipeline_config;
+    portEXIT_CRITICAL(&pipeline_lock);
+}
+
+esp_err_t face_recognition_set_pipeline(const face_pipeline_config_t *config)
+{
+    if (!pipeline_config_valid(config)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    portENTER_CRITICAL(&pipeline_lock);
+    pipeline_config = *config;
+    pipeline_dirty = true;
+    portEXIT_CRITICAL(&pipeline_lock);
+
+    esp_err_t err = save_settings(pipeline_nvs_key, config, sizeof(*config));
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Pipeline settings applied but not saved (%s)", esp_err_to_name(err));
+    }
+    ESP_LOGI(TAG, "Pipeline mode %s%s, MSR %.2f/%.2f, MNP %.2f/%.2f", face_pipeline_mode_name(config->mode),
+             config->tiled ? " (tiled)" : "", config->msr_score_thr, config->msr_nms_thr, config->mnp_score_thr,
+             config->mnp_nms_thr);
     return ESP_OK;
 }
 
+const char *face_pipeline_mode_name(face_pipeline_mode_t mode)
+{
+    switch (mode) {
+        case FACE_PIPELINE_PRESENCE: return "presence";
+        case FACE_PIPELINE_LANDMARKS: return "landmarks";
+        case FACE_PIPELINE_FULL: return "full";
+    }
+    return "?";
+}
+
+bool face_pipeline_mode_parse(const char *name, face_pipeline_mode_t *mode)
+{
+    for (int m = FACE_PIPELINE_PRESENCE; m <= FACE_PIPELINE_FULL; m++) {
+        if (strcmp(name, face_pipeline_mode_name((face_pipeline_mode_t)m)) == 0) {
+            *mode = (face_pipeline_mode_t)m;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Latest pipeline settings, applying changed thresholds to the detectors first.
+// Only called by whoever is about to run a detector.
+static face_pipeline_config_t apply_pipeline_config(void)
+{
+    portENTER_CRITICAL(&pipeline_lock);
+    face_pipeline_config_t config = pipeline_config;
+    bool dirty = pipeline_dirty;
+    pipeline_dirty = false;
+    portEXIT_CRITICAL(&pipeline_lock);
+
+    if (dirty) {
+        face_detector->set_score_thr(config.msr_score_thr, 0).set_nms_thr(config.msr_nms_thr, 0);
+        face_detector->set_score_thr(config.mnp_score_thr, 1).set_nms_thr(config.mnp_nms_thr, 1);
+        if (presence_detector) {
+            presence_detector->set_score_thr(config.msr_score_thr).set_nms_thr(config.msr_nms_thr);
+        }
+    }
+    if (config.mode == FACE_PIPELINE_PRESENCE && !presence_detector) {
+        presence_detector = new human_face_detect::MSR(msr_model, config.msr_score_thr, config.msr_nms_thr);
+    }
+    return config;
+}
+
 void face_recognition_init(void)
 {
     ESP_LOGI(TAG, "Initializing face recognition");
-    
+
+    if (rcu_init() != ESP_OK || !(directory_mutex = xSemaphoreCreateMutex())) {
+        ESP_LOGE(TAG, "Failed to create the face database locks");
+        return;
+    }
+
     // Mount SPIFFS partition for face database
     esp_vfs_spiffs_conf_t conf = {
         .base_path = "/spiflash",
@@ -95,7 +603,7 @@ void face_recognition_init(void)
         .max_files = 5,
         .format_if_mount_failed = true
     };
-    
+
     esp_err_t ret = esp_vfs_spiffs_register(&conf);
     if (ret != ESP_OK) {
         if (ret == ESP_FAIL) {
@@ -107,7 +615,7 @@ void face_recognition_init(void)
         }
         return;
     }
-    
+
     size_t total = 0, used = 0;
     ret = esp_spiffs_info(conf.partition_label, &total, &used);
     if (ret != ESP_OK) {
@@ -115,293 +623,1193 @@ void face_recognition_init(void)
     } else {
         ESP_LOGI(TAG, "SPIFFS partition: total: %d, used: %d", total, used);
     }
-    
+
+    load_pipeline_config();
+    load_duplicate_config();
+
     // Create face detector with MSR+MNP models (include .espdl extension)
     face_detector = new human_face_detect::MSRMNP(
-        "human_face_detect_msr_s8_v1.espdl",  // MSR model for detection
-        0.3f,  // MSR score threshold
-        0.3f,  // MSR NMS threshold  
-        "human_face_detect_mnp_s8_v1.espdl",  // MNP model for landmarks
-        0.3f,  // MNP score threshold
-        0.3f   // MNP NMS threshold
+        msr_model,                       // MSR model for detection
+        pipeline_config.msr_score_thr,   // MSR score threshold
+        pipeline_config.msr_nms_thr,     // MSR NMS threshold
+        mnp_model,                       // MNP model for landmarks
+        pipeline_config.mnp_score_thr,   // MNP score threshold
+        pipeline_config.mnp_nms_thr      // MNP NMS threshold
     );
-    
-    // Check if face database file exists
-    struct stat st;
-    bool db_exists = (stat(db_path, &st) == 0);
-    
-    if (db_exists) {
-        ESP_LOGI(TAG, "Found existing face database (size: %ld bytes)", st.st_size);
-        
-        // Create face recognizer and load existing database
-        face_recognizer = new HumanFaceRecognizer(
-            db_path,
-            HumanFaceFeat::MFN_S8_V1,  // Recognition model
-            false  // Don't use lazy loading - load the database immediately
-        );
-        
-        // Load face metadata (names)
-        if (load_face_metadata() == ESP_OK) {
-            // Verify enrolled count matches what's in the database
-            int db_count = face_recognizer->get_num_feats();
-            if (db_count != enrolled_count) {
-                ESP_LOGW(TAG, "Metadata count (%d) doesn't match database count (%d), using database count", 
-                         enrolled_count, db_count);
-                enrolled_count = db_count;
-            }
-            ESP_LOGI(TAG, "Loaded %d enrolled faces from persistent storage", enrolled_count);
-        } else {
-            ESP_LOGW(TAG, "Failed to load metadata, starting fresh");
-            enrolled_count = 0;
-            memset(face_database, 0, sizeof(face_database));
-        }
-    } else {
-        ESP_LOGI(TAG, "No existing database found, creating new one");
-        
-        // Create face recognizer with fresh database
-        face_recognizer = new HumanFaceRecognizer(
-            db_path,
-            HumanFaceFeat::MFN_S8_V1,  // Recognition model
-            true  // Use lazy loading - database will be created on first use
-        );
-        
-        enrolled_count = 0;
-        memset(face_database, 0, sizeof(face_database));
+
+    // Feature extractor - matching against enrolled templates is done by face_store
+    face_feat = new HumanFaceFeat(HumanFaceFeat::MFN_S8_V1);
+
+    // The recognizer's database shares the metadata path with the new store
+    stash_legacy_metadata();
+
+    if (face_store_init(templates_path) != ESP_OK) {
+        return;
     }
-    
-    ESP_LOGI(TAG, "Face recognition initialized (%d enrolled faces)", enrolled_count);
-}
 
-int face_recognition_recognize(camera_fb_t *fb, char *name_out)
-{
-    if (!fb || !name_out || !face_detector || !face_recognizer) {
-        ESP_LOGE(TAG, "Invalid parameters or not initialized");
-        return -1;
+    face_directory_t *dir = directory_edit();
+    if (load_face_metadata(dir) != ESP_OK) {
+        memset(dir, 0, sizeof(*dir));
     }
+    reconcile_database(dir);
+    import_legacy_database(dir);
+    int enrolled = dir->enrolled_count;
+    directory_publish(dir);
+
+    ESP_LOGI(TAG, "Face recognition initialized (%d enrolled faces, %d templates)",
+             enrolled, face_store_count());
+}
 
+// Decode a JPEG frame to RGB888, the caller frees img.data with heap_caps_free
+static dl::image::img_t decode_frame(camera_fb_t *fb)
+{
     // Convert camera frame buffer to dl::image::img_t
     dl::image::jpeg_img_t jpeg_img = {
         .data = (void *)fb->buf,
         .data_len = (size_t)fb->len
     };
-    
+
     // Decode JPEG to RGB888
+    int64_t start = trace_now();
+    telemetry_subsys_t prev = telemetry_enter(TELEMETRY_SUBSYS_DECODE);
     auto img = dl::image::sw_decode_jpeg(jpeg_img, dl::image::DL_IMAGE_PIX_TYPE_RGB888);
+    telemetry_exit(prev);
+    trace_span(TRACE_STAGE_DECODE, start, trace_now());
     if (!img.data) {
         ESP_LOGE(TAG, "Failed to decode JPEG");
+    }
+    return img;
+}
+
+// Compute the L2-normalized embedding of one detected face into out (FACE_FEAT_MAX_LEN floats)
+static esp_err_t extract_feature(const dl::image::img_t &img, const dl::detect::result_t &face, float *out)
+{
+    telemetry_subsys_t prev = telemetry_enter(TELEMETRY_SUBSYS_RECOGNIZE);
+    dl::TensorBase *feat = face_feat->run(img, face.keypoint);
+    telemetry_exit(prev);
+    if (!feat) {
+        return ESP_FAIL;
+    }
+
+    int len = feat->get_size();
+    if (face_store_get_feat_len() != len && face_store_set_feat_len(len) != ESP_OK) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    const float *data = feat->get_element_ptr<float>();
+    float norm = 0.0f;
+    for (int i = 0; i < len; i++) {
+        norm += data[i] * data[i];
+    }
+    norm = norm > 0.0f ? 1.0f / sqrtf(norm) : 0.0f;
+    for (int i = 0; i < len; i++) {
+        out[i] = data[i] * norm;
+    }
+    return ESP_OK;
+}
+
+static std::list<dl::detect::result_t> &detect_faces(const dl::image::img_t &img)
+{
+    int64_t start = trace_now();
+    telemetry_subsys_t prev = telemetry_enter(TELEMETRY_SUBSYS_DETECT);
+    auto &results = face_detector->run(img);
+    telemetry_exit(prev);
+    trace_span(TRACE_STAGE_DETECT, start, trace_now());
+    return results;
+}
+
+// MSR only: boxes without landmarks, enough to tell whether someone is there
+static std::list<dl::detect::result_t> &detect_presence(const dl::image::img_t &img)
+{
+    int64_t start = trace_now();
+    telemetry_subsys_t prev = telemetry_enter(TELEMETRY_SUBSYS_DETECT);
+    auto &results = presence_detector->run(img);
+    telemetry_exit(prev);
+    trace_span(TRACE_STAGE_DETECT, start, trace_now());
+    return results;
+}
+
+// Part of the frame handed to the detector, at (x, y) in frame coordinates and
+// sampled down by scale
+typedef struct {
+    dl::image::img_t img;
+    int x;
+    int y;
+    int scale;
+} frame_region_t;
+
+// Detected face, box and landmarks in the coordinates of its region
+typedef struct {
+    int region;
+    dl::detect::result_t face;
+} region_face_t;
+
+// Regions detected by the caller and the tile helper together. Each region is
+// claimed by one of them through next, once ready says its pixels are decoded.
+typedef struct {
+    frame_region_t *regions;
+    roi_crop_t *crops;        // Source of the regions while they are decoding
+    int count;
+    bool presence;
+    face_pipeline_config_t config;
+    std::atomic<bool> ready[FACE_MAX_REGIONS];
+    std::atomic<int> next;
+    std::atomic<bool> aborted;  // Decoding failed, stop waiting for regions
+    std::vector<dl::detect::result_t> found[FACE_MAX_REGIONS];
+} detect_batch_t;
+
+static TaskHandle_t tile_helper = NULL;
+static QueueHandle_t tile_queue = NULL;       // Batches for the helper
+static SemaphoreHandle_t tile_done = NULL;    // Given when the helper has left a batch
+
+// Claim regions until none are left and detect faces in them. Returns false
+// if a region never got decoded.
+template <typename Detector, typename Presence>
+static bool detect_claimed(detect_batch_t *b, Detector &&detect, Presence &&presence)
+{
+    int i;
+    while ((i = b->next.fetch_add(1)) < b->count) {
+        // Only the helper waits: the caller claims regions once decoding is over,
+        // and its task notifications belong to the executor
+        while (!b->ready[i].load(std::memory_order_acquire)) {
+            if (b->aborted.load(std::memory_order_acquire)) {
+                return false;
+            }
+            ulTaskNotifyTake(pdTRUE, 1);
+        }
+        auto &results = b->presence ? presence(b->regions[i].img) : detect(b->regions[i].img);
+        b->found[i].assign(results.begin(), results.end());
+    }
+    return true;
+}
+
+// Second detector pair on the core the executor leaves free. Runs outside the inference executor,
+// so it keeps out of the telemetry attribution, which is per subsystem, not per task.
+static void tile_helper_task(void *arg)
+{
+    human_face_detect::MSRMNP *detector = nullptr;
+    human_face_detect::MSR *presence = nullptr;
+    while (true) {
+        detect_batch_t *b;
+        xQueueReceive(tile_queue, &b, portMAX_DELAY);
+        const face_pipeline_config_t &c = b->config;
+        if (!detector) {
+            // A second copy of the models, as large as the executor's
+            size_t psram = heap_caps_get_free_size(MALLOC_CAP_SPIRAM);
+            size_t internal = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+            detector = new human_face_detect::MSRMNP(msr_model, c.msr_score_thr, c.msr_nms_thr, mnp_model,
+                                                     c.mnp_score_thr, c.mnp_nms_thr);
+            ESP_LOGI(TAG, "Tile helper detector loaded: %u KB PSRAM, %u KB internal RAM",
+                     (unsigned)((psram - heap_caps_get_free_size(MALLOC_CAP_SPIRAM)) / 1024),
+                     (unsigned)((internal - heap_caps_get_free_size(MALLOC_CAP_INTERNAL)) / 1024));
+        }
+        if (b->presence && !presence) {
+            presence = new human_face_detect::MSR(msr_model, c.msr_score_thr, c.msr_nms_thr);
+        }
+        detector->set_score_thr(c.msr_score_thr, 0).set_nms_thr(c.msr_nms_thr, 0);
+        detector->set_score_thr(c.mnp_score_thr, 1).set_nms_thr(c.mnp_nms_thr, 1);
+        if (presence) {
+            presence->set_score_thr(c.msr_score_thr).set_nms_thr(c.msr_nms_thr);
+        }
+        detect_claimed(
+            b,
+            [&](const dl::image::img_t &img) -> std::list<dl::detect::result_t> & {
+                int64_t start = trace_now();
+                auto &results = detector->run(img);
+                trace_span(TRACE_STAGE_DETECT, start, trace_now());
+                return results;
+            },
+            [&](const dl::image::img_t &img) -> std::list<dl::detect::result_t> & {
+                int64_t start = trace_now();
+                auto &results = presence->run(img);
+                trace_span(TRACE_STAGE_DETECT, start, trace_now());
+                return results;
+            });
+        xSemaphoreGive(tile_done);
+    }
+}
+
+// Started with the first tiled frame; the helper's models load on its first batch
+static bool start_tile_helper(void)
+{
+    if (tile_helper) {
+        return true;
+    }
+    tile_queue = xQueueCreate(1, sizeof(detect_batch_t *));
+    tile_done = xSemaphoreCreateBinary();
+    if (!tile_queue || !tile_done ||
+        xTaskCreatePinnedToCore(tile_helper_task, "face_tiles", INFERENCE_TASK_STACK, NULL, INFERENCE_TASK_PRIORITY,
+                                &tile_helper, 1 - INFERENCE_TASK_CORE) != pdPASS) {
+        ESP_LOGW(TAG, "Failed to start the tile helper, tiles are detected on one core");
+        tile_helper = NULL;
+        return false;
+    }
+    return true;
+}
+
+static void batch_region_ready(int index, void *arg)
+{
+    detect_batch_t *b = (detect_batch_t *)arg;
+    const roi_crop_t &c = b->crops[index];
+    b->regions[index] = {{c.rgb, (uint16_t)(c.rect.w / c.scale), (uint16_t)(c.rect.h / c.scale),
+                          dl::image::DL_IMAGE_PIX_TYPE_RGB888},
+                         c.rect.x, c.rect.y, c.scale};
+    b->ready[index].store(true, std::memory_order_release);
+    if (tile_helper) {
+        xTaskNotifyGive(tile_helper);
+    }
+}
+
+// Set up a batch and hand it to the helper if it runs and there is more than one
+// region. Regions that are not decoded yet are marked ready by batch_region_ready.
+// Returns whether the helper takes part.
+static bool batch_begin(detect_batch_t *b, frame_region_t *regions, int count, bool presence, bool decoded)
+{
+    b->regions = regions;
+    b->count = count;
+    b->presence = presence;
+    face_recognition_get_pipeline(&b->config);
+    for (int i = 0; i < count; i++) {
+        b->ready[i].store(decoded, std::memory_order_relaxed);
+    }
+    detect_batch_t *posted = b;
+    return count > 1 && tile_helper && xQueueSend(tile_queue, &posted, 0) == pdTRUE;
+}
+
+// Detect the regions nobody claimed yet on this task, then wait for the helper
+static bool batch_finish(detect_batch_t *b, bool helped)
+{
+    bool ok = detect_claimed(b, detect_faces, detect_presence);
+    if (helped) {
+        xSemaphoreTake(tile_done, portMAX_DELAY);
+    }
+    return ok;
+}
+
+static int tile_grid(int frame, int tile)
+{
+    int n = (frame - FACE_TILE_OVERLAP + tile - FACE_TILE_OVERLAP - 1) / (tile - FACE_TILE_OVERLAP);
+    return std::clamp(n, 1, FACE_TILE_MAX_GRID);
+}
+
+// Overlapping tiles covering a w x h frame, in decoding order. Returns how many,
+// 1 for a frame that fits in one tile.
+static int layout_tiles(int w, int h, roi_rect_t *tiles)
+{
+    int cols = tile_grid(w, FACE_TILE_WIDTH);
+    int rows = tile_grid(h, FACE_TILE_HEIGHT);
+    int tile_w = (w + (cols - 1) * FACE_TILE_OVERLAP + cols - 1) / cols;
+    int tile_h = (h + (rows - 1) * FACE_TILE_OVERLAP + rows - 1) / rows;
+    for (int r = 0; r < rows; r++) {
+        for (int c = 0; c < cols; c++) {
+            int x = c == cols - 1 ? w - tile_w : c * (tile_w - FACE_TILE_OVERLAP);
+            int y = r == rows - 1 ? h - tile_h : r * (tile_h - FACE_TILE_OVERLAP);
+            tiles[r * cols + c] = {(uint16_t)x, (uint16_t)y, (uint16_t)tile_w, (uint16_t)tile_h};
+        }
+    }
+    return rows * cols;
+}
+
+// Decode a frame as tiles plus an overview and detect faces in them, the tiles
+// decoded first already being detected while the decoder works on the rest.
+// Returns the number of regions, 0 for a frame that needs no tiles, -1 on failure.
+static int decode_tiles(camera_fb_t *fb, frame_region_t *regions, bool presence, detect_batch_t *b)
+{
+    roi_rect_t tiles[FACE_MAX_REGIONS - 1];
+    int count = layout_tiles(fb->width, fb->height, tiles);
+    if (count == 1 || !start_tile_helper()) {
+        return 0;
+    }
+    int overview_scale = std::max((fb->width + FACE_TILE_WIDTH - 1) / FACE_TILE_WIDTH,
+                                  (fb->height + FACE_TILE_HEIGHT - 1) / FACE_TILE_HEIGHT);
+
+    roi_crop_t crops[FACE_MAX_REGIONS] = {};
+    b->crops = crops;
+    bool helped = batch_begin(b, regions, count + 1, presence, false);
+    int64_t start = trace_now();
+    telemetry_subsys_t prev = telemetry_enter(TELEMETRY_SUBSYS_DECODE);
+    int decoded = roi_decode_rects(fb->buf, fb->len, tiles, count, overview_scale, crops, batch_region_ready, b);
+    telemetry_exit(prev);
+    trace_span(TRACE_STAGE_DECODE, start, trace_now());
+    if (decoded != count + 1) {
+        // The helper may be detecting in a crop already reported ready, so the
+        // crops are freed only once it has left the batch
+        b->aborted.store(true, std::memory_order_release);
+        xTaskNotifyGive(tile_helper);
+        batch_finish(b, helped);
+        roi_free_crops(crops, count + 1);
         return -1;
     }
-    
-    // Detect faces
-    auto detect_results = face_detector->run(img);
-    
-    if (detect_results.size() > 0) {
-        ESP_LOGI(TAG, "Detected %zu face(s)", detect_results.size());
-        
-        // Recognize faces
-        auto results = face_recognizer->recognize(img, detect_results);
-        
-        if (results.size() > 0) {
-            // Get the best match
-            auto &best = results.front();
-            
-            // Find name from database
-            for (int i = 0; i < enrolled_count; i++) {
-                if (face_database[i].id == best.id) {
-                    strcpy(name_out, face_database[i].name);
-                    ESP_LOGI(TAG, "Recognized: %s (ID: %d, Similarity: %.3f)", 
-                             name_out, best.id, best.similarity);
-                    heap_caps_free(img.data);
-                    return best.id;
-                }
+    batch_finish(b, helped);
+    return decoded;
+}
+
+// Decode the regions of interest of a frame, or the whole frame if none are set
+// or none lies in this frame (regions set for a larger frame size).
+// Returns the number of regions, 0 on failure.
+static int decode_regions(camera_fb_t *fb, frame_region_t *regions)
+{
+    roi_crop_t crops[ROI_MAX_COUNT];
+    int count = 0;
+    if (roi_get(NULL, 0) > 0) {
+        int64_t start = trace_now();
+        telemetry_subsys_t prev = telemetry_enter(TELEMETRY_SUBSYS_DECODE);
+        count = roi_decode_jpeg(fb->buf, fb->len, crops);
+        telemetry_exit(prev);
+        trace_span(TRACE_STAGE_DECODE, start, trace_now());
+        if (count < 0) {
+            return 0;
+        }
+    }
+    if (count == 0) {
+        auto img = decode_frame(fb);
+        if (!img.data) {
+            return 0;
+        }
+        regions[0] = {img, 0, 0, 1};
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        regions[i].img = {crops[i].rgb, crops[i].rect.w, crops[i].rect.h, dl::image::DL_IMAGE_PIX_TYPE_RGB888};
+        regions[i].x = crops[i].rect.x;
+        regions[i].y = crops[i].rect.y;
+        regions[i].scale = 1;
+    }
+    return count;
+}
+
+static void free_regions(frame_region_t *regions, int count)
+{
+    for (int i = 0; i < count; i++) {
+        heap_caps_free(regions[i].img.data);
+    }
+}
+
+// Box of a detected face in frame coordinates
+static void frame_box(const frame_region_t *regions, const region_face_t &f, int box[4])
+{
+    const frame_region_t &r = regions[f.region];
+    box[0] = f.face.box[0] * r.scale + r.x;
+    box[1] = f.face.box[1] * r.scale + r.y;
+    box[2] = f.face.box[2] * r.scale + r.x;
+    box[3] = f.face.box[3] * r.scale + r.y;
+}
+
+// Whether box b is a second detection of face a: mostly the same box, or, for
+// a face cut by a tile edge, mostly inside it
+static bool same_face(const int *a, const int *b)
+{
+    return roi_box_iou(a, b) > 0.5f || roi_box_containment(a, b) > FACE_TILE_CONTAINED;
+}
+
+// Faces of a finished batch, best first. A face seen by two overlapping regions
+// is kept once.
+static std::vector<region_face_t> merge_regions(const frame_region_t *regions, detect_batch_t *b)
+{
+    std::vector<region_face_t> faces;
+    for (int r = 0; r < b->count; r++) {
+        for (auto &face : b->found[r]) {
+            faces.push_back({r, face});
+        }
+    }
+    if (b->count == 1) {
+        return faces;
+    }
+
+    std::stable_sort(faces.begin(), faces.end(), [](const region_face_t &a, const region_face_t &b) {
+        return a.face.score > b.face.score;
+    });
+    std::vector<region_face_t> kept;
+    for (auto &f : faces) {
+        int box[4];
+        frame_box(regions, f, box);
+        bool duplicate = false;
+        for (auto &k : kept) {
+            int kept_box[4];
+            frame_box(regions, k, kept_box);
+            if (same_face(kept_box, box)) {
+                duplicate = true;
+                break;
             }
-        } else {
-            ESP_LOGD(TAG, "Face detected but not recognized");
         }
-    } else {
-        ESP_LOGD(TAG, "No face detected");
+        if (!duplicate) {
+            kept.push_back(f);
+        }
+    }
+    return kept;
+}
+
+// Run the detector on every decoded region, together with the tile helper once
+// it runs, best face first
+static std::vector<region_face_t> detect_regions(frame_region_t *regions, int count, bool presence)
+{
+    detect_batch_t b = {};
+    bool helped = batch_begin(&b, regions, count, presence, true);
+    batch_finish(&b, helped);
+    return merge_regions(regions, &b);
+}
+
+void face_recognition_warmup(int width, int height)
+{
+    if (!face_detector || !face_feat) {
+        return;
+    }
+    dl::image::img_t img = {
+        .data = heap_caps_malloc((size_t)width * height * 3, MALLOC_CAP_SPIRAM),
+        .width = (uint16_t)width,
+        .height = (uint16_t)height,
+        .pix_type = dl::image::DL_IMAGE_PIX_TYPE_RGB888,
+    };
+    if (!img.data) {
+        ESP_LOGW(TAG, "No memory for the warm-up frame, skipping it");
+        return;
+    }
+    memset(img.data, 128, (size_t)width * height * 3);
+
+    // A flat frame has no faces, so drop the score thresholds for the warm-up to
+    // make MSR hand candidates to MNP and run both stages
+    face_detector->set_score_thr(0.01f, 0).set_score_thr(0.01f, 1);
+    int64_t detect_us[2];
+    for (int i = 0; i < 2; i++) {
+        int64_t start = esp_timer_get_time();
+        detect_faces(img);
+        if (presence_detector) {
+            detect_presence(img);
+        }
+        detect_us[i] = esp_timer_get_time() - start;
     }
+    portENTER_CRITICAL(&pipeline_lock);
+    pipeline_dirty = true;
+    portEXIT_CRITICAL(&pipeline_lock);
+    apply_pipeline_config();
 
+    // Landmarks of a frontal face in the middle of the frame, in the detector's
+    // order: left eye, left mouth corner, nose, right eye, right mouth corner
+    int cx = width / 2;
+    int cy = height / 2;
+    int s = std::min(width, height) / 4;
+    dl::detect::result_t face;
+    face.box = {cx - s, cy - s, cx + s, cy + s};
+    face.keypoint = {cx - s * 2 / 5, cy - s / 4, cx - s / 3, cy + s / 2, cx, cy + s / 8,
+                     cx + s * 2 / 5, cy - s / 4, cx + s / 3, cy + s / 2};
+    float *feat = (float *)heap_caps_malloc(FACE_FEAT_MAX_LEN * sizeof(float), MALLOC_CAP_SPIRAM);
+    int64_t embed_us[2] = {0, 0};
+    for (int i = 0; feat && i < 2; i++) {
+        int64_t start = esp_timer_get_time();
+        extract_feature(img, face, feat);
+        embed_us[i] = esp_timer_get_time() - start;
+    }
+    heap_caps_free(feat);
     heap_caps_free(img.data);
-    return -1;
+
+    warmup_stats.detect_cold_us = detect_us[0];
+    warmup_stats.detect_warm_us = detect_us[1];
+    warmup_stats.embed_cold_us = embed_us[0];
+    warmup_stats.embed_warm_us = embed_us[1];
+    ESP_LOGI(TAG, "Warm-up at %dx%d: detect %lld -> %lld ms, embed %lld -> %lld ms", width, height,
+             detect_us[0] / 1000, detect_us[1] / 1000, embed_us[0] / 1000, embed_us[1] / 1000);
 }
 
-int face_recognition_enroll(camera_fb_t *fb, const char *name)
+void face_recognition_get_warmup(face_warmup_stats_t *stats)
 {
-    if (!fb || !name || !face_detector || !face_recognizer) {
-        ESP_LOGE(TAG, "Cannot enroll: invalid params or not initialized");
+    *stats = warmup_stats;
+}
+
+int face_recognition_recognize(camera_fb_t *fb, char *name_out, face_match_t *match_out)
+{
+    if (match_out) {
+        memset(match_out, 0, sizeof(face_match_t));
+        match_out->id = -1;
+    }
+
+    if (!fb || !name_out || !face_detector || !face_feat) {
+        ESP_LOGE(TAG, "Invalid parameters or not initialized");
         return -1;
     }
 
-    // Convert camera frame buffer to dl::image::img_t
-    dl::image::jpeg_img_t jpeg_img = {
-        .data = (void *)fb->buf,
-        .data_len = (size_t)fb->len
+    face_pipeline_config_t pipeline = apply_pipeline_config();
+
+    // Detect faces, in tiles if asked to and the whole frame is being scanned
+    frame_region_t regions[FACE_MAX_REGIONS];
+    std::vector<region_face_t> faces;
+    bool presence = pipeline.mode == FACE_PIPELINE_PRESENCE;
+    int region_count = 0;
+    if (pipeline.tiled && roi_get(NULL, 0) == 0) {
+        detect_batch_t batch = {};
+        region_count = decode_tiles(fb, regions, presence, &batch);
+        if (region_count < 0) {
+            return -1;
+        }
+        faces = merge_regions(regions, &batch);
+    }
+    if (region_count == 0) {
+        region_count = decode_regions(fb, regions);
+        if (region_count == 0) {
+            return -1;
+        }
+        faces = detect_regions(regions, region_count, presence);
+    }
+
+    // Cheaper modes only identify when a new face shows up, retrying on later
+    // frames until one passes the quality checks
+    int face_count = faces.size();
+    if (face_count > last_face_count) {
+        identify_pending = true;
+    } else if (face_count == 0) {
+        identify_pending = false;
+    }
+    last_face_count = face_count;
+    bool identify = pipeline.mode == FACE_PIPELINE_FULL || identify_pending;
+
+    if (faces.empty()) {
+        ESP_LOGD(TAG, "No face detected");
+        free_regions(regions, region_count);
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "Detected %zu face(s)", faces.size());
+
+    face_match_face_t results[FACE_RESULT_MAX_FACES];
+    int count = std::min<int>(faces.size(), FACE_RESULT_MAX_FACES);
+    auto reset_results = [&]() {
+        count = std::min<int>(faces.size(), FACE_RESULT_MAX_FACES);
+        for (int i = 0; i < count; i++) {
+            memset(&results[i], 0, sizeof(results[i]));
+            results[i].id = -1;
+            frame_box(regions, faces[i], results[i].box);
+        }
     };
-    
-    // Decode JPEG to RGB888
-    auto img = dl::image::sw_decode_jpeg(jpeg_img, dl::image::DL_IMAGE_PIX_TYPE_RGB888);
+    reset_results();
+    if (match_out) {
+        match_out->face_count = faces.size();
+        memcpy(match_out->box, results[0].box, sizeof(match_out->box));
+        match_out->result_count = count;
+        memcpy(match_out->faces, results, count * sizeof(results[0]));
+    }
+
+    if (!identify) {
+        free_regions(regions, region_count);
+        return -1;
+    }
+    if (pipeline.mode == FACE_PIPELINE_PRESENCE) {
+        // Escalating: alignment for the embedding needs the landmarks
+        faces = detect_regions(regions, region_count, false);
+        if (faces.empty()) {
+            free_regions(regions, region_count);
+            return -1;
+        }
+        reset_results();
+    }
+
+    // Identify every face, skipping those too small, turned away or blurred before
+    // paying for their embedding
+    int64_t recognize_start = trace_now();
+    float *feat = (float *)heap_caps_malloc(FACE_FEAT_MAX_LEN * sizeof(float), MALLOC_CAP_SPIRAM);
+    if (!feat) {
+        ESP_LOGE(TAG, "Failed to allocate the face embedding");
+        free_regions(regions, region_count);
+        return -1;
+    }
+    int identified = 0;
+    for (int i = 0; i < count; i++) {
+        const region_face_t &f = faces[i];
+        if (face_quality_assess(regions[f.region].img, f.face, face_quality_recognize_thresholds, NULL) !=
+            FACE_QUALITY_OK) {
+            continue;
+        }
+        if (extract_feature(regions[f.region].img, f.face, feat) != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to compute face embedding");
+            continue;
+        }
+        float similarity = 0.0f;
+        results[i].id = face_store_match(feat, &similarity);
+        results[i].similarity = std::max(similarity, 0.0f);
+        results[i].identified = true;
+        identified++;
+    }
+    heap_caps_free(feat);
+    free_regions(regions, region_count);
+    if (identified == 0) {
+        ESP_LOGD(TAG, "Skipped %d low-quality face(s)", count);
+        return -1;
+    }
+    identify_pending = false;
+    trace_span(TRACE_STAGE_RECOGNIZE, recognize_start, trace_now());
+
+    // Names are copied out of the snapshot the IDs were looked up in. The best
+    // known face is the result, else the first one that was identified.
+    int best = -1;
+    uint32_t rcu;
+    const face_directory_t *dir = directory_read_begin(&rcu);
+    for (int i = 0; i < count; i++) {
+        face_match_face_t *r = &results[i];
+        if (!r->identified) {
+            continue;
+        }
+        int slot = r->id >= 0 ? find_slot(dir, r->id) : -1;
+        if (slot < 0 || r->similarity < FACE_RECOGNITION_THRESHOLD) {
+            r->id = -1;
+        }
+        if (best < 0 || (r->id >= 0 && (results[best].id < 0 || r->similarity > results[best].similarity))) {
+            best = i;
+            if (r->id >= 0) {
+                strcpy(name_out, dir->faces[slot].name);
+            }
+        }
+    }
+    directory_read_end(rcu);
+
+    const face_match_face_t *r = &results[best];
+    if (match_out) {
+        match_out->id = r->id;
+        match_out->similarity = r->similarity;
+        match_out->identified = true;
+        memcpy(match_out->box, r->box, sizeof(match_out->box));
+        memcpy(match_out->faces, results, count * sizeof(results[0]));
+    }
+    if (r->id >= 0) {
+        ESP_LOGI(TAG, "Recognized: %s (ID: %d, Similarity: %.3f, %d of %d face(s) identified)", name_out, r->id,
+                 r->similarity, identified, count);
+        return r->id;
+    }
+
+    ESP_LOGD(TAG, "Face detected but not recognized (best similarity %.3f)", r->similarity);
+    return -1;
+}
+
+int face_recognition_identify_all(camera_fb_t *fb, face_result_t *faces, int max_faces)
+{
+    if (!fb || !faces || !face_detector || !face_feat) {
+        return -1;
+    }
+    apply_pipeline_config();
+
+    dl::image::img_t img = decode_frame(fb);
     if (!img.data) {
-        ESP_LOGE(TAG, "Failed to decode JPEG");
         return -1;
     }
+    // Copied, the detector reuses its result list on the next run
+    std::list<dl::detect::result_t> detected = detect_faces(img);
+
+    float *feat = (float *)heap_caps_malloc(FACE_FEAT_MAX_LEN * sizeof(float), MALLOC_CAP_SPIRAM);
+    int n = 0;
+    for (const auto &face : detected) {
+        if (n == max_faces) {
+            break;
+        }
+        face_result_t *out = &faces[n++];
+        memset(out, 0, sizeof(*out));
+        out->id = -1;
+        out->score = face.score;
+        for (int k = 0; k < 4 && k < (int)face.box.size(); k++) {
+            out->box[k] = face.box[k];
+        }
+        for (int k = 0; k < 10 && k < (int)face.keypoint.size(); k++) {
+            out->keypoints[k] = face.keypoint[k];
+        }
+        if (!feat || face.keypoint.size() < 10 || extract_feature(img, face, feat) != ESP_OK) {
+            continue;
+        }
+
+        float similarity = 0.0f;
+        int id = face_store_match(feat, &similarity);
+        out->similarity = std::max(similarity, 0.0f);
+        uint32_t rcu;
+        const face_directory_t *dir = directory_read_begin(&rcu);
+        int slot = id >= 0 ? find_slot(dir, id) : -1;
+        if (slot >= 0 && similarity >= FACE_RECOGNITION_THRESHOLD) {
+            out->id = id;
+            snprintf(out->name, sizeof(out->name), "%s", dir->faces[slot].name);
+        }
+        directory_read_end(rcu);
+    }
+    heap_caps_free(feat);
+    heap_caps_free(img.data);
 
-    ESP_LOGI(TAG, "Converted to RGB888 for enrollment: %dx%d", img.width, img.height);
+    ESP_LOGI(TAG, "Identified %d of %zu face(s) in a %dx%d upload", n, detected.size(), img.width, img.height);
+    return n;
+}
+
+face_burst_t *face_recognition_burst_begin(int max_frames)
+{
+    if (max_frames < 1 || max_frames > FACE_BURST_MAX_FRAMES) {
+        return NULL;
+    }
+
+    face_burst_t *burst = (face_burst_t *)calloc(1, sizeof(face_burst_t));
+    if (!burst) {
+        return NULL;
+    }
+    burst->feats = (float *)heap_caps_malloc((size_t)max_frames * FACE_FEAT_MAX_LEN * sizeof(float),
+                                             MALLOC_CAP_SPIRAM);
+    if (!burst->feats) {
+        free(burst);
+        return NULL;
+    }
+    burst->max_frames = max_frames;
+    burst->reject_reason = "No face detected";
+    return burst;
+}
+
+int face_recognition_burst_add(face_burst_t *burst, camera_fb_t *fb)
+{
+    if (!burst || !fb || !face_detector || !face_feat) {
+        return -1;
+    }
+    if (burst->count >= burst->max_frames) {
+        return 0;
+    }
+    burst->frames++;
+
+    auto img = decode_frame(fb);
+    if (!img.data) {
+        burst->reject_reason = "Failed to decode JPEG";
+        return 0;
+    }
 
     // Detect faces
-    ESP_LOGI(TAG, "Running face detection...");
-    auto detect_results = face_detector->run(img);
-    
-    ESP_LOGI(TAG, "Detection complete, found %zu face(s)", detect_results.size());
-    
+    auto detect_results = detect_faces(img);
     if (detect_results.size() == 0) {
-        ESP_LOGE(TAG, "No face detected in image. Try better lighting or a clearer face view.");
+        burst->reject_reason = "No face detected";
         heap_caps_free(img.data);
-        return -1;
+        return 0;
     }
-    
+
     if (detect_results.size() > 1) {
-        ESP_LOGW(TAG, "Multiple faces detected (%zu), using first one", detect_results.size());
+        ESP_LOGW(TAG, "Multiple faces detected (%zu), using the best one", detect_results.size());
     }
 
-    // Get the first detected face
-    auto &face = detect_results.front();
-    ESP_LOGI(TAG, "Face detected - Score: %.3f, Box: [%d,%d,%d,%d]", 
-             face.score, face.box[0], face.box[1], face.box[2], face.box[3]);
-    
-    // Debug: Check if keypoints are present
-    ESP_LOGI(TAG, "Face has %zu keypoints", face.keypoint.size());
+    // Pick the best face that meets the enrollment quality thresholds
+    const dl::detect::result_t *best = NULL;
+    face_quality_t best_quality = {};
+    face_quality_reason_t reject_reason = FACE_QUALITY_OK;
+    for (auto &face : detect_results) {
+        face_quality_t quality;
+        face_quality_reason_t reason = face_quality_assess(img, face, face_quality_enroll_thresholds, &quality);
+        if (reason != FACE_QUALITY_OK) {
+            if (&face == &detect_results.front()) {
+                reject_reason = reason;
+            }
+            continue;
+        }
+        if (!best || quality.score > best_quality.score) {
+            best = &face;
+            best_quality = quality;
+        }
+    }
+
+    if (!best) {
+        ESP_LOGW(TAG, "Face rejected: %s", face_quality_reason_str(reject_reason));
+        burst->reject_reason = face_quality_reason_str(reject_reason);
+        heap_caps_free(img.data);
+        return 0;
+    }
+
+    ESP_LOGI(TAG, "Face detected - Score: %.3f, Box: [%d,%d,%d,%d], Quality: %.2f (yaw %.2f, roll %.1f, blur %.0f)",
+             best->score, best->box[0], best->box[1], best->box[2], best->box[3],
+             best_quality.score, best_quality.yaw, best_quality.roll, best_quality.blur);
 
-    // Enroll the face
-    esp_err_t ret = face_recognizer->enroll(img, detect_results);
-    
+    burst_candidate_t *cand = &burst->candidates[burst->count];
+    cand->feat = burst->feats + (size_t)burst->count * FACE_FEAT_MAX_LEN;
+    cand->score = best_quality.score;
+    esp_err_t err = extract_feature(img, *best, cand->feat);
     heap_caps_free(img.data);
-    
-    if (ret == ESP_OK) {
-        // Get the new ID (last enrolled)
-        enrolled_count = face_recognizer->get_num_feats();
-        int id = enrolled_count - 1;
-        
-        // Update our local database
-        if (id < MAX_FACE_ID_COUNT) {
-            face_database[id].id = id;
-            face_database[id].enrolled = true;
-            strncpy(face_database[id].name, name, MAX_NAME_LENGTH - 1);
-            face_database[id].name[MAX_NAME_LENGTH - 1] = '\0';
-            face_database[id].template_count = 1;
-            
-            // Save metadata to persistent storage
-            save_face_metadata();
-            
-            ESP_LOGI(TAG, "Successfully enrolled '%s' with ID %d (Total enrolled: %d)", 
-                     name, id, enrolled_count);
+
+    if (err != ESP_OK) {
+        burst->reject_reason = "Failed to compute face embedding";
+        return 0;
+    }
+    burst->count++;
+    return 1;
+}
+
+// Add templates to the enrolled face in slot of dir, as many as fit under MAX_FACE_TEMPLATES
+static int attach_templates(face_directory_t *dir, int slot, const float *const *feats, int n)
+{
+    face_id_t *face = &dir->faces[slot];
+    int id = face->id;
+    duplicate_id = id;
+    n = std::min(n, MAX_FACE_TEMPLATES - face->template_count);
+    if (n <= 0) {
+        ESP_LOGI(TAG, "'%s' (ID %d) already has %d templates, nothing added", face->name, id,
+                 face->template_count);
+        last_error = "";
+        return id;
+    }
+
+    esp_err_t err = face_store_add(id, feats, n);
+    if (err == ESP_OK && face_store_save() != ESP_OK) {
+        face_store_remove_last(id, n);
+        err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+        last_error = "Failed to save face database";
+        ESP_LOGE(TAG, "Enrollment failed: %s", last_error);
+        return -1;
+    }
+    // Template counts are rebuilt from the store at boot if this save is lost
+    face->template_count += n;
+    save_face_metadata(dir);
+
+    ESP_LOGI(TAG, "Attached %d template(s) to '%s' (ID %d), now %d", n, face->name, id, face->template_count);
+    last_error = "";
+    return id;
+}
+
+int face_recognition_burst_commit(face_burst_t *burst, const char *name, int max_templates, bool centroid)
+{
+    duplicate_id = -1;
+    if (!burst || !name || !face_feat) {
+        last_error = "Face recognition not initialized";
+        return -1;
+    }
+    if (burst->count == 0) {
+        last_error = burst->reject_reason;
+        ESP_LOGE(TAG, "Enrollment failed: %s", last_error);
+        return -1;
+    }
+    max_templates = std::max(1, std::min(max_templates, MAX_FACE_TEMPLATES));
+    int feat_len = face_store_get_feat_len();
+
+    // Best frames first, then keep those that add something the chosen ones lack
+    burst_candidate_t *order[FACE_BURST_MAX_FRAMES];
+    for (int i = 0; i < burst->count; i++) {
+        order[i] = &burst->candidates[i];
+    }
+    std::sort(order, order + burst->count, [](const burst_candidate_t *a, const burst_candidate_t *b) {
+        return a->score > b->score;
+    });
+
+    const float *chosen[MAX_FACE_TEMPLATES];
+    int n_chosen = 0;
+    for (int i = 0; i < burst->count && n_chosen < max_templates; i++) {
+        bool diverse = true;
+        for (int j = 0; j < n_chosen && diverse; j++) {
+            diverse = dot(order[i]->feat, chosen[j], feat_len) < FACE_BURST_DIVERSITY_MAX_SIM;
+        }
+        if (diverse) {
+            chosen[n_chosen++] = order[i]->feat;
+        }
+    }
+
+    // Optionally collapse the chosen frames into a single averaged template
+    float *mean = NULL;
+    if (centroid && n_chosen > 1) {
+        mean = (float *)heap_caps_calloc(feat_len, sizeof(float), MALLOC_CAP_SPIRAM);
+        if (!mean) {
+            last_error = "Memory allocation failed";
+            return -1;
+        }
+        for (int j = 0; j < n_chosen; j++) {
+            for (int k = 0; k < feat_len; k++) {
+                mean[k] += chosen[j][k];
+            }
+        }
+        float norm = sqrtf(dot(mean, mean, feat_len));
+        for (int k = 0; k < feat_len; k++) {
+            mean[k] /= norm;
+        }
+        chosen[0] = mean;
+        n_chosen = 1;
+    }
+
+    // Look for the person among the enrolled faces before giving them a new ID
+    int dup_owner = -1;
+    float dup_sim = -1.0f;
+    for (int i = 0; i < n_chosen; i++) {
+        float sim;
+        int owner = face_store_match(chosen[i], &sim);
+        if (owner >= 0 && sim > dup_sim) {
+            dup_owner = owner;
+            dup_sim = sim;
+        }
+    }
+    // Changes go to a copy of the directory that is only published once saved
+    face_directory_t *dir = directory_edit();
+    int dup_slot = dup_owner >= 0 ? find_slot(dir, dup_owner) : -1;
+    if (dup_slot >= 0 && dup_sim >= duplicate_config.threshold) {
+        bool same_name = strncmp(dir->faces[dup_slot].name, name, MAX_NAME_LENGTH - 1) == 0;
+        if (same_name || duplicate_config.policy == FACE_DUPLICATE_ATTACH) {
+            int id = attach_templates(dir, dup_slot, chosen, n_chosen);
+            if (id >= 0) {
+                directory_publish(dir);
+            } else {
+                directory_abort();
+            }
+            heap_caps_free(mean);
             return id;
         }
+        if (duplicate_config.policy == FACE_DUPLICATE_REJECT) {
+            duplicate_id = dup_owner;
+            snprintf(last_error_buf, sizeof(last_error_buf), "Already enrolled as '%s' (ID %d)",
+                     dir->faces[dup_slot].name, dup_owner);
+            directory_abort();
+            last_error = last_error_buf;
+            ESP_LOGW(TAG, "Enrollment of '%s' rejected: %s, similarity %.3f", name, last_error, dup_sim);
+            heap_caps_free(mean);
+            return -1;
+        }
+    }
+
+    int slot = -1;
+    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+        if (!dir->faces[i].enrolled) {
+            slot = i;
+            break;
+        }
+    }
+
+    // Templates are written first and the metadata last, so an interrupted commit
+    // leaves only orphan templates that reconcile_database() drops on the next boot.
+    // Readers that match the new templates before the directory is published see
+    // an unknown ID and report an unknown face.
+    int id = dir->next_face_id;
+    esp_err_t err = ESP_ERR_NO_MEM;
+    if (slot >= 0) {
+        err = face_store_add(id, chosen, n_chosen);
+    }
+    if (err == ESP_OK) {
+        face_id_t *face = &dir->faces[slot];
+        face->id = id;
+        face->enrolled = true;
+        strncpy(face->name, name, MAX_NAME_LENGTH - 1);
+        face->name[MAX_NAME_LENGTH - 1] = '\0';
+        face->template_count = n_chosen;
+        dir->enrolled_count++;
+        dir->next_face_id++;
+
+        if (face_store_save() != ESP_OK || save_face_metadata(dir) != ESP_OK) {
+            // Roll back so RAM matches what is on flash; the copy is dropped
+            face_store_remove_owner(id);
+            face_store_save();
+            err = ESP_FAIL;
+        }
+    }
+    int enrolled = dir->enrolled_count;
+    if (err == ESP_OK) {
+        directory_publish(dir);
+    } else {
+        directory_abort();
+    }
+    heap_caps_free(mean);
+
+    if (err != ESP_OK) {
+        last_error = (slot < 0 || err == ESP_ERR_NO_MEM) ? "Face database full" : "Failed to save face database";
+        ESP_LOGE(TAG, "Enrollment failed: %s", last_error);
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "Successfully enrolled '%s' with ID %d from %d of %d frames, %d template(s) (Total enrolled: %d)",
+             name, id, burst->count, burst->frames, n_chosen, enrolled);
+    last_error = "";
+    return id;
+}
+
+void face_recognition_burst_end(face_burst_t *burst)
+{
+    if (burst) {
+        heap_caps_free(burst->feats);
+        free(burst);
     }
-    
-    ESP_LOGE(TAG, "Enrollment failed");
-    return -1;
+}
+
+int face_recognition_enroll(camera_fb_t *fb, const char *name)
+{
+    if (!fb || !name || !face_detector || !face_feat) {
+        ESP_LOGE(TAG, "Cannot enroll: invalid params or not initialized");
+        last_error = "Face recognition not initialized";
+        return -1;
+    }
+
+    // A single frame is a burst of one
+    face_burst_t *burst = face_recognition_burst_begin(1);
+    if (!burst) {
+        last_error = "Memory allocation failed";
+        return -1;
+    }
+    face_recognition_burst_add(burst, fb);
+    int id = face_recognition_burst_commit(burst, name, 1, false);
+    face_recognition_burst_end(burst);
+    return id;
 }
 
 int face_recognition_delete_all(void)
 {
-    if (!face_recognizer) {
+    if (!face_feat) {
         return ESP_FAIL;
     }
-    
-    esp_err_t ret = face_recognizer->clear_all_feats();
+
+    face_directory_t *dir = directory_edit();
+    face_store_clear();
+    esp_err_t ret = face_store_save();
     if (ret == ESP_OK) {
-        enrolled_count = 0;
-        memset(face_database, 0, sizeof(face_database));
-        
-        // Delete metadata file
-        unlink(metadata_path);
-        
+        // Keep next_face_id in the metadata file, so deleted IDs are not handed out again
+        int32_t next_face_id = dir->next_face_id;
+        memset(dir, 0, sizeof(*dir));
+        dir->next_face_id = next_face_id;
+        save_face_metadata(dir);
+        directory_publish(dir);
+
         ESP_LOGI(TAG, "Deleted all faces");
+    } else {
+        directory_abort();
     }
     return ret;
 }
 
 int face_recognition_get_enrolled_count(void)
 {
-    return enrolled_count;
+    uint32_t rcu;
+    int count = directory_read_begin(&rcu)->enrolled_count;
+    directory_read_end(rcu);
+    return count;
 }
 
 esp_err_t face_recognition_get_info(int id, face_id_t *info)
 {
-    if (!info || id < 0 || id >= MAX_FACE_ID_COUNT) {
+    if (!info || id < 0) {
         return ESP_ERR_INVALID_ARG;
     }
-    
-    if (!face_database[id].enrolled) {
-        return ESP_ERR_NOT_FOUND;
+
+    uint32_t rcu;
+    const face_directory_t *dir = directory_read_begin(&rcu);
+    int slot = find_slot(dir, id);
+    if (slot >= 0) {
+        memcpy(info, &dir->faces[slot], sizeof(face_id_t));
     }
-    
-    memcpy(info, &face_database[id], sizeof(face_id_t));
-    return ESP_OK;
+    directory_read_end(rcu);
+    return slot >= 0 ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+int face_recognition_list(int from_id, face_id_t *faces, int max_faces)
+{
+    face_id_t found[MAX_FACE_ID_COUNT];
+    int n = 0;
+    uint32_t rcu;
+    const face_directory_t *dir = directory_read_begin(&rcu);
+    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+        if (dir->faces[i].enrolled && dir->faces[i].id >= from_id) {
+            found[n++] = dir->faces[i];
+        }
+    }
+    directory_read_end(rcu);
+    std::sort(found, found + n, [](const face_id_t &a, const face_id_t &b) { return a.id < b.id; });
+    n = std::min(n, max_faces);
+    memcpy(faces, found, n * sizeof(face_id_t));
+    return n;
 }
 
 esp_err_t face_recognition_delete(int id)
 {
-    if (!face_recognizer || id < 0 || id >= MAX_FACE_ID_COUNT) {
+    if (!face_feat || id < 0) {
         return ESP_ERR_INVALID_ARG;
     }
-    
-    if (!face_database[id].enrolled) {
+
+    face_directory_t *dir = directory_edit();
+    int slot = find_slot(dir, id);
+    if (slot < 0) {
+        directory_abort();
         return ESP_ERR_NOT_FOUND;
     }
-    
-    // Delete from recognizer
-    esp_err_t ret = face_recognizer->delete_feat(id);
+
+    // Only marks the templates deleted and writes their owner entries; the
+    // compactor closes the holes in the background
+    face_store_remove_owner(id);
+    esp_err_t ret = face_store_save();
     if (ret == ESP_OK) {
         // Update local database
-        face_database[id].enrolled = false;
-        memset(face_database[id].name, 0, MAX_NAME_LENGTH);
-        face_database[id].template_count = 0;
-        enrolled_count--;
-        
+        memset(&dir->faces[slot], 0, sizeof(face_id_t));
+        dir->enrolled_count--;
+
         // Save updated metadata
-        save_face_metadata();
-        
+        save_face_metadata(dir);
+        directory_publish(dir);
+
         ESP_LOGI(TAG, "Deleted face ID %d", id);
+    } else {
+        directory_abort();
     }
-    
+
     return ret;
 }
 
+int face_recognition_find_duplicates(float threshold, bool merge, face_duplicate_pair_t *pairs, int max_pairs)
+{
+    if (!face_feat) {
+        return 0;
+    }
+    int found = 0;
+    bool merged = false;
+    face_directory_t *dir = directory_edit();
+    for (int i = 0; i < MAX_FACE_ID_COUNT && found < max_pairs; i++) {
+        for (int j = i + 1; j < MAX_FACE_ID_COUNT && found < max_pairs; j++) {
+            if (!dir->faces[i].enrolled || !dir->faces[j].enrolled) {
+                continue;
+            }
+            // The older face, with the lower ID, is kept
+            face_id_t *keep = &dir->faces[i];
+            face_id_t *other = &dir->faces[j];
+            if (other->id < keep->id) {
+                std::swap(keep, other);
+            }
+            float sim = face_store_owner_similarity(keep->id, other->id);
+            if (sim < threshold) {
+                continue;
+            }
+            pairs[found++] = {keep->id, other->id, sim};
+            if (!merge) {
+                continue;
+            }
+
+            keep->template_count = face_store_reassign(other->id, keep->id, MAX_FACE_TEMPLATES);
+            ESP_LOGI(TAG, "Merged '%s' (ID %d) into '%s' (ID %d), similarity %.3f", other->name, other->id,
+                     keep->name, keep->id, sim);
+            memset(other, 0, sizeof(face_id_t));
+            dir->enrolled_count--;
+            merged = true;
+        }
+    }
+    if (!merged) {
+        directory_abort();
+        return found;
+    }
+
+    // Templates first and metadata last, as for enrollment. The templates have
+    // moved in RAM either way, so the directory is published even if saving fails.
+    bool saved = face_store_save() == ESP_OK && save_face_metadata(dir) == ESP_OK;
+    directory_publish(dir);
+    return saved ? found : -1;
+}
+
 esp_err_t face_recognition_reset_database(void)
 {
-    ESP_LOGW(TAG, "Resetting face database and metadata...");
-    
-    // Delete the recognizer object
-    if (face_recognizer) {
-        delete face_recognizer;
-        face_recognizer = nullptr;
+    if (!directory_mutex) {
+        return ESP_ERR_INVALID_STATE;
     }
-    
+    ESP_LOGW(TAG, "Resetting face database and metadata...");
+
     // Delete database and metadata files
-    unlink(db_path);
+    face_directory_t *dir = directory_edit();
+    face_store_clear();
+    unlink(templates_path);
     unlink(metadata_path);
-    
-    // Clear in-memory database
-    enrolled_count = 0;
-    memset(face_database, 0, sizeof(face_database));
-    
-    // Small delay to ensure filesystem operations complete
-    vTaskDelay(pdMS_TO_TICKS(100));
-    
-    // Recreate the recognizer with fresh database
-    face_recognizer = new HumanFaceRecognizer(
-        db_path,
-        HumanFaceFeat::MFN_S8_V1,
-        true  // Use lazy loading
-    );
-    
+    unlink(metadata_tmp_path);
+
+    // Clear in-memory database. IDs keep counting up, so a deleted ID is not
+    // handed out again; a fresh metadata file keeps the counter across reboots.
+    // Recognition in progress keeps using the old directory until it is done with it.
+    int32_t next_face_id = dir->next_face_id;
+    memset(dir, 0, sizeof(*dir));
+    dir->next_face_id = next_face_id;
+    save_face_metadata(dir);
+    directory_publish(dir);
+
     ESP_LOGI(TAG, "Database and metadata reset complete");
     return ESP_OK;
 }
 
-const face_id_t* face_recognition_get_enrolled_ids(void)
+const char *face_recognition_get_last_error(void)
 {
-    return face_database;
+    return last_error;
 }
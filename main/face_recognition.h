@@ -11,25 +11,168 @@ extern "C" {
 #define MAX_FACE_ID_COUNT 10
 #define MAX_NAME_LENGTH 32
 #define MAX_FACE_TEMPLATES 5  // Max templates per person
+#define FACE_RECOGNITION_THRESHOLD 0.5f  // Min cosine similarity for a match
+#define FACE_BURST_MAX_FRAMES 16         // Max frames in one burst enrollment
+#define FACE_BURST_DIVERSITY_MAX_SIM 0.92f  // Burst frames more similar than this to a kept frame are skipped
+#define FACE_DUPLICATE_DEFAULT_THRESHOLD 0.6f  // Enrollments this similar to an enrolled face are duplicates
+#define FACE_RESULT_MAX_FACES 8          // Max faces reported for one image
 
 typedef struct {
     char name[MAX_NAME_LENGTH];
-    int id;
+    int id;              // Stable: never reused, also after the face is deleted
     bool enrolled;
     int template_count;  // Number of face templates for this person
 } face_id_t;
 
+// One face of a recognized frame
+typedef struct {
+    int id;            // Matched face ID, -1 if unknown
+    float similarity;  // Similarity of the best match
+    int box[4];        // [x1, y1, x2, y2]
+    bool identified;   // An embedding was matched, so id and similarity are meaningful
+} face_match_face_t;
+
+typedef struct {
+    int id;            // ID of the best match, -1 if unknown
+    float similarity;  // Similarity of the best match
+    int box[4];        // Box of the matched face [x1, y1, x2, y2]
+    int face_count;    // Number of faces detected in the frame
+    bool identified;   // An embedding was matched, so id and similarity are meaningful
+    int result_count;  // Faces in faces, at most FACE_RESULT_MAX_FACES
+    face_match_face_t faces[FACE_RESULT_MAX_FACES];  // Every face of the frame in detection order
+} face_match_t;
+
+// One face found by face_recognition_identify_all
+typedef struct {
+    int box[4];            // [x1, y1, x2, y2]
+    int keypoints[10];     // [x, y] of left eye, left mouth corner, nose, right eye, right mouth corner
+    float score;           // Detection score
+    int id;                // Matched face ID, -1 if unknown
+    float similarity;      // Similarity of the best match, 0 if no embedding could be taken
+    char name[MAX_NAME_LENGTH];  // Name of id, empty if unknown
+} face_result_t;
+
+// How much of the pipeline runs on every frame
+typedef enum {
+    FACE_PIPELINE_PRESENCE = 0,  // MSR detection only
+    FACE_PIPELINE_LANDMARKS,     // MSR detection plus MNP landmarks
+    FACE_PIPELINE_FULL,          // Detection, landmarks and identification
+} face_pipeline_mode_t;
+
+typedef struct {
+    face_pipeline_mode_t mode;
+    float msr_score_thr;
+    float msr_nms_thr;
+    float mnp_score_thr;
+    float mnp_nms_thr;
+    bool tiled;            // Detect in overlapping tiles of frames larger than about 352x272,
+                           // for faces too small to find in the whole frame
+} face_pipeline_config_t;
+
+// Model latencies measured by the warm-up, 0 until it has run
+typedef struct {
+    int64_t detect_cold_us;  // First detection, includes loading the models and allocating tensors
+    int64_t detect_warm_us;
+    int64_t embed_cold_us;   // First embedding
+    int64_t embed_warm_us;
+} face_warmup_stats_t;
+
+// What enrollment does with a face that is already enrolled under another ID
+typedef enum {
+    FACE_DUPLICATE_ALLOW = 0,  // Enroll it under a new ID anyway
+    FACE_DUPLICATE_ATTACH,     // Add it as templates of the existing ID, up to MAX_FACE_TEMPLATES
+    FACE_DUPLICATE_REJECT,     // Refuse the enrollment
+} face_duplicate_policy_t;
+
+typedef struct {
+    face_duplicate_policy_t policy;
+    float threshold;  // Min similarity to an enrolled template for a duplicate
+} face_duplicate_config_t;
+
+// Two enrolled IDs that look like the same person
+typedef struct {
+    int keep;          // Lower ID, survives a merge
+    int merge;         // Folded into keep by a merge
+    float similarity;  // Best similarity between their templates
+} face_duplicate_pair_t;
+
 // Initialize face recognition system
 void face_recognition_init(void);
 
-// Detect and recognize faces in the frame buffer
-// Returns the ID of recognized face, or -1 if no face or unknown face
-int face_recognition_recognize(camera_fb_t *fb, char *name_out);
+// Run every model twice on a synthetic width x height frame so the one-time
+// costs are paid at boot instead of by the first real frame or enrollment
+void face_recognition_warmup(int width, int height);
+void face_recognition_get_warmup(face_warmup_stats_t *stats);
+
+// Current pipeline mode and detector thresholds
+void face_recognition_get_pipeline(face_pipeline_config_t *config);
+
+// Change the pipeline mode and detector thresholds without rebuilding the
+// detectors, and store them in NVS. Takes effect on the next frame.
+// In presence and landmarks mode a frame is escalated to full identification
+// only when more faces are visible than in the previous frame.
+esp_err_t face_recognition_set_pipeline(const face_pipeline_config_t *config);
+
+// "presence", "landmarks" or "full"
+const char *face_pipeline_mode_name(face_pipeline_mode_t mode);
+bool face_pipeline_mode_parse(const char *name, face_pipeline_mode_t *mode);
+
+// Detect and recognize every face in the frame buffer
+// Returns the ID of the best recognized face, or -1 if no face or only unknown faces
+// match_out is optional and receives the details of the best match and of every face
+int face_recognition_recognize(camera_fb_t *fb, char *name_out, face_match_t *match_out);
+
+// Detect every face in a JPEG image of any size and identify each one, for
+// images that did not come from the camera. Always runs the full pipeline on the
+// whole image, ignoring the regions of interest. Must be called from the
+// inference executor like every other model call, the models are not shared.
+// Returns the number of faces stored (at most max_faces), -1 if the image could not be decoded
+int face_recognition_identify_all(camera_fb_t *fb, face_result_t *faces, int max_faces);
 
 // Enroll a new face with the given name
 // Returns face ID on success, -1 on failure
+// Faces that fail the enrollment quality checks are rejected
 int face_recognition_enroll(camera_fb_t *fb, const char *name);
 
+// Reason for the last enrollment failure, empty after a success
+const char *face_recognition_get_last_error(void);
+
+// Duplicate handling for enrollment, stored in NVS. A duplicate enrolled under
+// the same name is always attached, whatever the policy.
+void face_recognition_get_duplicate_config(face_duplicate_config_t *config);
+esp_err_t face_recognition_set_duplicate_config(const face_duplicate_config_t *config);
+
+// "allow", "attach" or "reject"
+const char *face_duplicate_policy_name(face_duplicate_policy_t policy);
+bool face_duplicate_policy_parse(const char *name, face_duplicate_policy_t *policy);
+
+// Enrolled ID the last enrollment was attached to or rejected for, -1 if it was new
+int face_recognition_get_duplicate_id(void);
+
+// Find enrolled IDs whose templates are at least threshold similar, up to max_pairs.
+// With merge set, each pair is folded into its lower ID: the templates are pooled
+// up to MAX_FACE_TEMPLATES, the name of the lower ID is kept and the other ID is deleted.
+// Returns the number of pairs, -1 if the merge could not be saved.
+int face_recognition_find_duplicates(float threshold, bool merge, face_duplicate_pair_t *pairs, int max_pairs);
+
+// Burst enrollment: offer several frames of the same person, then keep the best
+// and most diverse ones as templates of a single face ID
+typedef struct face_burst face_burst_t;
+
+// Start a burst of up to max_frames frames, returns NULL on failure
+face_burst_t *face_recognition_burst_begin(int max_frames);
+
+// Score one frame, returns 1 if it produced a usable face, 0 if not, -1 on error
+int face_recognition_burst_add(face_burst_t *burst, camera_fb_t *fb);
+
+// Enroll the best frames as up to max_templates templates (or one averaged
+// template if centroid is set) and save them in one step.
+// Returns face ID on success, -1 on failure
+int face_recognition_burst_commit(face_burst_t *burst, const char *name, int max_templates, bool centroid);
+
+// Free the burst
+void face_recognition_burst_end(face_burst_t *burst);
+
 // Delete a face by ID
 esp_err_t face_recognition_delete(int id);
 
@@ -45,6 +188,10 @@ int face_recognition_get_enrolled_count(void);
 // Get face info by ID
 esp_err_t face_recognition_get_info(int id, face_id_t *info);
 
+// Enrolled faces with an ID of from_id or higher, in ascending ID order, up to
+// max_faces of them. Returns how many were stored in faces.
+int face_recognition_list(int from_id, face_id_t *faces, int max_faces);
+
 #ifdef __cplusplus
 }
 #endif
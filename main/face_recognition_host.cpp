@@ -0,0 +1,290 @@
+#include "face_recognition.h"
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+// Host build stand-in for face_recognition.cpp. esp-dl has no linux target, so
+// there is no detector or embedding model here: every frame costs a fixed,
+// configurable amount of time (RECOGNITION_COST_MS, default 300 ms, roughly the
+// detect + embed time on the ESP32-S3) and contains no face. Enrollment only
+// keeps names, so /enroll and /faces behave like the device minus the model.
+
+static const char *TAG = "face_recognition";
+
+#define HOST_RECOGNITION_DEFAULT_COST_MS 300
+
+static face_id_t face_database[MAX_FACE_ID_COUNT];
+static int32_t enrolled_count = 0;
+static int32_t next_face_id = 0;  // IDs are stable, as on the device
+static const char *last_error = "";
+static TickType_t recognition_cost = 0;
+static face_pipeline_config_t pipeline_config = {FACE_PIPELINE_FULL, 0.3f, 0.3f, 0.3f, 0.3f};
+static face_duplicate_config_t duplicate_config = {FACE_DUPLICATE_REJECT, FACE_DUPLICATE_DEFAULT_THRESHOLD};
+
+struct face_burst {
+    int max_frames;
+    int frames;
+};
+
+void face_recognition_init(void)
+{
+    const char *cost = getenv("RECOGNITION_COST_MS");
+    recognition_cost = pdMS_TO_TICKS(cost ? atoi(cost) : HOST_RECOGNITION_DEFAULT_COST_MS);
+    memset(face_database, 0, sizeof(face_database));
+    enrolled_count = 0;
+    ESP_LOGI(TAG, "Host recognizer: no model, %lu ms per frame",
+             (unsigned long)(recognition_cost * portTICK_PERIOD_MS));
+}
+
+void face_recognition_warmup(int width, int height)
+{
+}
+
+void face_recognition_get_warmup(face_warmup_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+void face_recognition_get_pipeline(face_pipeline_config_t *config)
+{
+    *config = pipeline_config;
+}
+
+esp_err_t face_recognition_set_pipeline(const face_pipeline_config_t *config)
+{
+    if (config->mode < FACE_PIPELINE_PRESENCE || config->mode > FACE_PIPELINE_FULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pipeline_config = *config;
+    return ESP_OK;
+}
+
+const char *face_pipeline_mode_name(face_pipeline_mode_t mode)
+{
+    switch (mode) {
+        case FACE_PIPELINE_PRESENCE: return "presence";
+        case FACE_PIPELINE_LANDMARKS: return "landmarks";
+        case FACE_PIPELINE_FULL: return "full";
+    }
+    return "?";
+}
+
+bool face_pipeline_mode_parse(const char *name, face_pipeline_mode_t *mode)
+{
+    for (int m = FACE_PIPELINE_PRESENCE; m <= FACE_PIPELINE_FULL; m++) {
+        if (strcmp(name, face_pipeline_mode_name((face_pipeline_mode_t)m)) == 0) {
+            *mode = (face_pipeline_mode_t)m;
+            return true;
+        }
+    }
+    return false;
+}
+
+void face_recognition_get_duplicate_config(face_duplicate_config_t *config)
+{
+    *config = duplicate_config;
+}
+
+esp_err_t face_recognition_set_duplicate_config(const face_duplicate_config_t *config)
+{
+    if (config->policy < FACE_DUPLICATE_ALLOW || config->policy > FACE_DUPLICATE_REJECT ||
+        config->threshold <= 0.0f || config->threshold >= 1.0f) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    duplicate_config = *config;
+    return ESP_OK;
+}
+
+const char *face_duplicate_policy_name(face_duplicate_policy_t policy)
+{
+    switch (policy) {
+        case FACE_DUPLICATE_ALLOW: return "allow";
+        case FACE_DUPLICATE_ATTACH: return "attach";
+        case FACE_DUPLICATE_REJECT: return "reject";
+    }
+    return "?";
+}
+
+bool face_duplicate_policy_parse(const char *name, face_duplicate_policy_t *policy)
+{
+    for (int p = FACE_DUPLICATE_ALLOW; p <= FACE_DUPLICATE_REJECT; p++) {
+        if (strcmp(name, face_duplicate_policy_name((face_duplicate_policy_t)p)) == 0) {
+            *policy = (face_duplicate_policy_t)p;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Without embeddings nothing can be recognized as a duplicate
+int face_recognition_get_duplicate_id(void)
+{
+    return -1;
+}
+
+int face_recognition_find_duplicates(float threshold, bool merge, face_duplicate_pair_t *pairs, int max_pairs)
+{
+    return 0;
+}
+
+int face_recognition_recognize(camera_fb_t *fb, char *name_out, face_match_t *match_out)
+{
+    if (match_out) {
+        memset(match_out, 0, sizeof(face_match_t));
+        match_out->id = -1;
+    }
+    if (!fb || !name_out) {
+        return -1;
+    }
+    vTaskDelay(recognition_cost);
+    return -1;
+}
+
+int face_recognition_identify_all(camera_fb_t *fb, face_result_t *faces, int max_faces)
+{
+    if (!fb || !faces) {
+        return -1;
+    }
+    vTaskDelay(recognition_cost);
+    return 0;
+}
+
+face_burst_t *face_recognition_burst_begin(int max_frames)
+{
+    face_burst_t *burst = (face_burst_t *)calloc(1, sizeof(face_burst_t));
+    if (burst) {
+        burst->max_frames = max_frames;
+    }
+    return burst;
+}
+
+int face_recognition_burst_add(face_burst_t *burst, camera_fb_t *fb)
+{
+    if (!burst || !fb || burst->frames >= burst->max_frames) {
+        return -1;
+    }
+    vTaskDelay(recognition_cost);
+    burst->frames++;
+    return 1;
+}
+
+// Slot of an enrolled face ID, -1 if there is none
+static int find_slot(int id)
+{
+    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+        if (face_database[i].enrolled && face_database[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int face_recognition_burst_commit(face_burst_t *burst, const char *name, int max_templates, bool centroid)
+{
+    if (!burst || !name || burst->frames == 0) {
+        last_error = "No usable face in the burst";
+        return -1;
+    }
+
+    for (int slot = 0; slot < MAX_FACE_ID_COUNT; slot++) {
+        if (!face_database[slot].enrolled) {
+            int id = next_face_id++;
+            snprintf(face_database[slot].name, MAX_NAME_LENGTH, "%s", name);
+            face_database[slot].id = id;
+            face_database[slot].enrolled = true;
+            face_database[slot].template_count = centroid ? 1 : std::min(burst->frames, max_templates);
+            enrolled_count++;
+            last_error = "";
+            ESP_LOGI(TAG, "Enrolled %s as ID %d", name, id);
+            return id;
+        }
+    }
+    last_error = "Face database full";
+    return -1;
+}
+
+void face_recognition_burst_end(face_burst_t *burst)
+{
+    free(burst);
+}
+
+int face_recognition_enroll(camera_fb_t *fb, const char *name)
+{
+    face_burst_t *burst = face_recognition_burst_begin(1);
+    if (!burst) {
+        last_error = "Memory allocation failed";
+        return -1;
+    }
+    face_recognition_burst_add(burst, fb);
+    int id = face_recognition_burst_commit(burst, name, 1, false);
+    face_recognition_burst_end(burst);
+    return id;
+}
+
+esp_err_t face_recognition_delete(int id)
+{
+    if (id < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int slot = find_slot(id);
+    if (slot < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memset(&face_database[slot], 0, sizeof(face_id_t));
+    enrolled_count--;
+    return ESP_OK;
+}
+
+esp_err_t face_recognition_delete_all(void)
+{
+    memset(face_database, 0, sizeof(face_database));
+    enrolled_count = 0;
+    return ESP_OK;
+}
+
+esp_err_t face_recognition_reset_database(void)
+{
+    next_face_id = 0;
+    return face_recognition_delete_all();
+}
+
+int face_recognition_get_enrolled_count(void)
+{
+    return enrolled_count;
+}
+
+esp_err_t face_recognition_get_info(int id, face_id_t *info)
+{
+    if (!info || id < 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int slot = find_slot(id);
+    if (slot < 0) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    memcpy(info, &face_database[slot], sizeof(face_id_t));
+    return ESP_OK;
+}
+
+int face_recognition_list(int from_id, face_id_t *faces, int max_faces)
+{
+    face_id_t found[MAX_FACE_ID_COUNT];
+    int n = 0;
+    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
+        if (face_database[i].enrolled && face_database[i].id >= from_id) {
+            found[n++] = face_database[i];
+        }
+    }
+    std::sort(found, found + n, [](const face_id_t &a, const face_id_t &b) { return a.id < b.id; });
+    n = std::min(n, max_faces);
+    memcpy(faces, found, n * sizeof(face_id_t));
+    return n;
+}
+
+const char *face_recognition_get_last_error(void)
+{
+    return last_error;
+}
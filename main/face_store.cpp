@@ -0,0 +1,907 @@
+#include "face_store.h"
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "rcu.h"
+
+static const char *TAG = "face_store";
+
+#define FACE_STORE_MAGIC 0x31544646  // "FFT1"
+#define FACE_STORE_VERSION 2
+#define FACE_STORE_TOMBSTONE -1          // Owner of a deleted row
+#define FACE_STORE_COMPACT_STEP_MS 20    // Pause between two moved rows
+
+// Hot tier: copies of the rows of the most often matched identities in internal
+// RAM, scanned before the PSRAM matrix. Identities are promoted whole, so a hot
+// match can only lose to another owner's row. With cross_max the highest
+// similarity between rows of different owners, a match at or above
+// sqrt((1 + cross_max) / 2) is at least half their angle from its row, hence no
+// farther than any other owner's row: the scan ends without touching PSRAM.
+// This holds whatever the duplicate policy, it only ends scans less often when
+// identities are close.
+//
+// A matrix that fits the data cache is scanned from cache after the first match,
+// so the tier, its hit counting and its bookkeeping only start once the store
+// holds FACE_STORE_HOT_MIN_ROWS live rows, and stop again below that.
+#define FACE_STORE_HOT_ROWS MAX_FACE_TEMPLATES             // One whole identity, 2 KB of internal RAM each at 512 dims
+#define FACE_STORE_HOT_MARGIN 1e-3f                        // Rounding of float dot products
+#define FACE_STORE_HOT_OFF 2.0f                            // Exit above any cosine similarity
+#define FACE_STORE_HOT_MIN_ROWS 32                         // 64 KB at 512 dims, the ESP32-S3 data cache
+#define FACE_STORE_REBALANCE_MS (60 * 1000)                // Hot tier review interval
+#define FACE_STORE_HIT_HALF_LIFE_MS (24 * 60 * 60 * 1000)  // Hit counters halve daily
+
+static_assert(MAX_TEMPLATE_COUNT <= 64, "dirty row masks are 64 bits");
+
+// Version 2 file: header, MAX_TEMPLATE_COUNT owners, then count rows of feat_len
+// floats. Every row has a fixed offset, so changes are written in place.
+// Version 1 files (count int16 owners, then the rows) are loaded and rewritten.
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t feat_len;
+    uint32_t count;
+} face_store_header_t;
+
+// Deleting a template only marks its row with FACE_STORE_TOMBSTONE. The compactor
+// task later moves the live rows down into the holes, one row at a time and in
+// order, so the matrix becomes dense again and the newest templates of an owner
+// stay its last rows.
+//
+// On flash a move is only safe once it is complete: a later move may overwrite
+// its source row, which must be a saved tombstone by then. So the compactor makes
+// no move while an earlier one is unsaved, and row data only changes with
+// file_mutex held, so a save writes every row with the owner it had when the
+// save started.
+//
+// face_store_match reads the matrix without store_mutex, inside an RCU read
+// section, so writers never hold up recognition. A row is published by writing
+// its data before its owner, and row_count last. A deleted row keeps its data
+// until a grace period has passed, so a reader that saw it live never reads a
+// half-overwritten row.
+static float *feats = NULL;                        // MAX_TEMPLATE_COUNT rows of FACE_FEAT_MAX_LEN
+static int32_t owners[MAX_TEMPLATE_COUNT];
+static int row_count = 0;                          // Rows in use, deleted ones included
+static int live_count = 0;
+static int feat_len = 0;
+static uint64_t dirty_rows = 0;                    // Rows whose data was not saved yet
+static uint64_t dirty_owners = 0;                  // Rows whose owner was not saved yet
+static uint64_t retired_rows = 0;                  // Deleted rows readers may still be reading
+static int saved_count = 0;                        // Row count in the file header
+static uint32_t moves_made = 0;                    // Rows moved by compaction
+static uint32_t moves_saved = 0;                   // Of those, moves saved to the file
+static bool rewrite_file = true;                   // File missing or in an old format
+static char store_path[64];
+static char store_tmp_path[68];
+static SemaphoreHandle_t store_mutex = NULL;       // Guards the RAM copy, held only briefly
+static SemaphoreHandle_t file_mutex = NULL;        // Serializes writers of the file
+static TaskHandle_t compactor_task = NULL;
+static uint32_t row_hits[MAX_TEMPLATE_COUNT];      // Matches per row, decayed, bumped by readers
+static float *hot_feats = NULL;                    // FACE_STORE_HOT_ROWS rows in internal RAM, allocated on first use
+static std::atomic<bool> hot_active{false};        // Store large enough for the tier, hot_feats allocated
+static int hot_src[FACE_STORE_HOT_ROWS];           // Row each hot slot copies, -1 if empty
+static bool hot_emptied = false;                   // A slot emptied since the last grace period
+static float cross_max = 1.0f;                     // Upper bound, valid only with cross_known
+static bool cross_known = false;                   // Cleared until the next full recompute
+static std::atomic<float> hot_exit{FACE_STORE_HOT_OFF};  // Similarity that ends a match in the hot tier
+static int64_t last_decay_us = 0;
+
+static inline float *feat_row(int i)
+{
+    return feats + (size_t)i * FACE_FEAT_MAX_LEN;
+}
+
+static inline float dot(const float *a, const float *b, int len)
+{
+    float sim = 0.0f;
+    for (int k = 0; k < len; k++) {
+        sim += a[k] * b[k];
+    }
+    return sim;
+}
+
+static inline long row_offset(int i)
+{
+    return (long)(sizeof(face_store_header_t) + sizeof(owners) + (size_t)i * feat_len * sizeof(float));
+}
+
+// Owners and the row count are read without store_mutex, so they are stored atomically
+static inline void set_owner(int i, int32_t owner)
+{
+    std::atomic_ref<int32_t>(owners[i]).store(owner, std::memory_order_release);
+}
+
+static inline void set_row_count(int n)
+{
+    std::atomic_ref<int>(row_count).store(n, std::memory_order_release);
+}
+
+static inline float *hot_row(int slot)
+{
+    return hot_feats + (size_t)slot * FACE_FEAT_MAX_LEN;
+}
+
+// A hot slot's data only changes while the slot is empty and no reader is left
+// in it. Its row can be moved or retired any time; the slot follows or empties.
+static inline void set_hot_src(int slot, int row)
+{
+    std::atomic_ref<int>(hot_src[slot]).store(row, std::memory_order_release);
+}
+
+// Point the hot slot of a row at another row with the same data, or empty it
+// with -1. An emptied slot is not refilled before the next grace period.
+// Called with store_mutex held.
+static void hot_retarget(int row, int to)
+{
+    for (int slot = 0; hot_feats && slot < FACE_STORE_HOT_ROWS; slot++) {
+        if (hot_src[slot] == row) {
+            set_hot_src(slot, to);
+            hot_emptied = hot_emptied || to < 0;
+        }
+    }
+}
+
+// Wait until no reader is left in a row or hot slot given up so far.
+// Called with store_mutex held.
+static void grace_period(void)
+{
+    rcu_synchronize();
+    retired_rows = 0;
+    hot_emptied = false;
+}
+
+static void publish_hot_exit(void)
+{
+    float exit = cross_known ? sqrtf((1.0f + cross_max) / 2.0f) + FACE_STORE_HOT_MARGIN : FACE_STORE_HOT_OFF;
+    hot_exit.store(exit, std::memory_order_relaxed);
+}
+
+// Raise cross_max to cover a new row. Deletions and merges only ever lower
+// the true maximum, so they leave the bound as it is until the next recompute.
+// Called with store_mutex held.
+static void cross_add_row(int i)
+{
+    if (!cross_known) {
+        return;
+    }
+    for (int j = 0; j < row_count; j++) {
+        if (owners[j] != FACE_STORE_TOMBSTONE && owners[j] != owners[i]) {
+            cross_max = fmaxf(cross_max, dot(feat_row(i), feat_row(j), feat_len));
+        }
+    }
+    publish_hot_exit();
+}
+
+// Called with store_mutex held
+static void cross_recompute(void)
+{
+    cross_max = -1.0f;
+    for (int i = 0; i < row_count; i++) {
+        for (int j = i + 1; owners[i] != FACE_STORE_TOMBSTONE && j < row_count; j++) {
+            if (owners[j] != FACE_STORE_TOMBSTONE && owners[j] != owners[i]) {
+                cross_max = fmaxf(cross_max, dot(feat_row(i), feat_row(j), feat_len));
+            }
+        }
+    }
+    cross_known = true;
+    publish_hot_exit();
+}
+
+// Called with store_mutex held
+static void tombstone_row(int i)
+{
+    set_owner(i, FACE_STORE_TOMBSTONE);
+    hot_retarget(i, -1);
+    std::atomic_ref<uint32_t>(row_hits[i]).store(0, std::memory_order_relaxed);
+    retired_rows |= 1ULL << i;
+    dirty_owners |= 1ULL << i;
+    live_count--;
+}
+
+// Wait before overwriting a row a reader may still be reading. One grace period
+// frees every row retired so far. Called with store_mutex held.
+static void reuse_row(int i)
+{
+    if (retired_rows & (1ULL << i)) {
+        grace_period();
+    }
+}
+
+static void wake_compactor(void)
+{
+    if (compactor_task) {
+        xTaskNotifyGive(compactor_task);
+    }
+}
+
+esp_err_t face_store_replace_file(const char *tmp_path, const char *path)
+{
+    unlink(path);
+    if (rename(tmp_path, path) != 0) {
+        ESP_LOGE(TAG, "Failed to rename %s to %s", tmp_path, path);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+FILE *face_store_open_latest(const char *path, const char *tmp_path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        // Only a fully written temp file is left behind once the old file is removed
+        f = fopen(tmp_path, "rb");
+        if (f != NULL) {
+            ESP_LOGW(TAG, "Recovering %s from %s", path, tmp_path);
+        }
+    }
+    return f;
+}
+
+// Runs in face_store_init, before there are readers
+static esp_err_t load_store(void)
+{
+    FILE *f = face_store_open_latest(store_path, store_tmp_path);
+    if (f == NULL) {
+        ESP_LOGI(TAG, "No template file found, starting fresh");
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    face_store_header_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != FACE_STORE_MAGIC ||
+        (hdr.version != 1 && hdr.version != FACE_STORE_VERSION) || hdr.feat_len == 0 ||
+        hdr.feat_len > FACE_FEAT_MAX_LEN || hdr.count > MAX_TEMPLATE_COUNT) {
+        ESP_LOGE(TAG, "Template file header invalid, ignoring it");
+        fclose(f);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    bool ok;
+    if (hdr.version == 1) {
+        int16_t old_owners[MAX_TEMPLATE_COUNT];
+        ok = fread(old_owners, sizeof(old_owners[0]), hdr.count, f) == hdr.count;
+        for (uint32_t i = 0; i < hdr.count; i++) {
+            owners[i] = old_owners[i];
+        }
+    } else {
+        ok = fread(owners, sizeof(owners), 1, f) == 1;
+    }
+    for (uint32_t i = 0; ok && i < hdr.count; i++) {
+        ok = fread(feat_row(i), sizeof(float), hdr.feat_len, f) == hdr.feat_len;
+    }
+    fclose(f);
+
+    if (!ok) {
+        ESP_LOGE(TAG, "Template file truncated, ignoring it");
+        for (int i = 0; i < MAX_TEMPLATE_COUNT; i++) {
+            owners[i] = FACE_STORE_TOMBSTONE;
+        }
+        return ESP_FAIL;
+    }
+
+    feat_len = hdr.feat_len;
+    row_count = hdr.count;
+    live_count = 0;
+    for (int i = 0; i < MAX_TEMPLATE_COUNT; i++) {
+        if (i >= row_count) {
+            owners[i] = FACE_STORE_TOMBSTONE;
+        } else if (owners[i] != FACE_STORE_TOMBSTONE) {
+            live_count++;
+        }
+    }
+    saved_count = row_count;
+    rewrite_file = hdr.version != FACE_STORE_VERSION;
+    ESP_LOGI(TAG, "Loaded %d templates in %d rows (%d dims)%s", live_count, row_count, feat_len,
+             rewrite_file ? ", converting the file on the next save" : "");
+    return ESP_OK;
+}
+
+// Move the first live row after the first hole into that hole, or drop the deleted
+// rows at the end. Returns false once the matrix is dense, or while the previous
+// move is not saved. Called with file_mutex and store_mutex held.
+static bool compact_step_locked(void)
+{
+    if (moves_saved != moves_made) {
+        return false;
+    }
+    int hole = 0;
+    while (hole < row_count && owners[hole] != FACE_STORE_TOMBSTONE) {
+        hole++;
+    }
+    int row = hole + 1;
+    while (row < row_count && owners[row] == FACE_STORE_TOMBSTONE) {
+        row++;
+    }
+    if (hole == row_count) {
+        return false;
+    }
+    if (row < row_count) {
+        // Readers may see the row in both places for a moment, never in neither
+        reuse_row(hole);
+        memcpy(feat_row(hole), feat_row(row), feat_len * sizeof(float));
+        set_owner(hole, owners[row]);
+        set_owner(row, FACE_STORE_TOMBSTONE);
+        hot_retarget(row, hole);
+        std::atomic_ref<uint32_t> hits(row_hits[row]);
+        std::atomic_ref<uint32_t>(row_hits[hole]).store(hits.exchange(0, std::memory_order_relaxed),
+                                                        std::memory_order_relaxed);
+        retired_rows |= 1ULL << row;
+        dirty_rows |= 1ULL << hole;
+        dirty_owners |= (1ULL << hole) | (1ULL << row);
+        moves_made++;
+    } else {
+        set_row_count(hole);
+    }
+    return true;
+}
+
+static bool compact_step(void)
+{
+    xSemaphoreTake(file_mutex, portMAX_DELAY);
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    bool moved = compact_step_locked();
+    xSemaphoreGive(store_mutex);
+    xSemaphoreGive(file_mutex);
+    return moved;
+}
+
+// Fill the hot tier with the rows of the identities with the most hits, as many
+// whole identities as fit. Slots that change are emptied first and refilled
+// after one grace period. Also decays the hit counters. Below
+// FACE_STORE_HOT_MIN_ROWS the tier is emptied and switched off instead.
+static void rebalance_hot_tier(void)
+{
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    if (live_count < FACE_STORE_HOT_MIN_ROWS) {
+        if (hot_active.load(std::memory_order_relaxed)) {
+            hot_active.store(false, std::memory_order_relaxed);
+            for (int slot = 0; slot < FACE_STORE_HOT_ROWS; slot++) {
+                if (hot_src[slot] >= 0) {
+                    set_hot_src(slot, -1);
+                    hot_emptied = true;
+                }
+            }
+            cross_known = false;
+            publish_hot_exit();
+            ESP_LOGI(TAG, "Hot tier off, %d templates fit the cache", live_count);
+        }
+        xSemaphoreGive(store_mutex);
+        return;
+    }
+    if (!hot_feats) {
+        // Kept once allocated, a reader may be in it until the next grace period
+        hot_feats = (float *)heap_caps_malloc(FACE_STORE_HOT_ROWS * FACE_FEAT_MAX_LEN * sizeof(float),
+                                              MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (!hot_feats) {
+            xSemaphoreGive(store_mutex);
+            ESP_LOGW(TAG, "No internal RAM for the hot tier, matching from PSRAM only");
+            return;
+        }
+    }
+    hot_active.store(true, std::memory_order_release);
+
+    bool decay = esp_timer_get_time() - last_decay_us >= (int64_t)FACE_STORE_HIT_HALF_LIFE_MS * 1000;
+    if (decay) {
+        last_decay_us = esp_timer_get_time();
+    }
+
+    // Hits per identity
+    int32_t ids[MAX_TEMPLATE_COUNT];
+    uint32_t id_hits[MAX_TEMPLATE_COUNT];
+    int id_rows[MAX_TEMPLATE_COUNT];
+    int n_ids = 0;
+    for (int i = 0; i < row_count; i++) {
+        std::atomic_ref<uint32_t> hits(row_hits[i]);
+        uint32_t h = hits.load(std::memory_order_relaxed);
+        if (decay) {
+            hits.store(h / 2, std::memory_order_relaxed);
+        }
+        if (owners[i] == FACE_STORE_TOMBSTONE) {
+            continue;
+        }
+        int j = 0;
+        while (j < n_ids && ids[j] != owners[i]) {
+            j++;
+        }
+        if (j == n_ids) {
+            ids[n_ids] = owners[i];
+            id_hits[n_ids] = 0;
+            id_rows[n_ids++] = 0;
+        }
+        id_hits[j] += h;
+        id_rows[j]++;
+    }
+
+    // Hottest identities first, skipping any that no longer fit
+    bool wanted[MAX_TEMPLATE_COUNT] = {};
+    int free_rows = FACE_STORE_HOT_ROWS;
+    while (free_rows > 0) {
+        int best = -1;
+        for (int j = 0; j < n_ids; j++) {
+            if (id_hits[j] > 0 && id_rows[j] <= free_rows && (best < 0 || id_hits[j] > id_hits[best])) {
+                best = j;
+            }
+        }
+        if (best < 0) {
+            break;
+        }
+        for (int i = 0; i < row_count; i++) {
+            wanted[i] = wanted[i] || owners[i] == ids[best];
+        }
+        free_rows -= id_rows[best];
+        id_hits[best] = 0;
+    }
+
+    // Keep the slots that already hold a wanted row, empty the rest. Slots
+    // emptied here or by deletions since the last grace period may still
+    // have readers, so wait for them before copying new rows in.
+    bool emptied = false;
+    for (int slot = 0; slot < FACE_STORE_HOT_ROWS; slot++) {
+        int row = hot_src[slot];
+        if (row >= 0 && wanted[row]) {
+            wanted[row] = false;
+        } else if (row >= 0) {
+            set_hot_src(slot, -1);
+            emptied = true;
+        }
+    }
+    if (emptied || hot_emptied) {
+        grace_period();
+    }
+    cross_recompute();
+    int moved = 0;
+    for (int slot = 0, i = 0; slot < FACE_STORE_HOT_ROWS; slot++) {
+        if (hot_src[slot] >= 0) {
+            continue;
+        }
+        while (i < row_count && !wanted[i]) {
+            i++;
+        }
+        if (i == row_count) {
+            break;
+        }
+        memcpy(hot_row(slot), feat_row(i), feat_len * sizeof(float));
+        set_hot_src(slot, i++);
+        moved++;
+    }
+    xSemaphoreGive(store_mutex);
+    if (moved > 0 || emptied) {
+        ESP_LOGI(TAG, "Hot tier updated, %d row(s) promoted", moved);
+    }
+}
+
+// Runs below the recognition task. Besides compacting, it reviews the hot tier.
+// Each compaction step holds store_mutex for one row copy,
+// plus a grace period when the hole was deleted recently, and is saved before the
+// next, so an interrupted compaction loses nothing.
+static void face_store_compactor_task(void *arg)
+{
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(FACE_STORE_REBALANCE_MS));
+        int steps = 0;
+        // A move whose save failed is saved before the next one is made
+        while (face_store_save() == ESP_OK && compact_step()) {
+            steps++;
+            vTaskDelay(pdMS_TO_TICKS(FACE_STORE_COMPACT_STEP_MS));
+        }
+        if (steps > 0) {
+            ESP_LOGI(TAG, "Compacted templates in %d step(s), %d rows", steps, row_count);
+        }
+        rebalance_hot_tier();
+    }
+}
+
+esp_err_t face_store_init(const char *path)
+{
+    if (!feats) {
+        feats = (float *)heap_caps_calloc(MAX_TEMPLATE_COUNT * FACE_FEAT_MAX_LEN, sizeof(float),
+                                          MALLOC_CAP_SPIRAM);
+        store_mutex = xSemaphoreCreateMutex();
+        file_mutex = xSemaphoreCreateMutex();
+        if (!feats || !store_mutex || !file_mutex) {
+            ESP_LOGE(TAG, "Failed to allocate template store");
+            return ESP_ERR_NO_MEM;
+        }
+        for (int slot = 0; slot < FACE_STORE_HOT_ROWS; slot++) {
+            hot_src[slot] = -1;
+        }
+        last_decay_us = esp_timer_get_time();
+        if (xTaskCreate(face_store_compactor_task, "face_compact", 3072, NULL, 1, &compactor_task) != pdPASS) {
+            ESP_LOGW(TAG, "Failed to start the compactor, deleted rows stay until the next clear");
+            compactor_task = NULL;
+        }
+    }
+
+    snprintf(store_path, sizeof(store_path), "%s", path);
+    snprintf(store_tmp_path, sizeof(store_tmp_path), "%s.tmp", path);
+
+    face_store_clear();
+    if (load_store() == ESP_OK) {
+        wake_compactor();  // Holes left by a compaction that was cut short
+    }
+    return ESP_OK;
+}
+
+// Write the whole store to a new file, for a missing or old-format file
+static esp_err_t rewrite_store(int *count_out)
+{
+    FILE *f = fopen(store_tmp_path, "wb");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open template file for writing");
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    face_store_header_t hdr = {
+        .magic = FACE_STORE_MAGIC,
+        .version = FACE_STORE_VERSION,
+        .feat_len = (uint16_t)feat_len,
+        .count = (uint32_t)row_count,
+    };
+    *count_out = row_count;
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    ok = ok && fwrite(owners, sizeof(owners), 1, f) == 1;
+    for (int i = 0; ok && i < row_count; i++) {
+        ok = fwrite(feat_row(i), sizeof(float), feat_len, f) == (size_t)feat_len;
+    }
+    xSemaphoreGive(store_mutex);
+    ok = (fclose(f) == 0) && ok;
+
+    esp_err_t err = ok ? face_store_replace_file(store_tmp_path, store_path) : ESP_FAIL;
+    if (err != ESP_OK) {
+        unlink(store_tmp_path);
+    }
+    return err;
+}
+
+// Write the changed rows, then their owners in row order, then the row count.
+// A crash in between leaves either rows the header does not count yet, or the
+// one unsaved move (its hole comes before its source) in both places, which only
+// duplicates a template. Called with file_mutex held, so rows keep their data;
+// owners are the ones taken with the dirty masks.
+static esp_err_t update_store(uint64_t rows, uint64_t row_owners, const int32_t *saved_owners, int count)
+{
+    FILE *f = fopen(store_path, "r+b");
+    if (f == NULL) {
+        ESP_LOGE(TAG, "Failed to open template file for update");
+        return ESP_FAIL;
+    }
+
+    float *row = (float *)heap_caps_malloc(FACE_FEAT_MAX_LEN * sizeof(float), MALLOC_CAP_SPIRAM);
+    bool ok = row != NULL;
+    for (int i = 0; ok && i < MAX_TEMPLATE_COUNT; i++) {
+        if (rows & (1ULL << i)) {
+            // Copy out so the file write does not hold up readers
+            xSemaphoreTake(store_mutex, portMAX_DELAY);
+            memcpy(row, feat_row(i), feat_len * sizeof(float));
+            xSemaphoreGive(store_mutex);
+            ok = fseek(f, row_offset(i), SEEK_SET) == 0 &&
+                 fwrite(row, sizeof(float), feat_len, f) == (size_t)feat_len;
+        }
+    }
+    heap_caps_free(row);
+    for (int i = 0; ok && i < MAX_TEMPLATE_COUNT; i++) {
+        if (row_owners & (1ULL << i)) {
+            ok = fseek(f, (long)(sizeof(face_store_header_t) + i * sizeof(int32_t)), SEEK_SET) == 0 &&
+                 fwrite(&saved_owners[i], sizeof(int32_t), 1, f) == 1;
+        }
+    }
+    if (ok && count != saved_count) {
+        face_store_header_t hdr = {
+            .magic = FACE_STORE_MAGIC,
+            .version = FACE_STORE_VERSION,
+            .feat_len = (uint16_t)feat_len,
+            .count = (uint32_t)count,
+        };
+        ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    }
+    ok = (fclose(f) == 0) && ok;
+    return ok ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t face_store_save(void)
+{
+    xSemaphoreTake(file_mutex, portMAX_DELAY);
+
+    // Take the pending changes; anything changed from here on is saved next time
+    int32_t saved_owners[MAX_TEMPLATE_COUNT];
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    uint64_t rows = dirty_rows;
+    uint64_t row_owners = dirty_owners;
+    int count = row_count;
+    bool rewrite = rewrite_file;
+    uint32_t moves = moves_made;
+    memcpy(saved_owners, owners, sizeof(saved_owners));
+    bool clean = !rewrite && !rows && !row_owners && count == saved_count;
+    if (clean) {
+        moves_saved = moves;
+    }
+    dirty_rows = 0;
+    dirty_owners = 0;
+    rewrite_file = false;
+    xSemaphoreGive(store_mutex);
+
+    if (clean) {
+        xSemaphoreGive(file_mutex);
+        return ESP_OK;
+    }
+    esp_err_t err = rewrite ? rewrite_store(&count) : update_store(rows, row_owners, saved_owners, count);
+    if (err == ESP_OK) {
+        saved_count = count;
+        xSemaphoreTake(store_mutex, portMAX_DELAY);
+        moves_saved = moves;
+        xSemaphoreGive(store_mutex);
+    } else {
+        xSemaphoreTake(store_mutex, portMAX_DELAY);
+        dirty_rows |= rows;
+        dirty_owners |= row_owners;
+        rewrite_file = rewrite_file || rewrite;
+        xSemaphoreGive(store_mutex);
+    }
+    xSemaphoreGive(file_mutex);
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to save templates");
+    } else {
+        ESP_LOGD(TAG, "Templates saved (%d live of %d rows)", live_count, count);
+    }
+    return err;
+}
+
+void face_store_clear(void)
+{
+    xSemaphoreTake(file_mutex, portMAX_DELAY);
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_TEMPLATE_COUNT; i++) {
+        set_owner(i, FACE_STORE_TOMBSTONE);
+        hot_retarget(i, -1);
+        std::atomic_ref<uint32_t>(row_hits[i]).store(0, std::memory_order_relaxed);
+    }
+    retired_rows |= row_count > 0 ? ~0ULL >> (64 - row_count) : 0;
+    cross_known = false;  // Until the compactor has looked at the new rows
+    publish_hot_exit();
+    set_row_count(0);
+    live_count = 0;
+    dirty_rows = 0;
+    dirty_owners = 0;
+    moves_saved = moves_made;  // Nothing of the old file is kept
+    rewrite_file = true;
+    xSemaphoreGive(store_mutex);
+    xSemaphoreGive(file_mutex);
+}
+
+int face_store_get_feat_len(void)
+{
+    return feat_len;
+}
+
+esp_err_t face_store_set_feat_len(int len)
+{
+    if (len <= 0 || len > FACE_FEAT_MAX_LEN) {
+        ESP_LOGE(TAG, "Unsupported embedding length %d", len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    esp_err_t err = ESP_OK;
+    if (row_count > 0 && len != feat_len) {
+        ESP_LOGE(TAG, "Embedding length %d does not match stored templates (%d)", len, feat_len);
+        err = ESP_ERR_INVALID_STATE;
+    } else if (len != feat_len) {
+        // Row offsets in the file depend on it
+        feat_len = len;
+        rewrite_file = true;
+    }
+    xSemaphoreGive(store_mutex);
+    return err;
+}
+
+int face_store_count(void)
+{
+    return live_count;
+}
+
+int face_store_count_owner(int owner)
+{
+    int n = 0;
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    for (int i = 0; i < row_count; i++) {
+        if (owners[i] == owner) {
+            n++;
+        }
+    }
+    xSemaphoreGive(store_mutex);
+    return n;
+}
+
+esp_err_t face_store_add(int owner, const float *const *new_feats, int n)
+{
+    if (feat_len == 0) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // New rows go at the end; close holes now if the compactor has not got to
+    // them, saving each move before the next like the compactor does
+    auto full = [n]() {
+        xSemaphoreTake(store_mutex, portMAX_DELAY);
+        bool no_room = row_count + n > MAX_TEMPLATE_COUNT;
+        xSemaphoreGive(store_mutex);
+        return no_room;
+    };
+    while (full() && face_store_save() == ESP_OK && compact_step()) {
+    }
+
+    xSemaphoreTake(file_mutex, portMAX_DELAY);
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    if (row_count + n > MAX_TEMPLATE_COUNT || moves_saved != moves_made) {
+        xSemaphoreGive(store_mutex);
+        xSemaphoreGive(file_mutex);
+        ESP_LOGE(TAG, "Template store full");
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < n; i++) {
+        int row = row_count + i;
+        reuse_row(row);
+        memcpy(feat_row(row), new_feats[i], feat_len * sizeof(float));
+        std::atomic_ref<uint32_t>(row_hits[row]).store(0, std::memory_order_relaxed);
+        set_owner(row, owner);
+        cross_add_row(row);
+        dirty_rows |= 1ULL << row;
+        dirty_owners |= 1ULL << row;
+    }
+    live_count += n;
+    set_row_count(row_count + n);
+    xSemaphoreGive(store_mutex);
+    xSemaphoreGive(file_mutex);
+    return ESP_OK;
+}
+
+void face_store_remove_owner(int owner)
+{
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    for (int i = 0; i < row_count; i++) {
+        if (owners[i] == owner) {
+            tombstone_row(i);
+        }
+    }
+    xSemaphoreGive(store_mutex);
+    wake_compactor();
+}
+
+void face_store_remove_last(int owner, int n)
+{
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    for (int i = row_count - 1; i >= 0 && n > 0; i--) {
+        if (owners[i] == owner) {
+            tombstone_row(i);
+            n--;
+        }
+    }
+    xSemaphoreGive(store_mutex);
+    wake_compactor();
+}
+
+void face_store_retain(const int *keep, int n)
+{
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    for (int i = 0; i < row_count; i++) {
+        if (owners[i] == FACE_STORE_TOMBSTONE) {
+            continue;
+        }
+        bool kept = false;
+        for (int j = 0; j < n && !kept; j++) {
+            kept = owners[i] == keep[j];
+        }
+        if (!kept) {
+            tombstone_row(i);
+        }
+    }
+    xSemaphoreGive(store_mutex);
+    wake_compactor();
+}
+
+float face_store_owner_similarity(int a, int b)
+{
+    float best = -1.0f;
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    for (int i = 0; i < row_count; i++) {
+        if (owners[i] != a) {
+            continue;
+        }
+        for (int j = 0; j < row_count; j++) {
+            if (owners[j] != b) {
+                continue;
+            }
+            const float *x = feat_row(i);
+            const float *y = feat_row(j);
+            float sim = 0.0f;
+            for (int k = 0; k < feat_len; k++) {
+                sim += x[k] * y[k];
+            }
+            best = sim > best ? sim : best;
+        }
+    }
+    xSemaphoreGive(store_mutex);
+    return best;
+}
+
+int face_store_reassign(int from, int to, int max_to)
+{
+    xSemaphoreTake(store_mutex, portMAX_DELAY);
+    int n_to = 0;
+    for (int i = 0; i < row_count; i++) {
+        n_to += owners[i] == to;
+    }
+    for (int i = 0; i < row_count; i++) {
+        if (owners[i] != from) {
+            continue;
+        }
+        if (n_to < max_to) {
+            set_owner(i, to);
+            dirty_owners |= 1ULL << i;
+            n_to++;
+        } else {
+            tombstone_row(i);
+        }
+    }
+    xSemaphoreGive(store_mutex);
+    wake_compactor();
+    return n_to;
+}
+
+int face_store_match(const float *feat, float *similarity_out)
+{
+    int best_row = -1;
+    int best_owner = -1;
+    float best_sim = -1.0f;
+
+    // Lock-free, see the comment at the top
+    uint32_t rcu = rcu_read_lock();
+    bool hot = hot_active.load(std::memory_order_acquire);
+    for (int slot = 0; hot && slot < FACE_STORE_HOT_ROWS; slot++) {
+        int row = std::atomic_ref<int>(hot_src[slot]).load(std::memory_order_acquire);
+        if (row < 0) {
+            continue;
+        }
+        int32_t owner = std::atomic_ref<int32_t>(owners[row]).load(std::memory_order_acquire);
+        float sim = dot(feat, hot_row(slot), feat_len);
+        if (owner != FACE_STORE_TOMBSTONE && sim > best_sim) {
+            best_sim = sim;
+            best_owner = owner;
+            best_row = row;
+        }
+    }
+
+    // A confident hot match leaves the PSRAM tier unread
+    if (best_sim < hot_exit.load(std::memory_order_relaxed)) {
+        int rows = std::atomic_ref<int>(row_count).load(std::memory_order_acquire);
+        for (int i = 0; i < rows; i++) {
+            int32_t owner = std::atomic_ref<int32_t>(owners[i]).load(std::memory_order_acquire);
+            if (owner == FACE_STORE_TOMBSTONE) {
+                continue;
+            }
+            float sim = dot(feat, feat_row(i), feat_len);
+            if (sim > best_sim) {
+                best_sim = sim;
+                best_owner = owner;
+                best_row = i;
+            }
+        }
+    }
+    // Recognitions drive the hot tier
+    if (hot && best_row >= 0 && best_sim >= FACE_RECOGNITION_THRESHOLD) {
+        std::atomic_ref<uint32_t>(row_hits[best_row]).fetch_add(1, std::memory_order_relaxed);
+    }
+    rcu_read_unlock(rcu);
+
+    if (similarity_out) {
+        *similarity_out = best_sim;
+    }
+    return best_owner;
+}
@@ -0,0 +1,70 @@
+#ifndef FACE_STORE_H
+#define FACE_STORE_H
+
+#include <stdio.h>
+#include "esp_err.h"
+#include "face_recognition.h"
+
+// Face template store: a matrix of L2-normalized embeddings in PSRAM, each tagged
+// with the face ID that owns it. Removing templates leaves holes that a background
+// task closes again. Persisted as a single file that is updated in place.
+// The templates of the most often recognized identities are also copied to a
+// small internal-RAM tier that is searched first.
+
+#define FACE_FEAT_MAX_LEN 512
+#define MAX_TEMPLATE_COUNT (MAX_FACE_ID_COUNT * MAX_FACE_TEMPLATES)
+
+// Allocate the store and load templates from path (missing file means empty store).
+// rcu_init must have been called.
+esp_err_t face_store_init(const char *path);
+
+// Write the templates changed since the last save to the store file
+esp_err_t face_store_save(void);
+
+// Remove every template (RAM only, call face_store_save to persist)
+void face_store_clear(void);
+
+// Embedding length, 0 until the first template or face_store_set_feat_len
+int face_store_get_feat_len(void);
+esp_err_t face_store_set_feat_len(int feat_len);
+
+// Number of templates, in total or owned by one face ID
+int face_store_count(void);
+int face_store_count_owner(int owner);
+
+// Add n templates for one owner in a single step (RAM only). When the store is
+// full of deleted rows, the compaction moves that make room are saved first.
+esp_err_t face_store_add(int owner, const float *const *feats, int n);
+
+// Remove all templates of one owner (RAM only). No rows move, so this is
+// cheap and saving it only writes the owner entries.
+void face_store_remove_owner(int owner);
+
+// Remove the n newest templates of one owner (RAM only), to undo a face_store_add
+void face_store_remove_last(int owner, int n);
+
+// Remove the templates of every owner not in keep (RAM only)
+void face_store_retain(const int *keep, int n);
+
+// Best cosine similarity between any template of owner a and any of owner b,
+// -1 if either has none
+float face_store_owner_similarity(int a, int b);
+
+// Give the templates of owner from to owner to, keeping at most max_to templates
+// for to and dropping the rest (RAM only). Returns the templates to owns afterwards.
+int face_store_reassign(int from, int to, int max_to);
+
+// Best matching template. Returns the owner and stores the cosine similarity,
+// or returns -1 if the store is empty. A confident match in the hot tier is
+// returned without searching the rest. Never waits for writers; a concurrent
+// change is either seen whole per template or not at all.
+int face_store_match(const float *feat, float *similarity_out);
+
+// Replace path with tmp_path. SPIFFS cannot rename over an existing file, so the
+// old file is removed first; face_store_open_latest recovers from a crash in between.
+esp_err_t face_store_replace_file(const char *tmp_path, const char *path);
+
+// Open path for reading, falling back to tmp_path if only that one exists
+FILE *face_store_open_latest(const char *path, const char *tmp_path);
+
+#endif // FACE_STORE_H
@@ -0,0 +1,112 @@
+#include "frame_cache.h"
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "trace.h"
+
+static const char *TAG = "frame_cache";
+
+// The latest entry holds one reference of its own, dropped when it is replaced
+static frame_cache_entry_t *latest = NULL;
+static uint32_t next_seq = 1;
+static int holders = 0;
+static int64_t wanted_until_us = 0;
+static portMUX_TYPE cache_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Drop the latest frame, when the new one is not cached
+static void invalidate(void)
+{
+    portENTER_CRITICAL(&cache_lock);
+    frame_cache_entry_t *old = latest;
+    latest = NULL;
+    portEXIT_CRITICAL(&cache_lock);
+    frame_cache_release(old);
+}
+
+frame_cache_entry_t *frame_cache_put(const camera_fb_t *fb)
+{
+    portENTER_CRITICAL(&cache_lock);
+    bool wanted = holders > 0 || esp_timer_get_time() < wanted_until_us;
+    portEXIT_CRITICAL(&cache_lock);
+    if (!wanted) {
+        invalidate();
+        return NULL;
+    }
+
+    // Header and JPEG in one PSRAM block
+    frame_cache_entry_t *entry = (frame_cache_entry_t *)heap_caps_malloc(sizeof(frame_cache_entry_t) + fb->len,
+                                                                         MALLOC_CAP_SPIRAM);
+    if (!entry) {
+        ESP_LOGW(TAG, "No memory to cache a %u byte frame", (unsigned)fb->len);
+        invalidate();
+        return NULL;
+    }
+    entry->buf = (uint8_t *)(entry + 1);
+    memcpy(entry->buf, fb->buf, fb->len);
+    entry->len = fb->len;
+    entry->width = fb->width;
+    entry->height = fb->height;
+    entry->capture_us = trace_fb_capture_us(fb);
+    entry->wall_time = time(NULL);
+    entry->refs = 2;  // The cache's and the caller's
+
+    portENTER_CRITICAL(&cache_lock);
+    entry->seq = next_seq++;
+    frame_cache_entry_t *old = latest;
+    latest = entry;
+    portEXIT_CRITICAL(&cache_lock);
+
+    frame_cache_release(old);
+    return entry;
+}
+
+void frame_cache_want(int ms)
+{
+    int64_t until = esp_timer_get_time() + ms * 1000LL;
+    portENTER_CRITICAL(&cache_lock);
+    if (until > wanted_until_us) {
+        wanted_until_us = until;
+    }
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+void frame_cache_hold(bool hold)
+{
+    portENTER_CRITICAL(&cache_lock);
+    holders += hold ? 1 : -1;
+    portEXIT_CRITICAL(&cache_lock);
+}
+
+frame_cache_entry_t *frame_cache_get(void)
+{
+    portENTER_CRITICAL(&cache_lock);
+    frame_cache_entry_t *entry = latest;
+    if (entry) {
+        entry->refs++;
+    }
+    portEXIT_CRITICAL(&cache_lock);
+    return entry;
+}
+
+frame_cache_entry_t *frame_cache_ref(frame_cache_entry_t *entry)
+{
+    portENTER_CRITICAL(&cache_lock);
+    entry->refs++;
+    portEXIT_CRITICAL(&cache_lock);
+    return entry;
+}
+
+void frame_cache_release(frame_cache_entry_t *entry)
+{
+    if (!entry) {
+        return;
+    }
+    portENTER_CRITICAL(&cache_lock);
+    bool last = --entry->refs == 0;
+    portEXIT_CRITICAL(&cache_lock);
+    if (last) {
+        heap_caps_free(entry);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <time.h>
+#include "esp_camera.h"
+
+// Copy of the most recent JPEG frame, shared by reference. An entry stays valid
+// until every holder has released it, even after newer frames replaced it.
+// Frames are only copied while someone reads them: a reader of every frame (the
+// clip recorder) holds the cache open, an occasional reader (/capture) keeps it
+// open for a while with each read. Otherwise there is no latest frame.
+typedef struct {
+    uint8_t *buf;         // JPEG data
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    uint32_t seq;         // Increments with every cached frame, used as ETag
+    int64_t capture_us;   // esp_timer time the sensor captured the frame
+    time_t wall_time;     // Wall-clock time it was cached, for Last-Modified
+    int refs;             // Owned by frame_cache.cpp
+} frame_cache_entry_t;
+
+// Make a copy of a frame the latest one and return it with a reference taken.
+// Called by whoever captured it; the frame buffer itself goes back to the driver
+// as usual. Returns NULL, and drops the previous latest frame so it is never
+// taken for this one, if nobody reads the cache or there is no memory.
+frame_cache_entry_t *frame_cache_put(const camera_fb_t *fb);
+
+// Keep copying frames for at least ms from now
+void frame_cache_want(int ms);
+
+// Keep copying frames until released, counted per holder
+void frame_cache_hold(bool hold);
+
+// Latest frame with a reference taken, NULL if none. Release it when done.
+frame_cache_entry_t *frame_cache_get(void);
+
+// Take another reference to an entry already held
+frame_cache_entry_t *frame_cache_ref(frame_cache_entry_t *entry);
+
+void frame_cache_release(frame_cache_entry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FRAME_CACHE_H
@@ -0,0 +1,134 @@
+#include "identity_vote.h"
+#include "roi.h"
+#include <string.h>
+#include <algorithm>
+#include "esp_log.h"
+
+static const char *TAG = "identity_vote";
+
+void identity_vote_init(identity_vote_t *v)
+{
+    memset(v, 0, sizeof(*v));
+}
+
+// Track that continues this box, or a fresh one in a free or the stalest slot
+static int find_track(identity_vote_t *v, const int box[4])
+{
+    int best = -1;
+    float best_iou = IDENTITY_VOTE_MIN_IOU;
+    int stalest = 0;
+    for (int i = 0; i < IDENTITY_VOTE_MAX_TRACKS; i++) {
+        identity_track_t *t = &v->tracks[i];
+        if (!t->active) {
+            stalest = i;
+            continue;
+        }
+        float iou = roi_box_iou(t->box, box);
+        if (iou >= best_iou) {
+            best_iou = iou;
+            best = i;
+        }
+        if (v->tracks[stalest].active && t->last_seen_us < v->tracks[stalest].last_seen_us) {
+            stalest = i;
+        }
+    }
+    if (best >= 0) {
+        return best;
+    }
+
+    identity_track_t *t = &v->tracks[stalest];
+    memset(t, 0, sizeof(*t));
+    t->active = true;
+    t->confirmed = -1;
+    return stalest;
+}
+
+// Histogram slot counting id. A window of IDENTITY_VOTE_WINDOW identifications
+// cannot name more IDs than there are slots, so a free one always exists.
+static int find_slot(identity_track_t *t, int id)
+{
+    if (id < 0) {
+        return IDENTITY_VOTE_UNKNOWN;
+    }
+    int free_slot = -1;
+    for (int i = 0; i < IDENTITY_VOTE_SLOTS; i++) {
+        if (t->votes[i] == 0) {
+            free_slot = free_slot < 0 ? i : free_slot;
+        } else if (t->slot_id[i] == id) {
+            return i;
+        }
+    }
+    t->slot_id[free_slot] = id;
+    return free_slot;
+}
+
+// Slide the window by one identification and update the confirmed identity.
+// Only the slot that gained a vote can be newly confirmed and only the confirmed
+// slot can be dropped, so this is constant time.
+static void vote(identity_track_t *t, int id, float similarity)
+{
+    if (t->count == IDENTITY_VOTE_WINDOW) {
+        // Free the oldest identification's slot before looking one up
+        int old = t->window_id[t->next];
+        t->votes[old]--;
+        t->sim_sum[old] = t->votes[old] ? t->sim_sum[old] - t->window_sim[t->next] : 0.0f;
+        t->count--;
+    }
+    int slot = find_slot(t, id);
+
+    t->count++;
+    t->window_id[t->next] = (int8_t)slot;
+    t->window_sim[t->next] = similarity;
+    t->next = (t->next + 1) % IDENTITY_VOTE_WINDOW;
+    t->votes[slot]++;
+    t->sim_sum[slot] += similarity;
+
+    if (t->confirmed >= 0 && t->votes[t->confirmed] <= IDENTITY_VOTE_EXIT) {
+        ESP_LOGI(TAG, "Track lost ID %d", t->slot_id[t->confirmed]);
+        t->confirmed = -1;
+    }
+    if (slot != IDENTITY_VOTE_UNKNOWN && slot != t->confirmed && t->votes[slot] >= IDENTITY_VOTE_ENTER &&
+        t->sim_sum[slot] >= IDENTITY_VOTE_ENTER_SIM * t->votes[slot] &&
+        (t->confirmed < 0 || t->votes[slot] > t->votes[t->confirmed])) {
+        ESP_LOGI(TAG, "Track confirmed ID %d (%d/%d votes)", t->slot_id[slot], t->votes[slot], t->count);
+        t->confirmed = slot;
+    }
+}
+
+int identity_vote_observe(identity_vote_t *v, const int box[4], bool identified, int id,
+                          float similarity, int64_t now_us)
+{
+    int index = find_track(v, box);
+    identity_track_t *t = &v->tracks[index];
+    memcpy(t->box, box, sizeof(t->box));
+    t->last_seen_us = now_us;
+    if (identified) {
+        vote(t, id, similarity);
+    }
+    return index;
+}
+
+void identity_vote_expire(identity_vote_t *v, int64_t now_us)
+{
+    for (int i = 0; i < IDENTITY_VOTE_MAX_TRACKS; i++) {
+        identity_track_t *t = &v->tracks[i];
+        if (t->active && now_us - t->last_seen_us > IDENTITY_VOTE_TRACK_TIMEOUT_MS * 1000LL) {
+            t->active = false;
+        }
+    }
+}
+
+int identity_vote_confirmed(const identity_vote_t *v, int track, float *similarity)
+{
+    if (track < 0 || track >= IDENTITY_VOTE_MAX_TRACKS || !v->tracks[track].active) {
+        return -1;
+    }
+    const identity_track_t *t = &v->tracks[track];
+    if (t->confirmed < 0) {
+        return -1;
+    }
+    if (similarity) {
+        *similarity = t->sim_sum[t->confirmed] / t->votes[t->confirmed];
+    }
+    return t->slot_id[t->confirmed];
+}
@@ -0,0 +1,66 @@
+#ifndef IDENTITY_VOTE_H
+#define IDENTITY_VOTE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "face_recognition.h"
+
+// Per-frame identities are noisy: one bad frame says "Unknown", one false match
+// names someone else. A track follows one face across frames and votes over its
+// last IDENTITY_VOTE_WINDOW identifications. An identity is confirmed with
+// IDENTITY_VOTE_ENTER votes and kept until it drops to IDENTITY_VOTE_EXIT votes.
+
+#define IDENTITY_VOTE_WINDOW 5             // Identifications kept per track
+#define IDENTITY_VOTE_ENTER 3              // Votes an identity needs to be confirmed
+#define IDENTITY_VOTE_ENTER_SIM 0.55f      // Mean similarity it needs as well
+#define IDENTITY_VOTE_EXIT 1               // A confirmed identity with this few votes is dropped
+#define IDENTITY_VOTE_MAX_TRACKS 4
+#define IDENTITY_VOTE_TRACK_TIMEOUT_MS 5000  // Tracks not seen for this long are dropped
+#define IDENTITY_VOTE_MIN_IOU 0.3f         // Box overlap for a face to continue a track
+
+// Face IDs are not bounded, so each track counts votes in histogram slots that
+// are bound to an ID while it has votes in the window
+#define IDENTITY_VOTE_SLOTS IDENTITY_VOTE_WINDOW
+#define IDENTITY_VOTE_UNKNOWN IDENTITY_VOTE_SLOTS  // Histogram slot of "Unknown"
+
+typedef struct {
+    bool active;
+    int box[4];                  // Last box of the face [x1, y1, x2, y2]
+    int64_t last_seen_us;
+    int confirmed;               // Histogram slot of the confirmed face ID, -1 if none
+    uint8_t next;                // Next slot of the window to overwrite
+    uint8_t count;               // Filled slots of the window
+    int8_t window_id[IDENTITY_VOTE_WINDOW];     // Histogram slot of each identification
+    float window_sim[IDENTITY_VOTE_WINDOW];
+    int slot_id[IDENTITY_VOTE_SLOTS];           // Face ID of each slot with votes
+    uint8_t votes[IDENTITY_VOTE_SLOTS + 1];     // Identifications per slot in the window
+    float sim_sum[IDENTITY_VOTE_SLOTS + 1];     // Their summed similarity
+} identity_track_t;
+
+typedef struct {
+    identity_track_t tracks[IDENTITY_VOTE_MAX_TRACKS];
+} identity_vote_t;
+
+void identity_vote_init(identity_vote_t *v);
+
+// Attribute a detected face to a track, starting one if no track overlaps it.
+// With identified set, id (-1 for unknown) and similarity are added to its vote;
+// otherwise the track is only kept alive. Returns the track index.
+int identity_vote_observe(identity_vote_t *v, const int box[4], bool identified, int id,
+                          float similarity, int64_t now_us);
+
+// Drop tracks that have not been seen for IDENTITY_VOTE_TRACK_TIMEOUT_MS
+void identity_vote_expire(identity_vote_t *v, int64_t now_us);
+
+// Confirmed face ID of a track and its mean similarity, -1 if none
+int identity_vote_confirmed(const identity_vote_t *v, int track, float *similarity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IDENTITY_VOTE_H
@@ -0,0 +1,209 @@
+#include "inference.h"
+#include <string.h>
+#include <stdio.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+static const char *TAG = "inference";
+
+static inference_job_t jobs[INFERENCE_MAX_JOBS];
+static uint32_t next_job_id = 1;
+static TaskHandle_t executor_task = NULL;
+static portMUX_TYPE jobs_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static bool is_pending(const inference_job_t *job)
+{
+    return job->state == INFERENCE_JOB_QUEUED || job->state == INFERENCE_JOB_RUNNING;
+}
+
+// Whether a should run before b: priority, then the earlier deadline, then submission order
+static bool runs_before(const inference_job_t *a, const inference_job_t *b)
+{
+    if (a->priority != b->priority) {
+        return a->priority < b->priority;
+    }
+    if (a->deadline_us != b->deadline_us) {
+        if (a->deadline_us == 0 || b->deadline_us == 0) {
+            return b->deadline_us == 0;
+        }
+        return a->deadline_us < b->deadline_us;
+    }
+    return (int32_t)(a->id - b->id) < 0;
+}
+
+static void finish(inference_job_t *job, inference_job_state_t state)
+{
+    if (job->done) {
+        job->done(job, state == INFERENCE_JOB_EXPIRED);
+    }
+    portENTER_CRITICAL(&jobs_lock);
+    job->state = state;
+    job->finished_us = esp_timer_get_time();
+    portEXIT_CRITICAL(&jobs_lock);
+}
+
+static void executor(void *arg)
+{
+    while (true) {
+        int64_t now = esp_timer_get_time();
+        int64_t wake_us = INT64_MAX;
+        inference_job_t *job = NULL;
+        inference_job_t *expired = NULL;
+
+        portENTER_CRITICAL(&jobs_lock);
+        for (int i = 0; i < INFERENCE_MAX_JOBS && !expired; i++) {
+            inference_job_t *j = &jobs[i];
+            if (j->state == INFERENCE_JOB_QUEUED && j->deadline_us && now > j->deadline_us) {
+                expired = j;
+            } else if (!is_pending(j)) {
+                continue;
+            } else if (j->next_step_us > now) {
+                wake_us = j->next_step_us < wake_us ? j->next_step_us : wake_us;
+            } else if (!job || runs_before(j, job)) {
+                job = j;
+            }
+        }
+        if (!expired && job && job->state == INFERENCE_JOB_QUEUED) {
+            job->state = INFERENCE_JOB_RUNNING;
+            job->started_us = now;
+        }
+        portEXIT_CRITICAL(&jobs_lock);
+
+        if (expired) {
+            ESP_LOGW(TAG, "Job %lu (%s) expired after %lld ms in the queue", (unsigned long)expired->id,
+                     expired->kind, (now - expired->submitted_us) / 1000);
+            expired->result = -1;
+            snprintf(expired->message, sizeof(expired->message), "Deadline passed before the job could start");
+            finish(expired, INFERENCE_JOB_EXPIRED);
+            continue;
+        }
+        if (!job) {
+            // Sleep until the next delayed step or a new job
+            TickType_t wait = portMAX_DELAY;
+            if (wake_us != INT64_MAX) {
+                wait = pdMS_TO_TICKS((wake_us - now + 999) / 1000) + 1;
+            }
+            ulTaskNotifyTake(pdTRUE, wait);
+            continue;
+        }
+
+        int delay_ms = job->step(job);
+        if (delay_ms == INFERENCE_STEP_DONE) {
+            finish(job, INFERENCE_JOB_DONE);
+        } else {
+            portENTER_CRITICAL(&jobs_lock);
+            job->next_step_us = esp_timer_get_time() + delay_ms * 1000LL;
+            portEXIT_CRITICAL(&jobs_lock);
+        }
+    }
+}
+
+esp_err_t inference_init(void)
+{
+    if (executor_task) {
+        return ESP_OK;
+    }
+    if (xTaskCreatePinnedToCore(executor, "inference", INFERENCE_TASK_STACK, NULL, INFERENCE_TASK_PRIORITY,
+                                &executor_task, INFERENCE_TASK_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the inference executor");
+        executor_task = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+uint32_t inference_submit(const char *kind, inference_priority_t priority, int64_t deadline_us,
+                          inference_step_fn_t step, inference_done_fn_t done, void *arg)
+{
+    if (!executor_task || !step) {
+        return 0;
+    }
+
+    // A free slot, else the one finished longest ago
+    portENTER_CRITICAL(&jobs_lock);
+    inference_job_t *job = NULL;
+    for (int i = 0; i < INFERENCE_MAX_JOBS; i++) {
+        inference_job_t *j = &jobs[i];
+        if (j->state == INFERENCE_JOB_FREE) {
+            job = j;
+            break;
+        }
+        if (!is_pending(j) && (!job || j->finished_us < job->finished_us)) {
+            job = j;
+        }
+    }
+    uint32_t id = 0;
+    if (job) {
+        id = next_job_id++;
+        memset(job, 0, sizeof(*job));
+        job->id = id;
+        job->kind = kind;
+        job->priority = priority;
+        job->submitted_us = esp_timer_get_time();
+        job->deadline_us = deadline_us;
+        job->step = step;
+        job->done = done;
+        job->arg = arg;
+        job->state = INFERENCE_JOB_QUEUED;
+    }
+    portEXIT_CRITICAL(&jobs_lock);
+
+    if (!job) {
+        ESP_LOGW(TAG, "Job table full, %s job refused", kind);
+        return 0;
+    }
+    xTaskNotifyGive(executor_task);
+    return id;
+}
+
+bool inference_get_job(uint32_t id, inference_job_t *job)
+{
+    bool found = false;
+    portENTER_CRITICAL(&jobs_lock);
+    for (int i = 0; i < INFERENCE_MAX_JOBS && !found; i++) {
+        if (jobs[i].state != INFERENCE_JOB_FREE && jobs[i].id == id) {
+            *job = jobs[i];
+            found = true;
+        }
+    }
+    portEXIT_CRITICAL(&jobs_lock);
+    return found;
+}
+
+int inference_list_jobs(inference_job_t *out, int max_jobs)
+{
+    int n = 0;
+    portENTER_CRITICAL(&jobs_lock);
+    for (int i = 0; i < INFERENCE_MAX_JOBS && n < max_jobs; i++) {
+        if (jobs[i].state != INFERENCE_JOB_FREE) {
+            out[n++] = jobs[i];
+        }
+    }
+    portEXIT_CRITICAL(&jobs_lock);
+    return n;
+}
+
+int inference_count(inference_priority_t priority)
+{
+    int n = 0;
+    portENTER_CRITICAL(&jobs_lock);
+    for (int i = 0; i < INFERENCE_MAX_JOBS; i++) {
+        n += is_pending(&jobs[i]) && jobs[i].priority == priority;
+    }
+    portEXIT_CRITICAL(&jobs_lock);
+    return n;
+}
+
+const char *inference_state_name(inference_job_state_t state)
+{
+    switch (state) {
+        case INFERENCE_JOB_FREE: return "free";
+        case INFERENCE_JOB_QUEUED: return "queued";
+        case INFERENCE_JOB_RUNNING: return "running";
+        case INFERENCE_JOB_DONE: return "done";
+        case INFERENCE_JOB_EXPIRED: return "expired";
+    }
+    return "?";
+}
@@ -0,0 +1,93 @@
+#ifndef INFERENCE_H
+#define INFERENCE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+// Inference executor: one task owns the detector and embedding models and runs
+// every job that needs them, so model access is serialized. Jobs run in steps;
+// between two steps of a job the executor picks the most urgent runnable job
+// again, so a long enrollment never holds up live recognition for more than
+// one step.
+
+#define INFERENCE_MAX_JOBS 8            // Queued, running and recently finished jobs
+#define INFERENCE_TASK_STACK 8192
+#define INFERENCE_TASK_PRIORITY 5
+#define INFERENCE_TASK_CORE 1           // The face detector's tile helper runs on the other core
+#define INFERENCE_STEP_DONE -1          // Step return value: the job is finished
+
+// Lower runs first
+typedef enum {
+    INFERENCE_PRIORITY_LIVE = 0,    // Camera frames, latency matters most
+    INFERENCE_PRIORITY_REMOTE,      // Uploads with a client waiting on the answer
+    INFERENCE_PRIORITY_BACKGROUND,  // Enrollment
+} inference_priority_t;
+
+typedef enum {
+    INFERENCE_JOB_FREE = 0,
+    INFERENCE_JOB_QUEUED,
+    INFERENCE_JOB_RUNNING,   // Started; between steps or in one
+    INFERENCE_JOB_DONE,
+    INFERENCE_JOB_EXPIRED,   // Its deadline passed before it could start
+} inference_job_state_t;
+
+typedef struct inference_job inference_job_t;
+
+// Runs one step in the executor. Returns INFERENCE_STEP_DONE when the job is
+// finished, otherwise the delay in ms before its next step (0 for as soon as
+// nothing more urgent is runnable).
+typedef int (*inference_step_fn_t)(inference_job_t *job);
+
+// Called in the executor once the job is finished or expired, to release arg
+typedef void (*inference_done_fn_t)(inference_job_t *job, bool expired);
+
+struct inference_job {
+    uint32_t id;
+    const char *kind;              // Label for the status endpoint, e.g. "enroll"
+    inference_priority_t priority;
+    inference_job_state_t state;
+    int64_t submitted_us;
+    int64_t started_us;
+    int64_t finished_us;
+    int64_t deadline_us;           // Latest start, 0 for none
+    int64_t next_step_us;          // Not stepped again before this time
+    inference_step_fn_t step;
+    inference_done_fn_t done;
+    void *arg;
+    // Outcome set by the job, valid once it is done
+    int result;                    // Job specific, e.g. the enrolled face ID or -1
+    int detail;                    // Job specific, e.g. the face an enrollment duplicates
+    char message[64];              // Why it failed, empty on success
+};
+
+// Start the executor task
+esp_err_t inference_init(void);
+
+// Queue a job. deadline_us is the esp_timer time by which it must have started,
+// 0 for none; a job that misses it is finished as expired without running.
+// Returns the job ID, 0 if the job table is full of unfinished jobs.
+uint32_t inference_submit(const char *kind, inference_priority_t priority, int64_t deadline_us,
+                          inference_step_fn_t step, inference_done_fn_t done, void *arg);
+
+// Snapshot of a job, false if it is unknown or its slot was reused since
+bool inference_get_job(uint32_t id, inference_job_t *job);
+
+// Snapshot of every job in the table, returns how many were stored
+int inference_list_jobs(inference_job_t *jobs, int max_jobs);
+
+// Queued and running jobs of one priority
+int inference_count(inference_priority_t priority);
+
+// "queued", "running", "done" or "expired"
+const char *inference_state_name(inference_job_state_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // INFERENCE_H
@@ -0,0 +1,180 @@
+#include "json_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+static void flush(json_writer_t *w)
+{
+    if (w->len > 0 && w->err == ESP_OK) {
+        w->err = httpd_resp_send_chunk(w->req, w->buf, w->len);
+    }
+    w->len = 0;
+}
+
+static void put(json_writer_t *w, const char *s, size_t n)
+{
+    while (n > 0 && w->err == ESP_OK) {
+        if (w->len == sizeof(w->buf)) {
+            flush(w);
+            continue;
+        }
+        size_t k = sizeof(w->buf) - w->len;
+        k = n < k ? n : k;
+        memcpy(w->buf + w->len, s, k);
+        w->len += k;
+        s += k;
+        n -= k;
+    }
+}
+
+static void put_char(json_writer_t *w, char c)
+{
+    put(w, &c, 1);
+}
+
+static void put_string(json_writer_t *w, const char *s)
+{
+    put_char(w, '"');
+    // Copy runs of plain characters at once, escape the rest
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        put(w, run, s - run);
+        run = s + 1;
+        char esc[8];
+        switch (c) {
+            case '"': put(w, "\\\"", 2); break;
+            case '\\': put(w, "\\\\", 2); break;
+            case '\n': put(w, "\\n", 2); break;
+            case '\r': put(w, "\\r", 2); break;
+            case '\t': put(w, "\\t", 2); break;
+            default:
+                snprintf(esc, sizeof(esc), "\\u%04x", c);
+                put(w, esc, 6);
+        }
+    }
+    put(w, run, s - run);
+    put_char(w, '"');
+}
+
+// Separator and key in front of every value
+static void member(json_writer_t *w, const char *key)
+{
+    uint16_t bit = 1u << w->depth;
+    if (w->has_items & bit) {
+        put_char(w, ',');
+    }
+    w->has_items |= bit;
+    if (key) {
+        put_string(w, key);
+        put_char(w, ':');
+    }
+}
+
+static void open_container(json_writer_t *w, const char *key, char c)
+{
+    member(w, key);
+    put_char(w, c);
+    if (w->depth < JSON_WRITER_MAX_DEPTH - 1) {
+        w->depth++;
+    }
+    w->has_items &= ~(1u << w->depth);
+}
+
+static void close_container(json_writer_t *w, char c)
+{
+    if (w->depth > 0) {
+        w->depth--;
+    }
+    put_char(w, c);
+}
+
+void json_writer_begin(json_writer_t *w, httpd_req_t *req)
+{
+    w->req = req;
+    w->err = ESP_OK;
+    w->len = 0;
+    w->depth = 0;
+    w->has_items = 0;
+    httpd_resp_set_type(req, "application/json");
+}
+
+esp_err_t json_writer_end(json_writer_t *w)
+{
+    flush(w);
+    if (w->err == ESP_OK) {
+        w->err = httpd_resp_send_chunk(w->req, NULL, 0);
+    }
+    return w->err;
+}
+
+void json_obj_begin(json_writer_t *w, const char *key)
+{
+    open_container(w, key, '{');
+}
+
+void json_obj_end(json_writer_t *w)
+{
+    close_container(w, '}');
+}
+
+void json_arr_begin(json_writer_t *w, const char *key)
+{
+    open_container(w, key, '[');
+}
+
+void json_arr_end(json_writer_t *w)
+{
+    close_container(w, ']');
+}
+
+void json_str(json_writer_t *w, const char *key, const char *value)
+{
+    member(w, key);
+    if (value) {
+        put_string(w, value);
+    } else {
+        put(w, "null", 4);
+    }
+}
+
+void json_int(json_writer_t *w, const char *key, long long value)
+{
+    char num[24];
+    member(w, key);
+    put(w, num, snprintf(num, sizeof(num), "%lld", value));
+}
+
+void json_uint(json_writer_t *w, const char *key, unsigned long long value)
+{
+    char num[24];
+    member(w, key);
+    put(w, num, snprintf(num, sizeof(num), "%llu", value));
+}
+
+void json_num(json_writer_t *w, const char *key, double value, int decimals)
+{
+    char num[32];
+    member(w, key);
+    if (!isfinite(value)) {
+        put(w, "null", 4);
+        return;
+    }
+    int n = snprintf(num, sizeof(num), "%.*f", decimals, value);
+    put(w, num, n < (int)sizeof(num) ? n : sizeof(num) - 1);
+}
+
+void json_bool(json_writer_t *w, const char *key, bool value)
+{
+    member(w, key);
+    put(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+void json_null(json_writer_t *w, const char *key)
+{
+    member(w, key);
+    put(w, "null", 4);
+}
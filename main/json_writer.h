@@ -0,0 +1,61 @@
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "esp_http_server.h"
+
+// Streams a JSON response as HTTP chunks through a small fixed buffer, so the
+// response can be any size. Strings are escaped. Members are written with their
+// key; pass a NULL key for array elements and the top-level value.
+//
+//     json_writer_t w;
+//     json_writer_begin(&w, req);
+//     json_obj_begin(&w, NULL);
+//     json_str(&w, "name", name);
+//     json_obj_end(&w);
+//     return json_writer_end(&w);
+
+#define JSON_WRITER_BUF_SIZE 256
+#define JSON_WRITER_MAX_DEPTH 16
+
+typedef struct {
+    httpd_req_t *req;
+    esp_err_t err;        // First send error; anything written after it is dropped
+    size_t len;
+    int depth;
+    uint16_t has_items;   // Bit per depth: a value was already written at that level
+    char buf[JSON_WRITER_BUF_SIZE];
+} json_writer_t;
+
+// Sets the content type; the body is sent chunked
+void json_writer_begin(json_writer_t *w, httpd_req_t *req);
+
+// Flush and terminate the response. Returns the first send error, if any.
+esp_err_t json_writer_end(json_writer_t *w);
+
+void json_obj_begin(json_writer_t *w, const char *key);
+void json_obj_end(json_writer_t *w);
+void json_arr_begin(json_writer_t *w, const char *key);
+void json_arr_end(json_writer_t *w);
+
+// value NULL writes null
+void json_str(json_writer_t *w, const char *key, const char *value);
+void json_int(json_writer_t *w, const char *key, long long value);
+void json_uint(json_writer_t *w, const char *key, unsigned long long value);
+// Non-finite values are written as null
+void json_num(json_writer_t *w, const char *key, double value, int decimals);
+void json_bool(json_writer_t *w, const char *key, bool value);
+void json_null(json_writer_t *w, const char *key);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // JSON_WRITER_H
@@ -1,18 +1,36 @@
 #include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <algorithm>
+#include <atomic>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_system.h"
 #include "esp_log.h"
-#include "esp_wifi.h"
 #include "esp_event.h"
+#include "esp_netif.h"
 #include "nvs_flash.h"
-#include "esp_camera.h"
+#include "camera_source.h"
 #include "esp_http_server.h"
 #include "camera_pins.h"
-#include "driver/gpio.h"
 #include "face_recognition.h"
+#include "event_log.h"
+#include "recognition_state.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "roi.h"
+#include "identity_vote.h"
+#include "frame_cache.h"
+#include "clip_recorder.h"
+#include "capture_profile.h"
+#include "json_writer.h"
+#include "inference.h"
+#include "www_assets.h"  // Generated from www/ at build time
+#include "esp_timer.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_wifi.h"
+#include "driver/gpio.h"
 #include "esp_http_client.h"
 #include "esp_crt_bundle.h"
 #include "esp_tls.h"
@@ -20,6 +38,7 @@
 #include "esp_crt_bundle.h"
 #endif
 #include "led_strip.h"
+#endif
 
 #ifndef MIN
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
@@ -29,9 +48,11 @@
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
+#if !CONFIG_IDF_TARGET_LINUX
 // RGB LED PIN
 #define WS2812_PIN 48
 led_strip_handle_t led_strip;
+#endif
 
 static const char *TAG = "camera_http_server";
 
@@ -46,186 +67,81 @@ static const char* _STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %
 
 httpd_handle_t stream_httpd = NULL;
 static SemaphoreHandle_t camera_mutex = NULL;
-char name[MAX_NAME_LENGTH] = "Unknown";
-static char last_sent_name[MAX_NAME_LENGTH] = "";
-static TickType_t last_recognition_time = 0;
-static SemaphoreHandle_t name_mutex = NULL;
+
+// An uploaded image for /recognize. The request is detached from the httpd task,
+// which goes on serving others, and answered by the inference executor.
+typedef struct {
+    httpd_req_t *req;     // Async copy, completed once answered
+    uint8_t *body;        // Whole upload, PSRAM
+    uint8_t *jpeg;        // JPEG within the body
+    size_t jpeg_len;
+} recognize_job_t;
+
+// An enrollment running as an inference job, one frame per step
+typedef struct {
+    char name[MAX_NAME_LENGTH];
+    int frames;               // Frames to offer, 1 unless it is a burst
+    int templates;
+    bool centroid;
+    int taken;                // Frames offered or skipped so far
+    int usable;
+    int64_t camera_wait_us;   // When the camera was first found busy for this frame, 0 if it was not
+    face_burst_t *burst;
+    uint8_t *upload;          // Uploaded body the frame is in, NULL to use the camera
+    camera_fb_t upload_fb;
+} enroll_job_t;
+static esp_timer_handle_t led_reset_timer = NULL;
+
+// Capture profiles: QVGA is as good as VGA for finding a face, the detector
+// scales both down to its input, at a quarter of the decode cost. Faces are
+// recognized and enrolled from SVGA frames.
+#define CAMERA_WATCH_FRAME_SIZE FRAMESIZE_QVGA
+#define CAMERA_WATCH_QUALITY 15
+#define CAMERA_BURST_FRAME_SIZE FRAMESIZE_SVGA
+#define CAMERA_BURST_QUALITY 12
+#define CAMERA_BURST_WIDTH 800
+#define CAMERA_BURST_HEIGHT 600
+#define CAMERA_BURST_MS 3000           // High resolution kept this long after an unidentified face was seen
+#define CAMERA_BURST_INTERVAL_MS 250   // Recognition interval during a burst
 
 #define MAX_HTTP_RECV_BUFFER 512
 #define MAX_HTTP_OUTPUT_BUFFER 2048
 #define RECOGNITION_INTERVAL_MS 2000  // Check for faces every 2 seconds
+#define PRESENCE_INTERVAL_MS 100      // Tick in presence and landmarks mode
 #define RECOGNITION_COOLDOWN_MS 30000 // Wait 30 seconds before sending same name again
+#define BURST_ENROLL_INTERVAL_MS 150  // Delay between frames of a burst enrollment
+#define BURST_ENROLL_DEFAULT_TEMPLATES 3
+#define WWW_CACHE_CONTROL "no-cache"  // Pages are revalidated by ETag on every load, so an update shows at once
+#define CAPTURE_DEFAULT_MAX_AGE_MS (RECOGNITION_INTERVAL_MS + 500)  // /capture reuses frames up to this old
+#define CAPTURE_CACHE_WANT_MS 30000  // Captured frames are cached this long after a /capture request
+#define RECOGNIZE_QUEUE_LEN 2         // Uploaded images waiting for the models, more get 429
+#define RECOGNIZE_MAX_UPLOAD (512 * 1024)
+#define RECOGNIZE_MAX_WIDTH CAMERA_BURST_WIDTH    // Larger uploads would decode to megabytes of RGB in one step
+#define RECOGNIZE_MAX_HEIGHT CAMERA_BURST_HEIGHT
+#define RECOGNIZE_DEADLINE_MS 10000   // Uploads not started by then are answered with 503
+#define ENROLL_DEADLINE_MS 30000      // Enrollments not started by then expire
+#define ENROLL_CAMERA_WAIT_MS 2000    // Give up on an enrollment frame if the camera stays busy this long
+#define ENROLL_CAMERA_RETRY_MS 20
+#define CLIP_BUDGET_BYTES (512 * 1024)   // JPEG data per event clip, and again for its pre-roll
+#define CLIP_PRE_ROLL_MS 3000
+#define CLIP_POST_ROLL_MS 5000
+#define CLIP_UNKNOWN_COOLDOWN_MS 60000  // Unknown faces start a clip at most this often
+#define CLIP_MAX_FRAME_GAP_MS 1000      // Longer pauses between clip frames are shortened on replay
+#define CLIP_FRAME_INTERVAL_MS 250      // Frames are grabbed for clips this often between recognitions
+#define CLIP_REPLAY_STACK 4096
+
+// The host build runs as a normal process, so stay off privileged ports
+#if CONFIG_IDF_TARGET_LINUX
+#define HTTP_SERVER_PORT 8080
+#else
+#define HTTP_SERVER_PORT 80
+#endif
 
 // Forward declarations
-void discord_task(void *param);
 bool sendDiscordMessage(const char* message);
-void face_recognition_task(void *param);
-
-// HTML page for face enrollment
-static const char* index_html = "<!DOCTYPE html>"
-"<html>"
-"<head>"
-"<meta name='viewport' content='width=device-width, initial-scale=1'>"
-"<title>Face Recognition Camera</title>"
-"<style>"
-"body { font-family: Arial; margin: 20px; background: #f0f0f0; }"
-".container { max-width: 800px; margin: 0 auto; background: white; padding: 20px; border-radius: 10px; }"
-"h1 { color: #333; }"
-".video-container { position: relative; margin: 20px 0; background: #000; min-height: 400px; display: flex; align-items: center; justify-content: center; }"
-"#snapshot { max-width: 100%; border-radius: 5px; }"
-".placeholder { color: #666; font-size: 18px; }"
-".controls { margin: 20px 0; }"
-"input[type='text'] { padding: 10px; width: 200px; font-size: 16px; border: 2px solid #ddd; border-radius: 5px; margin-right: 10px; }"
-"button { padding: 10px 20px; margin: 5px; font-size: 16px; cursor: pointer; border: none; border-radius: 5px; }"
-".btn-capture { background: #2196F3; color: white; }"
-".btn-capture:hover { background: #0b7dda; }"
-".btn-enroll { background: #4CAF50; color: white; }"
-".btn-enroll:hover { background: #45a049; }"
-".btn-enroll:disabled { background: #ccc; cursor: not-allowed; }"
-".btn-delete { background: #f44336; color: white; }"
-".btn-delete:hover { background: #da190b; }"
-".btn-reset { background: #ff9800; color: white; }"
-".btn-reset:hover { background: #e68900; }"
-".status { padding: 10px; margin: 10px 0; border-radius: 5px; }"
-".success { background: #d4edda; color: #155724; border: 1px solid #c3e6cb; }"
-".error { background: #f8d7da; color: #721c24; border: 1px solid #f5c6cb; }"
-".face-list { margin: 20px 0; }"
-".face-item { padding: 10px; background: #f9f9f9; margin: 5px 0; border-radius: 5px; display: flex; justify-content: space-between; align-items: center; }"
-"</style>"
-"</head>"
-"<body>"
-"<div class='container'>"
-"<h1>Face Recognition Camera</h1>"
-"<p><a href='/recognition' target='_blank' style='color: #2196F3; text-decoration: none;'>Open Live Recognition Stream</a></p>"
-"<div class='video-container'>"
-"<img id='snapshot' style='display:none'>"
-"<div id='placeholder' class='placeholder'>Click 'Capture Photo' to take a snapshot</div>"
-"</div>"
-"<div class='controls'>"
-"<button class='btn-capture' onclick='capturePhoto()'>Capture Photo</button>"
-"<br><br>"
-"<h3>Enroll Face</h3>"
-"<input type='text' id='name-input' placeholder='Enter name...'>"
-"<button class='btn-enroll' id='enroll-btn' onclick='enrollFace()' disabled>Enroll Face</button>"
-"<br><br>"
-"<h3>Database Management</h3>"
-"<button class='btn-delete' onclick='deleteAllFaces()'>Delete All Faces</button>"
-"<button class='btn-reset' onclick='resetDatabase()'>Reset Database</button>"
-"</div>"
-"<div id='status'></div>"
-"<div class='face-list'>"
-"<h3>Enrolled Faces: <span id='face-count'>0</span></h3>"
-"<div id='face-items'></div>"
-"</div>"
-"</div>"
-"<script>"
-"console.log('JavaScript loaded successfully');"
-"let currentImageData = null;"
-"function showStatus(msg, success) {"
-"  const status = document.getElementById('status');"
-"  status.className = 'status ' + (success ? 'success' : 'error');"
-"  status.textContent = msg;"
-"  setTimeout(() => status.textContent = '', 3000);"
-"}"
-"function capturePhoto() {"
-"  console.log('Capturing photo...');"
-"  showStatus('Capturing...', true);"
-"  fetch('/capture')"
-"    .then(r => r.blob())"
-"    .then(blob => {"
-"      const url = URL.createObjectURL(blob);"
-"      const img = document.getElementById('snapshot');"
-"      const placeholder = document.getElementById('placeholder');"
-"      img.src = url;"
-"      img.style.display = 'block';"
-"      placeholder.style.display = 'none';"
-"      document.getElementById('enroll-btn').disabled = false;"
-"      currentImageData = blob;"
-"      showStatus('Photo captured! Enter name and click Enroll', true);"
-"    })"
-"    .catch(e => {"
-"      console.error('Capture error:', e);"
-"      showStatus('Capture failed: ' + e.message, false);"
-"    });"
-"}"
-"function enrollFace() {"
-"  const name = document.getElementById('name-input').value;"
-"  if (!name) { showStatus('Please enter a name', false); return; }"
-"  if (!currentImageData) { showStatus('Please capture a photo first', false); return; }"
-"  console.log('Enrolling:', name);"
-"  showStatus('Enrolling...', true);"
-"  const formData = new FormData();"
-"  formData.append('image', currentImageData, 'snapshot.jpg');"
-"  formData.append('name', name);"
-"  fetch('/enroll', {"
-"    method: 'POST',"
-"    body: formData"
-"  })"
-"    .then(r => {"
-"      console.log('Response status:', r.status);"
-"      return r.text();"
-"    })"
-"    .then(text => {"
-"      console.log('Response text:', text);"
-"      const d = JSON.parse(text);"
-"      if (d.success) {"
-"        showStatus('Face enrolled: ' + name, true);"
-"        document.getElementById('name-input').value = '';"
-"        loadFaces();"
-"      } else {"
-"        showStatus('Enrollment failed: ' + (d.message || 'Unknown error'), false);"
-"      }"
-"    })"
-"    .catch(e => {"
-"      console.error('Error:', e);"
-"      showStatus('Error: ' + e.message, false);"
-"    });"
-"}"
-"function deleteAllFaces() {"
-"  if (!confirm('Delete all enrolled faces?')) return;"
-"  fetch('/delete_all')"
-"    .then(r => r.json())"
-"    .then(d => {"
-"      showStatus('All faces deleted', true);"
-"      loadFaces();"
-"    })"
-"    .catch(e => showStatus('Error: ' + e, false));"
-"}"
-"function resetDatabase() {"
-"  if (!confirm('Reset database and metadata? This will remove all face data and fix corruption issues. This action cannot be undone.')) return;"
-"  showStatus('Resetting database...', true);"
-"  fetch('/reset_database')"
-"    .then(r => r.json())"
-"    .then(d => {"
-"      if (d.success) {"
-"        showStatus('Database reset successfully', true);"
-"        loadFaces();"
-"      } else {"
-"        showStatus('Reset failed: ' + (d.message || 'Unknown error'), false);"
-"      }"
-"    })"
-"    .catch(e => showStatus('Error: ' + e.message, false));"
-"}"
-"function loadFaces() {"
-"  fetch('/faces')"
-"    .then(r => r.json())"
-"    .then(d => {"
-"      document.getElementById('face-count').textContent = d.count;"
-"      const items = document.getElementById('face-items');"
-"      items.innerHTML = '';"
-"      d.faces.forEach(f => {"
-"        const div = document.createElement('div');"
-"        div.className = 'face-item';"
-"        div.innerHTML = '<span>' + f.name + ' (ID: ' + f.id + ')</span>';"
-"        items.appendChild(div);"
-"      });"
-"    });"
-"}"
-"loadFaces();"
-"</script>"
-"</body>"
-"</html>";
+void set_neopixel_color(int r, int g, int b);
 
+#if !CONFIG_IDF_TARGET_LINUX
 // WiFi event handler
 static void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                 int32_t event_id, void* event_data)
@@ -270,6 +186,7 @@ void wifi_init_sta(void)
     esp_wifi_set_config(WIFI_IF_STA, &wifi_config);
     esp_wifi_start();
 }
+#endif
 
 // Camera initialization
 esp_err_t init_camera(void)
@@ -298,22 +215,22 @@ esp_err_t init_camera(void)
         .ledc_channel = LEDC_CHANNEL_0,
 
         .pixel_format = PIXFORMAT_JPEG,
-        .frame_size = FRAMESIZE_VGA,    // 640x480
-        .jpeg_quality = 15,
+        .frame_size = CAMERA_BURST_FRAME_SIZE,  // Frame buffers are sized for the largest profile
+        .jpeg_quality = CAMERA_BURST_QUALITY,
         .fb_count = 1,
         .fb_location = CAMERA_FB_IN_PSRAM,
         .grab_mode = CAMERA_GRAB_WHEN_EMPTY,
     };
 
     // Initialize camera
-    esp_err_t err = esp_camera_init(&config);
+    esp_err_t err = camera_source_init(&config);
     if (err != ESP_OK) {
         ESP_LOGE(TAG, "Camera init failed with error 0x%x", err);
         return err;
     }
 
     // Get sensor to adjust settings
-    sensor_t *s = esp_camera_sensor_get();
+    sensor_t *s = camera_source_sensor_get();
     if (s != NULL) {
         // Flip image upside down
         s->set_vflip(s, 1);          // Vertical flip
@@ -323,11 +240,34 @@ esp_err_t init_camera(void)
         s->set_contrast(s, 0);       // -2 to 2
         s->set_saturation(s, 0);     // -2 to 2
     }
+    
+    // Idle at the watch profile until a face shows up
+    capture_profile_settings_t profiles[CAPTURE_PROFILE_COUNT] = {
+        {CAMERA_WATCH_FRAME_SIZE, CAMERA_WATCH_QUALITY},
+        {CAMERA_BURST_FRAME_SIZE, CAMERA_BURST_QUALITY},
+    };
+    if (capture_profile_init(profiles) != ESP_OK) {
+        ESP_LOGW(TAG, "Capture profiles unavailable, capturing at the burst profile only");
+    }
 
     ESP_LOGI(TAG, "Camera initialized successfully");
     return ESP_OK;
 }
 
+// Grab a frame from the sensor in the current capture profile and make it the
+// latest cached frame, if anyone reads those, so /capture
+// can be served without touching the sensor and event clips can reference it
+static camera_fb_t *capture_frame(void)
+{
+    camera_fb_t *fb = capture_profile_fb_get();
+    if (fb) {
+        frame_cache_entry_t *frame = frame_cache_put(fb);
+        clip_recorder_push(frame);
+        frame_cache_release(frame);
+    }
+    return fb;
+}
+
 // HTTP stream handler
 static esp_err_t stream_handler(httpd_req_t *req)
 {
@@ -347,7 +287,7 @@ static esp_err_t stream_handler(httpd_req_t *req)
     while (true) {
         // Try to acquire camera with short timeout to allow enrollment
         if (xSemaphoreTake(camera_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            fb = esp_camera_fb_get();
+            fb = capture_frame();
             xSemaphoreGive(camera_mutex);
         } else {
             // Camera busy, skip this frame
@@ -375,7 +315,7 @@ static esp_err_t stream_handler(httpd_req_t *req)
             res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
         }
 
-        esp_camera_fb_return(fb);
+        camera_source_fb_return(fb);
         fb = NULL;
         _jpg_buf = NULL;
 
@@ -388,11 +328,236 @@ static esp_err_t stream_handler(httpd_req_t *req)
     return res;
 }
 
+// Whether the request's If-None-Match names etag (a quoted entity tag): "*", or
+// a comma-separated list of tags, weak ones compared as if strong
+static bool etag_matches(httpd_req_t *req, const char *etag)
+{
+    size_t len = httpd_req_get_hdr_value_len(req, "If-None-Match");
+    if (len == 0) {
+        return false;
+    }
+    char *value = (char *)malloc(len + 1);
+    if (!value || httpd_req_get_hdr_value_str(req, "If-None-Match", value, len + 1) != ESP_OK) {
+        free(value);
+        return false;
+    }
+    
+    bool match = false;
+    size_t etag_len = strlen(etag);
+    const char *p = value;
+    while (*p && !match) {
+        while (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+        }
+        const char *end = p;
+        if (*p == '*') {
+            match = true;
+            break;
+        }
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        if (*p == '"') {
+            end = strchr(p + 1, '"');
+            end = end ? end + 1 : p + strlen(p);
+        }
+        while (*end && *end != ',') {
+            end++;
+        }
+        const char *tag_end = end;
+        while (tag_end > p && (tag_end[-1] == ' ' || tag_end[-1] == '\t')) {
+            tag_end--;
+        }
+        match = (size_t)(tag_end - p) == etag_len && strncmp(p, etag, etag_len) == 0;
+        p = end;
+    }
+    free(value);
+    return match;
+}
+
+// Whether the request's Accept-Encoding allows gzip, that is names it or "*"
+// without q=0
+static bool accepts_gzip(httpd_req_t *req)
+{
+    char value[128];
+    if (httpd_req_get_hdr_value_str(req, "Accept-Encoding", value, sizeof(value)) != ESP_OK) {
+        return false;
+    }
+    for (char *save = NULL, *coding = strtok_r(value, ",", &save); coding; coding = strtok_r(NULL, ",", &save)) {
+        while (*coding == ' ') {
+            coding++;
+        }
+        size_t name_len = strcspn(coding, " ;");
+        bool named = (name_len == 4 && strncmp(coding, "gzip", 4) == 0) || (name_len == 1 && *coding == '*');
+        const char *q = strstr(coding, "q=");
+        if (named) {
+            return !q || strtof(q + 2, NULL) > 0.0f;
+        }
+    }
+    return false;
+}
+
+// Serve a page packed by tools/pack_www.py, gzipped if the browser accepts it,
+// or 304 if the browser already has this version
+static esp_err_t send_www_asset(httpd_req_t *req, const www_asset_t *asset)
+{
+    bool gzip = accepts_gzip(req);
+    const char *etag = gzip ? asset->etag : asset->plain_etag;
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", WWW_CACHE_CONTROL);
+    httpd_resp_set_hdr(req, "Vary", "Accept-Encoding");
+    
+    if (etag_matches(req, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+    
+    httpd_resp_set_type(req, asset->content_type);
+    if (!gzip) {
+        return httpd_resp_send(req, (const char *)asset->plain, asset->plain_len);
+    }
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char *)asset->data, asset->len);
+}
+
 // Root handler - serve HTML page
 static esp_err_t index_handler(httpd_req_t *req)
 {
-    httpd_resp_set_type(req, "text/html");
-    return httpd_resp_send(req, index_html, strlen(index_html));
+    return send_www_asset(req, &www_index_html);
+}
+
+// One enrollment step: offer the next frame, from the upload or the camera, and
+// once all are in commit the best of them. Camera frames are spaced out so the
+// pose and expression can vary, and other jobs run in between.
+static int enroll_step(inference_job_t *job)
+{
+    enroll_job_t *e = (enroll_job_t *)job->arg;
+    if (!e->burst) {
+        e->burst = face_recognition_burst_begin(e->frames);
+        if (!e->burst) {
+            job->result = -1;
+            snprintf(job->message, sizeof(job->message), "Memory allocation failed");
+            return INFERENCE_STEP_DONE;
+        }
+    }
+    
+    if (e->taken < e->frames) {
+        camera_fb_t *fb = &e->upload_fb;
+        if (!e->upload) {
+            // Enrollment templates come from high-resolution frames
+            capture_profile_burst(CAMERA_BURST_MS);
+            // Never block the executor on the camera, retry between other jobs
+            if (xSemaphoreTake(camera_mutex, 0) != pdTRUE) {
+                int64_t now = esp_timer_get_time();
+                if (e->camera_wait_us == 0) {
+                    e->camera_wait_us = now;
+                }
+                if (now - e->camera_wait_us < ENROLL_CAMERA_WAIT_MS * 1000LL) {
+                    return ENROLL_CAMERA_RETRY_MS;
+                }
+                ESP_LOGW(TAG, "Camera busy, skipping enrollment frame %d", e->taken);
+                fb = NULL;
+            } else {
+                fb = capture_frame();
+                xSemaphoreGive(camera_mutex);
+                if (!fb) {
+                    ESP_LOGW(TAG, "Camera capture failed, skipping enrollment frame %d", e->taken);
+                }
+            }
+            e->camera_wait_us = 0;
+        }
+        if (fb && face_recognition_burst_add(e->burst, fb) > 0) {
+            e->usable++;
+        }
+        if (fb && !e->upload) {
+            camera_source_fb_return(fb);
+        }
+        if (++e->taken < e->frames) {
+            return BURST_ENROLL_INTERVAL_MS;
+        }
+    }
+    
+    if (e->frames > 1) {
+        ESP_LOGI(TAG, "Burst captured: %d of %d frames usable", e->usable, e->frames);
+    }
+    job->result = face_recognition_burst_commit(e->burst, e->name, e->templates, e->centroid);
+    job->detail = face_recognition_get_duplicate_id();
+    snprintf(job->message, sizeof(job->message), "%s", face_recognition_get_last_error());
+    if (job->result >= 0) {
+        ESP_LOGI(TAG, "Enrollment successful, ID: %d", job->result);
+    } else {
+        ESP_LOGE(TAG, "Enrollment failed: %s", job->message);
+    }
+    return INFERENCE_STEP_DONE;
+}
+
+static void enroll_done(inference_job_t *job, bool expired)
+{
+    enroll_job_t *e = (enroll_job_t *)job->arg;
+    face_recognition_burst_end(e->burst);
+    heap_caps_free(e->upload);
+    free(e);
+}
+
+// Queue an enrollment and answer with its job ID right away. Takes ownership of
+// upload, which holds the frame (jpeg, jpeg_len) or is NULL to use the camera.
+static esp_err_t submit_enroll(httpd_req_t *req, const char *name, int frames, int templates, bool centroid,
+                               uint8_t *upload, uint8_t *jpeg, size_t jpeg_len)
+{
+    enroll_job_t *e = (enroll_job_t *)calloc(1, sizeof(enroll_job_t));
+    uint32_t id = 0;
+    if (e) {
+        snprintf(e->name, sizeof(e->name), "%s", name);
+        e->frames = upload ? 1 : frames;
+        e->templates = templates;
+        e->centroid = centroid;
+        e->upload = upload;
+        e->upload_fb.buf = jpeg;
+        e->upload_fb.len = jpeg_len;
+        e->upload_fb.format = PIXFORMAT_JPEG;
+        id = inference_submit("enroll", INFERENCE_PRIORITY_BACKGROUND,
+                              esp_timer_get_time() + ENROLL_DEADLINE_MS * 1000LL, enroll_step, enroll_done, e);
+    }
+    if (id == 0) {
+        free(e);
+        heap_caps_free(upload);
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, "{\"success\":false,\"message\":\"Too many jobs queued\"}");
+    }
+    
+    ESP_LOGI(TAG, "Enrollment of '%s' queued as job %lu", name, (unsigned long)id);
+    httpd_resp_set_status(req, "202 Accepted");
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_uint(&w, "job", id);
+    json_str(&w, "state", inference_state_name(INFERENCE_JOB_QUEUED));
+    json_obj_end(&w);
+    return json_writer_end(&w);
+}
+
+// Outcome of a finished enrollment job: the new face, or why it was rejected
+static void write_enroll_result(json_writer_t *w, const inference_job_t *job)
+{
+    int id = job->result;
+    json_bool(w, "success", id >= 0);
+    face_id_t info;
+    if (id >= 0 && face_recognition_get_info(id, &info) == ESP_OK) {
+        // An attached duplicate keeps the name it was enrolled with
+        json_int(w, "id", id);
+        json_str(w, "name", info.name);
+        json_int(w, "templates", info.template_count);
+    } else if (id >= 0) {
+        json_int(w, "id", id);  // Deleted since
+    } else {
+        json_str(w, "message", job->message);
+    }
+    // Existing face the enrollment was attached to or rejected for
+    if (job->detail >= 0) {
+        json_int(w, "duplicate_of", job->detail);
+    }
 }
 
 // Enroll face handler
@@ -541,31 +706,8 @@ static esp_err_t enroll_handler(httpd_req_t *req)
         }
         ESP_LOGI(TAG, "Found JPEG: %d bytes, enrolling as: %s", image_len, name);
         
-        // Create a fake camera frame buffer from the uploaded image
-        camera_fb_t fb;
-        fb.buf = jpeg_start;
-        fb.len = image_len;
-        fb.width = 640;  // Assuming VGA
-        fb.height = 480;
-        fb.format = PIXFORMAT_JPEG;
-        
-        // Enroll the face (keep image_buf alive during enrollment)
-        int id = face_recognition_enroll(&fb, name);
-        
-        // Now we can free the buffer
-        free(image_buf);
-        
-        char json[128];
-        if (id >= 0) {
-            snprintf(json, sizeof(json), "{\"success\":true,\"id\":%d,\"name\":\"%s\"}", id, name);
-            ESP_LOGI(TAG, "Enrollment successful, ID: %d", id);
-        } else {
-            snprintf(json, sizeof(json), "{\"success\":false,\"message\":\"Face detection failed\"}");
-            ESP_LOGE(TAG, "Enrollment failed");
-        }
-        
-        httpd_resp_set_type(req, "application/json");
-        return httpd_resp_sendstr(req, json);
+        // The job keeps image_buf until it has enrolled from it
+        return submit_enroll(req, name, 1, 1, false, image_buf, jpeg_start, image_len);
     }
     
     // Fallback: GET request (old behavior for compatibility)
@@ -575,42 +717,25 @@ static esp_err_t enroll_handler(httpd_req_t *req)
         if (httpd_query_key_value(query, "name", name, sizeof(name)) == ESP_OK) {
             ESP_LOGI(TAG, "Enrolling face with name: %s", name);
             
-            // Acquire camera with timeout
-            if (xSemaphoreTake(camera_mutex, pdMS_TO_TICKS(2000)) != pdTRUE) {
-                ESP_LOGE(TAG, "Camera busy, timeout");
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_sendstr(req, "{\"success\":false,\"message\":\"Camera busy\"}");
-                return ESP_OK;
-            }
-            
-            // Capture a frame
-            camera_fb_t *fb = esp_camera_fb_get();
-            xSemaphoreGive(camera_mutex);
-            
-            if (!fb) {
-                ESP_LOGE(TAG, "Camera capture failed");
-                httpd_resp_set_type(req, "application/json");
-                httpd_resp_sendstr(req, "{\"success\":false,\"message\":\"Camera capture failed\"}");
-                return ESP_OK;
+            // Burst mode: /enroll?name=<name>&burst=<frames>&templates=<k>&mode=templates|centroid
+            char value[16];
+            int burst_frames = 1;
+            if (httpd_query_key_value(query, "burst", value, sizeof(value)) == ESP_OK) {
+                burst_frames = MAX(1, MIN(atoi(value), FACE_BURST_MAX_FRAMES));
             }
-            
-            ESP_LOGI(TAG, "Frame captured, size: %d bytes", fb->len);
-            
-            // Enroll the face
-            int id = face_recognition_enroll(fb, name);
-            esp_camera_fb_return(fb);
-            
-            char json[128];
-            if (id >= 0) {
-                ESP_LOGI(TAG, "Enrollment successful, ID: %d", id);
-                snprintf(json, sizeof(json), "{\"success\":true,\"id\":%d,\"name\":\"%s\"}", id, name);
-            } else {
-                ESP_LOGE(TAG, "Enrollment failed");
-                snprintf(json, sizeof(json), "{\"success\":false,\"message\":\"No face detected or enrollment failed\"}");
+            int templates = 1;
+            bool centroid = false;
+            if (burst_frames > 1) {
+                templates = BURST_ENROLL_DEFAULT_TEMPLATES;
+                if (httpd_query_key_value(query, "templates", value, sizeof(value)) == ESP_OK) {
+                    templates = atoi(value);
+                }
+                centroid = httpd_query_key_value(query, "mode", value, sizeof(value)) == ESP_OK &&
+                           strcmp(value, "centroid") == 0;
             }
             
-            httpd_resp_set_type(req, "application/json");
-            return httpd_resp_sendstr(req, json);
+            // A single frame is a burst of one
+            return submit_enroll(req, name, burst_frames, templates, centroid, NULL, NULL, 0);
         } else {
             ESP_LOGE(TAG, "Failed to parse name parameter");
         }
@@ -622,37 +747,352 @@ static esp_err_t enroll_handler(httpd_req_t *req)
     return httpd_resp_sendstr(req, "{\"success\":false,\"message\":\"Missing name parameter\"}");
 }
 
-// List enrolled faces handler
-static esp_err_t faces_handler(httpd_req_t *req)
+// Frame size from the SOF segment of a JPEG. Walks the marker segments after
+// SOI, so SOF-like bytes inside EXIF data or a thumbnail are not mistaken for it.
+static bool jpeg_dimensions(const uint8_t *jpeg, size_t len, int *width, int *height)
 {
-    ESP_LOGI(TAG, "Faces handler called");
+    size_t i = 2;
+    while (i + 4 <= len) {
+        if (jpeg[i] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = jpeg[i + 1];
+        if (marker == 0xFF) {
+            i++;  // Fill byte
+            continue;
+        }
+        if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            i += 2;  // No length
+            continue;
+        }
+        if (marker == 0xDA || marker == 0xD9) {
+            return false;  // Image data before any frame header
+        }
+        size_t seg_len = (jpeg[i + 2] << 8) | jpeg[i + 3];
+        if (marker >= 0xC0 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            if (seg_len < 7 || i + 9 > len) {
+                return false;
+            }
+            *height = (jpeg[i + 5] << 8) | jpeg[i + 6];
+            *width = (jpeg[i + 7] << 8) | jpeg[i + 8];
+            return true;
+        }
+        i += 2 + seg_len;
+    }
+    return false;
+}
+
+// Find the JPEG in an upload, either the whole body or one part of a multipart form,
+// and the frame size from its header
+static bool find_jpeg(uint8_t *buf, size_t len, uint8_t **jpeg, size_t *jpeg_len, int *width, int *height)
+{
+    uint8_t *start = NULL;
+    for (size_t i = 0; i + 2 < len && !start; i++) {
+        if (buf[i] == 0xFF && buf[i + 1] == 0xD8 && buf[i + 2] == 0xFF) {
+            start = buf + i;
+        }
+    }
+    if (!start) {
+        return false;
+    }
+    // Last end marker, an embedded thumbnail has its own
+    for (size_t i = len - 1; i > (size_t)(start - buf) + 2; i--) {
+        if (buf[i - 1] == 0xFF && buf[i] == 0xD9) {
+            *jpeg = start;
+            *jpeg_len = buf + i + 1 - start;
+            return jpeg_dimensions(*jpeg, *jpeg_len, width, height);
+        }
+    }
+    return false;
+}
+
+static int remote_recognize_step(inference_job_t *ijob);
+static void remote_recognize_done(inference_job_t *ijob, bool expired);
+
+// Recognize handler - POST a JPEG (raw body or multipart form) to /recognize and get
+// every face in it back with box, landmarks, ID and similarity. The upload is queued
+// for the inference executor; with RECOGNIZE_QUEUE_LEN uploads already waiting the
+// request is refused with 429 right away instead of holding up the server. Images
+// larger than the burst profile (RECOGNIZE_MAX_WIDTH x RECOGNIZE_MAX_HEIGHT) get 413:
+// their decode would take megabytes of PSRAM and stall live recognition.
+static esp_err_t recognize_handler(httpd_req_t *req)
+{
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     
-    char json[1024];
-    int count = face_recognition_get_enrolled_count();
+    if (inference_count(INFERENCE_PRIORITY_REMOTE) >= RECOGNIZE_QUEUE_LEN) {
+        // The unread body is discarded by the server
+        httpd_resp_set_status(req, "429 Too Many Requests");
+        httpd_resp_set_hdr(req, "Retry-After", "1");
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, "{\"success\":false,\"message\":\"Recognition queue full\"}");
+    }
+    if (req->content_len == 0 || req->content_len > RECOGNIZE_MAX_UPLOAD) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected a JPEG of at most 512 KB");
+        return ESP_FAIL;
+    }
     
-    ESP_LOGI(TAG, "Enrolled count: %d", count);
+    uint8_t *body = (uint8_t *)heap_caps_malloc(req->content_len, MALLOC_CAP_SPIRAM);
+    if (!body) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    size_t received = 0;
+    while (received < req->content_len) {
+        int ret = httpd_req_recv(req, (char *)body + received, req->content_len - received);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) {
+            continue;
+        }
+        if (ret <= 0) {
+            heap_caps_free(body);
+            return ESP_FAIL;
+        }
+        received += ret;
+    }
     
-    snprintf(json, sizeof(json), "{\"count\":%d,\"faces\":[", count);
+    recognize_job_t *job = (recognize_job_t *)calloc(1, sizeof(recognize_job_t));
+    int width = 0;
+    int height = 0;
+    if (!job || !find_jpeg(body, received, &job->jpeg, &job->jpeg_len, &width, &height)) {
+        free(job);
+        heap_caps_free(body);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "No JPEG data found");
+        return ESP_FAIL;
+    }
+    if (width > RECOGNIZE_MAX_WIDTH || height > RECOGNIZE_MAX_HEIGHT) {
+        free(job);
+        heap_caps_free(body);
+        char message[96];
+        snprintf(message, sizeof(message),
+                 "{\"success\":false,\"message\":\"Image is %dx%d, at most %dx%d is accepted\"}", width, height,
+                 RECOGNIZE_MAX_WIDTH, RECOGNIZE_MAX_HEIGHT);
+        httpd_resp_set_status(req, "413 Payload Too Large");
+        httpd_resp_set_type(req, "application/json");
+        return httpd_resp_sendstr(req, message);
+    }
+    job->body = body;
+    if (httpd_req_async_handler_begin(req, &job->req) != ESP_OK) {
+        free(job);
+        heap_caps_free(body);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    if (inference_submit("remote", INFERENCE_PRIORITY_REMOTE, esp_timer_get_time() + RECOGNIZE_DEADLINE_MS * 1000LL,
+                         remote_recognize_step, remote_recognize_done, job) == 0) {
+        // Job table full of enrollments
+        httpd_resp_set_status(job->req, "429 Too Many Requests");
+        httpd_resp_set_hdr(job->req, "Retry-After", "1");
+        httpd_resp_set_type(job->req, "application/json");
+        httpd_resp_sendstr(job->req, "{\"success\":false,\"message\":\"Recognition queue full\"}");
+        httpd_req_async_handler_complete(job->req);
+        heap_caps_free(body);
+        free(job);
+    }
+    return ESP_OK;
+}
+
+// Answer one queued /recognize upload, in the inference executor
+static int remote_recognize_step(inference_job_t *ijob)
+{
+    recognize_job_t *job = (recognize_job_t *)ijob->arg;
+    camera_fb_t fb = {};
+    fb.buf = job->jpeg;
+    fb.len = job->jpeg_len;
+    fb.format = PIXFORMAT_JPEG;
     
-    for (int i = 0; i < MAX_FACE_ID_COUNT; i++) {
-        face_id_t info;
-        if (face_recognition_get_info(i, &info) == ESP_OK && info.enrolled) {
-            char item[64];
-            snprintf(item, sizeof(item), "{\"id\":%d,\"name\":\"%s\"},", info.id, info.name);
-            strcat(json, item);
+    int64_t start = esp_timer_get_time();
+    face_result_t faces[FACE_RESULT_MAX_FACES];
+    int n = face_recognition_identify_all(&fb, faces, FACE_RESULT_MAX_FACES);
+    int64_t done = esp_timer_get_time();
+    ijob->result = n;
+    
+    httpd_req_t *req = job->req;
+    if (n < 0) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Could not decode the JPEG");
+        return INFERENCE_STEP_DONE;
+    }
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_bool(&w, "success", true);
+    json_uint(&w, "job", ijob->id);
+    json_int(&w, "queue_ms", (start - ijob->submitted_us) / 1000);
+    json_int(&w, "inference_ms", (done - start) / 1000);
+    json_arr_begin(&w, "faces");
+    for (int i = 0; i < n; i++) {
+        const face_result_t *face = &faces[i];
+        json_obj_begin(&w, NULL);
+        json_arr_begin(&w, "box");
+        for (int k = 0; k < 4; k++) {
+            json_int(&w, NULL, face->box[k]);
+        }
+        json_arr_end(&w);
+        json_num(&w, "score", face->score, 3);
+        json_arr_begin(&w, "landmarks");
+        for (int k = 0; k < 10; k += 2) {
+            json_arr_begin(&w, NULL);
+            json_int(&w, NULL, face->keypoints[k]);
+            json_int(&w, NULL, face->keypoints[k + 1]);
+            json_arr_end(&w);
+        }
+        json_arr_end(&w);
+        if (face->id >= 0) {
+            json_int(&w, "id", face->id);
+            json_str(&w, "name", face->name);
+        } else {
+            json_null(&w, "id");
+            json_null(&w, "name");
         }
+        json_num(&w, "similarity", face->similarity, 4);
+        json_obj_end(&w);
+    }
+    json_arr_end(&w);
+    json_obj_end(&w);
+    json_writer_end(&w);
+    return INFERENCE_STEP_DONE;
+}
+
+static void remote_recognize_done(inference_job_t *ijob, bool expired)
+{
+    recognize_job_t *job = (recognize_job_t *)ijob->arg;
+    if (expired) {
+        httpd_resp_set_status(job->req, "503 Service Unavailable");
+        httpd_resp_set_hdr(job->req, "Retry-After", "1");
+        httpd_resp_set_type(job->req, "application/json");
+        httpd_resp_sendstr(job->req, "{\"success\":false,\"message\":\"Timed out waiting for the models\"}");
     }
+    httpd_req_async_handler_complete(job->req);
+    heap_caps_free(job->body);
+    free(job);
+}
+
+// Jobs handler - /jobs?id=<id> reports one inference job, /jobs all that are
+// still remembered. Enrollment jobs carry the enrollment result once done.
+static void write_job(json_writer_t *w, const inference_job_t *job)
+{
+    static const char *priority_names[] = {"live", "remote", "background"};
+    int64_t now = esp_timer_get_time();
+    json_obj_begin(w, NULL);
+    json_uint(w, "job", job->id);
+    json_str(w, "kind", job->kind);
+    json_str(w, "priority", priority_names[job->priority]);
+    json_str(w, "state", inference_state_name(job->state));
+    int64_t started = job->started_us ? job->started_us : now;
+    json_int(w, "queued_ms", (started - job->submitted_us) / 1000);
+    if (job->started_us) {
+        int64_t end = job->state == INFERENCE_JOB_DONE ? job->finished_us : now;
+        json_int(w, "run_ms", (end - job->started_us) / 1000);
+    }
+    bool finished = job->state == INFERENCE_JOB_DONE || job->state == INFERENCE_JOB_EXPIRED;
+    if (finished && strcmp(job->kind, "enroll") == 0) {
+        write_enroll_result(w, job);
+    } else if (job->state == INFERENCE_JOB_EXPIRED) {
+        json_str(w, "message", job->message);
+    }
+    json_obj_end(w);
+}
+
+static esp_err_t jobs_handler(httpd_req_t *req)
+{
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
     
-    // Remove trailing comma if exists
-    int len = strlen(json);
-    if (json[len-1] == ',') {
-        json[len-1] = '\0';
+    char query[32];
+    char value[12];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "id", value, sizeof(value)) == ESP_OK) {
+        inference_job_t job;
+        if (!inference_get_job(strtoul(value, NULL, 10), &job)) {
+            httpd_resp_send_404(req);
+            return ESP_FAIL;
+        }
+        json_writer_t w;
+        json_writer_begin(&w, req);
+        write_job(&w, &job);
+        return json_writer_end(&w);
     }
     
-    strcat(json, "]}");
+    inference_job_t jobs[INFERENCE_MAX_JOBS];
+    int n = inference_list_jobs(jobs, INFERENCE_MAX_JOBS);
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_arr_begin(&w, "jobs");
+    for (int i = 0; i < n; i++) {
+        write_job(&w, &jobs[i]);
+    }
+    json_arr_end(&w);
+    json_obj_end(&w);
+    return json_writer_end(&w);
+}
+
+// Faces handler - /faces?limit=<n>&cursor=<id> lists enrolled faces by ascending ID,
+// at most limit of them from ID cursor on. next_cursor starts the following page,
+// null after the last one. IDs are stable, so a page stays valid across deletes.
+static esp_err_t faces_handler(httpd_req_t *req)
+{
+    ESP_LOGI(TAG, "Faces handler called");
+    
+    int limit = MAX_FACE_ID_COUNT;
+    int cursor = 0;
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK) {
+            limit = MAX(1, atoi(value));
+        }
+        if (httpd_query_key_value(query, "cursor", value, sizeof(value)) == ESP_OK) {
+            cursor = MAX(0, atoi(value));
+        }
+    }
+    
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_int(&w, "count", face_recognition_get_enrolled_count());
+    json_arr_begin(&w, "faces");
+    // One more than a page tells whether another page follows
+    face_id_t faces[MAX_FACE_ID_COUNT];
+    int n = face_recognition_list(cursor, faces, MAX_FACE_ID_COUNT);
+    int next_cursor = n > limit ? faces[limit].id : -1;
+    for (int i = 0; i < n && i < limit; i++) {
+        json_obj_begin(&w, NULL);
+        json_int(&w, "id", faces[i].id);
+        json_str(&w, "name", faces[i].name);
+        json_int(&w, "templates", faces[i].template_count);
+        json_obj_end(&w);
+    }
+    json_arr_end(&w);
+    if (next_cursor >= 0) {
+        json_int(&w, "next_cursor", next_cursor);
+    } else {
+        json_null(&w, "next_cursor");
+    }
+    json_obj_end(&w);
+    return json_writer_end(&w);
+}
+
+// Delete handler - /delete?id=<id> removes one enrolled face
+static esp_err_t delete_handler(httpd_req_t *req)
+{
+    char query[32];
+    char value[12];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "id", value, sizeof(value)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing id parameter");
+        return ESP_FAIL;
+    }
+    int id = atoi(value);
+    ESP_LOGI(TAG, "Delete handler called for ID %d", id);
+    
+    esp_err_t err = face_recognition_delete(id);
     
     httpd_resp_set_type(req, "application/json");
-    return httpd_resp_sendstr(req, json);
+    if (err == ESP_OK) {
+        return httpd_resp_sendstr(req, "{\"success\":true}");
+    } else if (err == ESP_ERR_NOT_FOUND) {
+        return httpd_resp_sendstr(req, "{\"success\":false,\"message\":\"No such face\"}");
+    } else {
+        return httpd_resp_sendstr(req, "{\"success\":false}");
+    }
 }
 
 // Delete all faces handler
@@ -693,154 +1133,183 @@ static esp_err_t ping_handler(httpd_req_t *req)
     return httpd_resp_sendstr(req, "{\"status\":\"ok\",\"message\":\"pong\"}");
 }
 
-// Capture single image handler
+// Capture handler - /capture?max_age=ms serves the latest frame any task captured if it is
+// at most max_age old, and only grabs a new one from the sensor otherwise.
+// Responses carry an ETag; a matching If-None-Match gets 304 without the image.
 static esp_err_t capture_handler(httpd_req_t *req)
 {
-    ESP_LOGI(TAG, "Capture handler called");
+    int max_age_ms = CAPTURE_DEFAULT_MAX_AGE_MS;
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "max_age", value, sizeof(value)) == ESP_OK) {
+        max_age_ms = atoi(value);
+    }
     
-    camera_fb_t *fb = NULL;
-    esp_err_t res = ESP_OK;
+    // Someone polls: cache what the other tasks capture for a while
+    frame_cache_want(CAPTURE_CACHE_WANT_MS);
+    frame_cache_entry_t *frame = frame_cache_get();
+    if (!frame || esp_timer_get_time() - frame->capture_us > max_age_ms * 1000LL) {
+        frame_cache_release(frame);
+        frame = NULL;
+        
+        // Too old: capture a fresh one, which also refreshes the cache
+        if (xSemaphoreTake(camera_mutex, pdMS_TO_TICKS(2000)) != pdTRUE) {
+            ESP_LOGE(TAG, "Camera busy");
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        camera_fb_t *fb = capture_profile_fb_get();
+        if (fb) {
+            frame = frame_cache_put(fb);
+            clip_recorder_push(frame);
+            camera_source_fb_return(fb);
+        }
+        xSemaphoreGive(camera_mutex);
+    }
     
-    // Acquire camera
-    if (xSemaphoreTake(camera_mutex, pdMS_TO_TICKS(2000)) != pdTRUE) {
-        ESP_LOGE(TAG, "Camera busy");
+    if (!frame) {
+        ESP_LOGE(TAG, "Camera capture failed");
         httpd_resp_send_500(req);
         return ESP_FAIL;
     }
     
-    fb = esp_camera_fb_get();
-    xSemaphoreGive(camera_mutex);
+    char etag[16];
+    char last_modified[32];
+    char age[16];
+    struct tm tm;
+    snprintf(etag, sizeof(etag), "\"%lu\"", (unsigned long)frame->seq);
+    strftime(last_modified, sizeof(last_modified), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&frame->wall_time, &tm));
+    snprintf(age, sizeof(age), "%lld", (long long)((esp_timer_get_time() - frame->capture_us) / 1000));
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Last-Modified", last_modified);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "X-Frame-Age-Ms", age);
     
-    if (!fb) {
-        ESP_LOGE(TAG, "Camera capture failed");
-        httpd_resp_send_500(req);
-        return ESP_FAIL;
+    esp_err_t res;
+    if (etag_matches(req, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        res = httpd_resp_send(req, NULL, 0);
+    } else {
+        httpd_resp_set_type(req, "image/jpeg");
+        httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+        res = httpd_resp_send(req, (const char *)frame->buf, frame->len);
     }
+    frame_cache_release(frame);
     
-    ESP_LOGI(TAG, "Captured image, size: %d bytes", fb->len);
+    return res;
+}
+
+typedef struct {
+    httpd_req_t *req;
+    clip_t *clip;
+} clip_replay_t;
+
+static std::atomic<bool> clip_replaying{false};  // One replay at a time, each holds a task
+
+// Percent-encode everything but printable ASCII, so a face name can never end
+// the header line; clients decode it like a URL component
+static void clip_label_header(const char *label, char *out, size_t out_len)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t n = 0;
+    for (const unsigned char *c = (const unsigned char *)label; *c && n + 4 <= out_len; c++) {
+        if (*c > 0x20 && *c < 0x7f && *c != '%') {
+            out[n++] = *c;
+        } else {
+            out[n++] = '%';
+            out[n++] = hex[*c >> 4];
+            out[n++] = hex[*c & 0xf];
+        }
+    }
+    out[n] = '\0';
+}
+
+// Sends one clip at the pace it was captured, off the server task
+static void clip_replay_task(void *arg)
+{
+    clip_replay_t *replay = (clip_replay_t *)arg;
+    httpd_req_t *req = replay->req;
+    clip_t *clip = replay->clip;
     
-    httpd_resp_set_type(req, "image/jpeg");
-    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+    char id[16];
+    char label[CLIP_LABEL_LEN * 3 + 1];
+    snprintf(id, sizeof(id), "%lu", (unsigned long)clip->id);
+    clip_label_header(clip->label, label, sizeof(label));
+    httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "X-Clip-Id", id);
+    httpd_resp_set_hdr(req, "X-Clip-Label", label);
     
-    res = httpd_resp_send(req, (const char *)fb->buf, fb->len);
-    esp_camera_fb_return(fb);
+    esp_err_t res = ESP_OK;
+    char part_buf[64];
+    for (int i = 0; i < clip->count && res == ESP_OK; i++) {
+        frame_cache_entry_t *frame = clip->frames[i];
+        if (i > 0) {
+            int64_t gap_ms = (frame->capture_us - clip->frames[i - 1]->capture_us) / 1000;
+            vTaskDelay(pdMS_TO_TICKS(std::min<int64_t>(std::max<int64_t>(gap_ms, 0), CLIP_MAX_FRAME_GAP_MS)));
+        }
+        size_t hlen = snprintf(part_buf, sizeof(part_buf), _STREAM_PART, (unsigned)frame->len);
+        res = httpd_resp_send_chunk(req, part_buf, hlen);
+        if (res == ESP_OK) {
+            res = httpd_resp_send_chunk(req, (const char *)frame->buf, frame->len);
+        }
+        if (res == ESP_OK) {
+            res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
+        }
+    }
+    clip_recorder_release(clip);
     
-    return res;
+    if (res == ESP_OK) {
+        httpd_resp_send_chunk(req, NULL, 0);
+    }
+    httpd_req_async_handler_complete(req);
+    free(replay);
+    clip_replaying.store(false);
+    vTaskDelete(NULL);
 }
 
-// HTML page for recognition view with overlay
-static const char* recognition_html = "<!DOCTYPE html>"
-"<html>"
-"<head>"
-"<meta name='viewport' content='width=device-width, initial-scale=1'>"
-"<title>Live Face Recognition</title>"
-"<style>"
-"body { margin: 0; padding: 0; background: #000; font-family: Arial; }"
-".container { position: relative; width: 100vw; height: 100vh; display: flex; align-items: center; justify-content: center; overflow: hidden; }"
-"#canvas { max-width: 100%; max-height: 100%; }"
-".overlay { position: absolute; bottom: 20px; left: 20px; background: rgba(0,0,0,0.8); color: white; padding: 15px 25px; border-radius: 10px; font-size: 28px; font-weight: bold; min-width: 200px; box-shadow: 0 4px 6px rgba(0,0,0,0.3); }"
-".name { color: #4CAF50; }"
-".unknown { color: #ff9800; }"
-"</style>"
-"</head>"
-"<body>"
-"<div class='container'>"
-"<canvas id='canvas'></canvas>"
-"<div class='overlay' id='overlay'>"
-"<span id='name' class='unknown'>Scanning...</span>"
-"</div>"
-"</div>"
-"<script>"
-"const canvas = document.getElementById('canvas');"
-"const ctx = canvas.getContext('2d');"
-"const nameEl = document.getElementById('name');"
-"const streamUrl = '/recognition_stream';"
-"let img = new Image();"
-"let currentName = 'Scanning...';"
-"async function fetchStream() {"
-"  try {"
-"    const response = await fetch(streamUrl);"
-"    const reader = response.body.getReader();"
-"    let buffer = new Uint8Array(0);"
-"    const boundary = new TextEncoder().encode('--123456789000000000000987654321');"
-"    while (true) {"
-"      const {done, value} = await reader.read();"
-"      if (done) break;"
-"      const temp = new Uint8Array(buffer.length + value.length);"
-"      temp.set(buffer);"
-"      temp.set(value, buffer.length);"
-"      buffer = temp;"
-"      let searchStart = 0;"
-"      while (true) {"
-"        const boundaryPos = findBoundary(buffer, boundary, searchStart);"
-"        if (boundaryPos === -1) break;"
-"        const nextBoundaryPos = findBoundary(buffer, boundary, boundaryPos + boundary.length);"
-"        if (nextBoundaryPos === -1) break;"
-"        const chunk = buffer.slice(boundaryPos, nextBoundaryPos);"
-"        processChunk(chunk);"
-"        buffer = buffer.slice(nextBoundaryPos);"
-"        searchStart = 0;"
-"      }"
-"    }"
-"  } catch (e) {"
-"    console.error('Stream error:', e);"
-"    setTimeout(fetchStream, 1000);"
-"  }"
-"}"
-"function findBoundary(buffer, boundary, start) {"
-"  for (let i = start; i <= buffer.length - boundary.length; i++) {"
-"    let match = true;"
-"    for (let j = 0; j < boundary.length; j++) {"
-"      if (buffer[i + j] !== boundary[j]) {"
-"        match = false;"
-"        break;"
-"      }"
-"    }"
-"    if (match) return i;"
-"  }"
-"  return -1;"
-"}"
-"function processChunk(chunk) {"
-"  const text = new TextDecoder().decode(chunk);"
-"  const headerEnd = text.indexOf('\\r\\n\\r\\n');"
-"  if (headerEnd === -1) return;"
-"  const headers = text.substring(0, headerEnd);"
-"  const nameMatch = headers.match(/X-Face-Name: ([^\\r\\n]+)/);"
-"  if (nameMatch) {"
-"    const name = nameMatch[1].trim();"
-"    if (name !== currentName) {"
-"      currentName = name;"
-"      if (name !== 'Unknown' && name !== '') {"
-"        nameEl.textContent = name;"
-"        nameEl.className = 'name';"
-"      } else {"
-"        nameEl.textContent = 'No face detected';"
-"        nameEl.className = 'unknown';"
-"      }"
-"    }"
-"  }"
-"  const jpegStart = headerEnd + 4;"
-"  const jpegData = chunk.slice(jpegStart);"
-"  const blob = new Blob([jpegData], {type: 'image/jpeg'});"
-"  const url = URL.createObjectURL(blob);"
-"  img.onload = () => {"
-"    canvas.width = img.width;"
-"    canvas.height = img.height;"
-"    ctx.drawImage(img, 0, 0);"
-"    URL.revokeObjectURL(url);"
-"  };"
-"  img.src = url;"
-"}"
-"fetchStream();"
-"</script>"
-"</body>"
-"</html>";
+// Clip handler - /clip replays the latest event clip as an MJPEG stream at the
+// pace it was captured, or answers 404 if nothing was recorded yet. The replay
+// runs in its own task, so the server keeps answering meanwhile. The label in
+// X-Clip-Label is percent-encoded.
+static esp_err_t clip_handler(httpd_req_t *req)
+{
+    if (clip_replaying.exchange(true)) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_set_hdr(req, "Retry-After", "5");
+        return httpd_resp_sendstr(req, "A clip is already being replayed");
+    }
+    clip_t *clip = clip_recorder_get();
+    if (!clip) {
+        clip_replaying.store(false);
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "No clip recorded yet");
+        return ESP_FAIL;
+    }
+    
+    clip_replay_t *replay = (clip_replay_t *)calloc(1, sizeof(clip_replay_t));
+    if (!replay || httpd_req_async_handler_begin(req, &replay->req) != ESP_OK) {
+        free(replay);
+        clip_recorder_release(clip);
+        clip_replaying.store(false);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    replay->clip = clip;
+    if (xTaskCreate(clip_replay_task, "clip_replay", CLIP_REPLAY_STACK, replay, 5, NULL) != pdPASS) {
+        httpd_resp_send_500(replay->req);
+        httpd_req_async_handler_complete(replay->req);
+        clip_recorder_release(clip);
+        free(replay);
+        clip_replaying.store(false);
+    }
+    return ESP_OK;
+}
 
 // Recognition page handler - serves HTML with overlay
 static esp_err_t recognition_page_handler(httpd_req_t *req)
 {
-    httpd_resp_set_type(req, "text/html");
-    return httpd_resp_send(req, recognition_html, strlen(recognition_html));
+    return send_www_asset(req, &www_recognition_html);
 }
 
 // Recognition stream handler - stream with face detection
@@ -850,8 +1319,8 @@ static esp_err_t recognition_stream_handler(httpd_req_t *req)
     esp_err_t res = ESP_OK;
     size_t _jpg_buf_len = 0;
     uint8_t *_jpg_buf = NULL;
-    char part_buf[128];
-    char current_name[MAX_NAME_LENGTH];
+    char part_buf[256];
+    recognition_state_t state;
 
     res = httpd_resp_set_type(req, _STREAM_CONTENT_TYPE);
     if (res != ESP_OK) {
@@ -863,7 +1332,7 @@ static esp_err_t recognition_stream_handler(httpd_req_t *req)
     while (true) {
         // Try to acquire camera with short timeout
         if (xSemaphoreTake(camera_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            fb = esp_camera_fb_get();
+            fb = capture_frame();
             xSemaphoreGive(camera_mutex);
         } else {
             vTaskDelay(pdMS_TO_TICKS(50));
@@ -876,13 +1345,8 @@ static esp_err_t recognition_stream_handler(httpd_req_t *req)
             break;
         }
 
-        // Get current recognized name (with mutex protection)
-        if (xSemaphoreTake(name_mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-            strcpy(current_name, name);
-            xSemaphoreGive(name_mutex);
-        } else {
-            strcpy(current_name, "Unknown");
-        }
+        // Latest recognition result, never blocks
+        recognition_state_read(&state);
 
         _jpg_buf_len = fb->len;
         _jpg_buf = fb->buf;
@@ -892,8 +1356,11 @@ static esp_err_t recognition_stream_handler(httpd_req_t *req)
             size_t hlen = snprintf(part_buf, sizeof(part_buf), 
                 "Content-Type: image/jpeg\r\n"
                 "Content-Length: %u\r\n"
-                "X-Face-Name: %s\r\n\r\n", 
-                _jpg_buf_len, current_name);
+                "X-Face-Name: %s\r\n"
+                "X-Face-Seq: %lu\r\n"
+                "X-Face-Age-Ms: %lld\r\n\r\n", 
+                _jpg_buf_len, recognition_state_best_name(&state), (unsigned long)state.frame_seq,
+                state.frame_seq ? (long long)(esp_timer_get_time() - state.capture_us) / 1000 : -1LL);
             res = httpd_resp_send_chunk(req, part_buf, hlen);
         }
         if (res == ESP_OK) {
@@ -903,7 +1370,7 @@ static esp_err_t recognition_stream_handler(httpd_req_t *req)
             res = httpd_resp_send_chunk(req, _STREAM_BOUNDARY, strlen(_STREAM_BOUNDARY));
         }
 
-        esp_camera_fb_return(fb);
+        camera_source_fb_return(fb);
         fb = NULL;
         _jpg_buf = NULL;
 
@@ -916,31 +1383,404 @@ static esp_err_t recognition_stream_handler(httpd_req_t *req)
     return res;
 }
 
-static esp_err_t recognized_name_handler(httpd_req_t *req)
+// Event query context - streams records into the HTTP response
+typedef struct {
+    json_writer_t w;
+    int count;
+    int limit;
+} events_query_ctx_t;
+
+static bool events_query_cb(const event_record_t *rec, void *arg)
 {
-    char current_name[MAX_NAME_LENGTH];
+    events_query_ctx_t *ctx = (events_query_ctx_t *)arg;
+    json_writer_t *w = &ctx->w;
     
-    // Get current name with mutex protection
-    if (xSemaphoreTake(name_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-        strcpy(current_name, name);
-        xSemaphoreGive(name_mutex);
-    } else {
-        strcpy(current_name, "Unknown");
+    face_id_t info;
+    const char *face_name = "Unknown";
+    if (rec->face_id >= 0 && face_recognition_get_info(rec->face_id, &info) == ESP_OK) {
+        face_name = info.name;
     }
     
-    httpd_resp_set_type(req, "application/json");
-    char json[128];
-    snprintf(json, sizeof(json), "{\"name\":\"%s\"}", current_name);
-    return httpd_resp_sendstr(req, json);
+    json_obj_begin(w, NULL);
+    json_uint(w, "seq", rec->seq);
+    json_uint(w, "t", rec->timestamp);
+    json_bool(w, "wall", rec->flags & EVENT_FLAG_WALL_CLOCK);
+    json_uint(w, "boot", rec->boot_id);
+    json_int(w, "id", rec->face_id);
+    json_str(w, "name", face_name);
+    json_num(w, "sim", rec->similarity / 10000.0f, 4);
+    json_arr_begin(w, "box");
+    for (int i = 0; i < 4; i++) {
+        json_uint(w, NULL, rec->box[i]);
+    }
+    json_arr_end(w);
+    json_obj_end(w);
+    ctx->count++;
+    
+    return ctx->count < ctx->limit && w->err == ESP_OK;
+}
+
+// Event log handler - /events?from=<unix t>&to=<unix t>&id=<face id>&limit=<n>
+static esp_err_t events_handler(httpd_req_t *req)
+{
+    char query[128];
+    char value[16];
+    uint32_t from = 0;
+    uint32_t to = UINT32_MAX;
+    int face_id = EVENT_LOG_ANY_ID;
+    int limit = 1000;
+    
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK) {
+            from = strtoul(value, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK) {
+            to = strtoul(value, NULL, 10);
+        }
+        if (httpd_query_key_value(query, "id", value, sizeof(value)) == ESP_OK) {
+            face_id = atoi(value);
+        }
+        if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK) {
+            limit = MAX(1, atoi(value));
+        }
+    }
+    
+    events_query_ctx_t *ctx = (events_query_ctx_t *)calloc(1, sizeof(events_query_ctx_t));
+    if (!ctx) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    ctx->limit = limit;
+    
+    json_writer_t *w = &ctx->w;
+    json_writer_begin(w, req);
+    json_obj_begin(w, NULL);
+    json_arr_begin(w, "events");
+    esp_err_t err = event_log_query(from, to, face_id, events_query_cb, ctx);
+    json_arr_end(w);
+    json_int(w, "count", ctx->count);
+    json_uint(w, "dropped", event_log_get_dropped());
+    json_bool(w, "ok", err == ESP_OK);
+    json_obj_end(w);
+    
+    esp_err_t res = json_writer_end(w);
+    free(ctx);
+    return res;
+}
+
+// Memory telemetry handler - latest sample of task stacks, heaps and allocation counts
+static esp_err_t telemetry_handler(httpd_req_t *req)
+{
+    telemetry_snapshot_t *snap = (telemetry_snapshot_t *)malloc(sizeof(telemetry_snapshot_t));
+    if (!snap) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    telemetry_get_snapshot(snap);
+    
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_int(&w, "uptime_ms", esp_timer_get_time() / 1000);
+    json_int(&w, "sampled_ms", snap->timestamp_us / 1000);
+    json_arr_begin(&w, "tasks");
+    for (int i = 0; i < snap->task_count; i++) {
+        const telemetry_task_t *t = &snap->tasks[i];
+        json_obj_begin(&w, NULL);
+        json_str(&w, "name", t->name);
+        json_uint(&w, "priority", t->priority);
+        json_int(&w, "core", t->core);
+        json_uint(&w, "stack_free_min", t->stack_free_min);
+        json_obj_end(&w);
+    }
+    json_arr_end(&w);
+    json_obj_begin(&w, "heap");
+    for (int k = 0; k < TELEMETRY_HEAP_COUNT; k++) {
+        const telemetry_heap_t *h = &snap->heap[k];
+        json_obj_begin(&w, telemetry_heap_name((telemetry_heap_kind_t)k));
+        json_uint(&w, "total", h->total);
+        json_uint(&w, "free", h->free);
+        json_uint(&w, "min_free", h->min_free);
+        json_uint(&w, "largest_free_block", h->largest_free_block);
+        json_uint(&w, "free_blocks", h->free_blocks);
+        json_num(&w, "fragmentation", h->fragmentation, 3);
+        json_int(&w, "trend_per_min", h->trend_per_min);
+        json_obj_end(&w);
+    }
+    json_obj_end(&w);
+    json_obj_begin(&w, "subsystems");
+    for (int i = 0; i < TELEMETRY_SUBSYS_COUNT; i++) {
+        const telemetry_subsys_stats_t *st = &snap->subsys[i];
+        json_obj_begin(&w, telemetry_subsys_name((telemetry_subsys_t)i));
+        json_uint(&w, "allocs", st->allocs);
+        json_uint(&w, "frees", st->frees);
+        json_uint(&w, "alloc_bytes", st->alloc_bytes);
+        json_uint(&w, "failed", st->failed);
+        json_obj_end(&w);
+    }
+    json_obj_end(&w);
+    capture_profile_stats_t camera;
+    capture_profile_get_stats(&camera);
+    json_obj_begin(&w, "capture_profile");
+    json_str(&w, "current", capture_profile_name(camera.current));
+    json_uint(&w, "switches", camera.switches);
+    json_num(&w, "last_switch_ms", camera.last_switch_us / 1000.0, 1);
+    json_num(&w, "max_switch_ms", camera.max_switch_us / 1000.0, 1);
+    json_num(&w, "avg_switch_ms", camera.switches ? camera.total_switch_us / 1000.0 / camera.switches : 0.0, 1);
+    for (int p = 0; p < CAPTURE_PROFILE_COUNT; p++) {
+        json_obj_begin(&w, capture_profile_name((capture_profile_t)p));
+        json_int(&w, "residency_ms", camera.residency_us[p] / 1000);
+        json_uint(&w, "frames", camera.frames[p]);
+        json_obj_end(&w);
+    }
+    json_obj_end(&w);
+    json_obj_end(&w);
+    free(snap);
+    
+    return json_writer_end(&w);
+}
+
+// Pipeline handler - /pipeline?mode=presence|landmarks|full&msr_score=&msr_nms=&mnp_score=&mnp_nms=&tiled=0|1
+// Without parameters it only reports the current settings
+static esp_err_t pipeline_handler(httpd_req_t *req)
+{
+    face_pipeline_config_t config;
+    face_recognition_get_pipeline(&config);
+    
+    char query[160];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        bool ok = true;
+        if (httpd_query_key_value(query, "mode", value, sizeof(value)) == ESP_OK) {
+            ok = face_pipeline_mode_parse(value, &config.mode);
+        }
+        if (httpd_query_key_value(query, "msr_score", value, sizeof(value)) == ESP_OK) {
+            config.msr_score_thr = strtof(value, NULL);
+        }
+        if (httpd_query_key_value(query, "msr_nms", value, sizeof(value)) == ESP_OK) {
+            config.msr_nms_thr = strtof(value, NULL);
+        }
+        if (httpd_query_key_value(query, "mnp_score", value, sizeof(value)) == ESP_OK) {
+            config.mnp_score_thr = strtof(value, NULL);
+        }
+        if (httpd_query_key_value(query, "mnp_nms", value, sizeof(value)) == ESP_OK) {
+            config.mnp_nms_thr = strtof(value, NULL);
+        }
+        if (httpd_query_key_value(query, "tiled", value, sizeof(value)) == ESP_OK) {
+            config.tiled = atoi(value) != 0;
+        }
+        if (!ok || face_recognition_set_pipeline(&config) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid mode or threshold (0 < threshold < 1)");
+            return ESP_FAIL;
+        }
+    }
+    
+    face_warmup_stats_t warmup;
+    face_recognition_get_warmup(&warmup);
+    
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_str(&w, "mode", face_pipeline_mode_name(config.mode));
+    json_num(&w, "msr_score", config.msr_score_thr, 2);
+    json_num(&w, "msr_nms", config.msr_nms_thr, 2);
+    json_num(&w, "mnp_score", config.mnp_score_thr, 2);
+    json_num(&w, "mnp_nms", config.mnp_nms_thr, 2);
+    json_bool(&w, "tiled", config.tiled);
+    json_obj_begin(&w, "warmup");
+    json_num(&w, "detect_cold_ms", warmup.detect_cold_us / 1000.0, 1);
+    json_num(&w, "detect_warm_ms", warmup.detect_warm_us / 1000.0, 1);
+    json_num(&w, "embed_cold_ms", warmup.embed_cold_us / 1000.0, 1);
+    json_num(&w, "embed_warm_ms", warmup.embed_warm_us / 1000.0, 1);
+    json_obj_end(&w);
+    json_obj_end(&w);
+    return json_writer_end(&w);
+}
+
+// ROI handler - /roi?rects=x,y,w,h;x,y,w,h limits detection to those parts of the frame,
+// /roi?rects= scans the whole frame again. Without parameters it only reports the regions.
+static esp_err_t roi_handler(httpd_req_t *req)
+{
+    roi_rect_t rects[ROI_MAX_COUNT];
+    
+    char query[160];
+    char value[128];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "rects", value, sizeof(value)) == ESP_OK) {
+        int count = 0;
+        bool ok = true;
+        char *save = NULL;
+        for (char *tok = strtok_r(value, ";", &save); tok && ok; tok = strtok_r(NULL, ";", &save)) {
+            unsigned x, y, w, h;
+            ok = count < ROI_MAX_COUNT && sscanf(tok, "%u,%u,%u,%u", &x, &y, &w, &h) == 4 &&
+                 x < 4096 && y < 4096 && w <= 4096 && h <= 4096;
+            if (ok) {
+                rects[count++] = {(uint16_t)x, (uint16_t)y, (uint16_t)w, (uint16_t)h};
+            }
+        }
+        if (!ok || roi_set(rects, count) != ESP_OK) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Expected up to 4 rects as x,y,w,h separated by ';'");
+            return ESP_FAIL;
+        }
+    }
+    
+    int count = roi_get(rects, ROI_MAX_COUNT);
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_int(&w, "count", count);
+    json_arr_begin(&w, "rects");
+    for (int i = 0; i < count; i++) {
+        json_obj_begin(&w, NULL);
+        json_uint(&w, "x", rects[i].x);
+        json_uint(&w, "y", rects[i].y);
+        json_uint(&w, "w", rects[i].w);
+        json_uint(&w, "h", rects[i].h);
+        json_obj_end(&w);
+    }
+    json_arr_end(&w);
+    json_obj_end(&w);
+    return json_writer_end(&w);
+}
+
+// Duplicates handler - /duplicates?policy=allow|attach|reject&threshold=<sim> sets what enrollment
+// does with a face that is already enrolled. Lists enrolled IDs that look like the same
+// person; with merge=1 each such pair is folded into its lower ID.
+static esp_err_t duplicates_handler(httpd_req_t *req)
+{
+    face_duplicate_config_t config;
+    face_recognition_get_duplicate_config(&config);
+    bool merge = false;
+    
+    char query[96];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+        bool ok = true;
+        bool changed = false;
+        if (httpd_query_key_value(query, "policy", value, sizeof(value)) == ESP_OK) {
+            ok = face_duplicate_policy_parse(value, &config.policy);
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "threshold", value, sizeof(value)) == ESP_OK) {
+            config.threshold = strtof(value, NULL);
+            changed = true;
+        }
+        if (httpd_query_key_value(query, "merge", value, sizeof(value)) == ESP_OK) {
+            merge = atoi(value) != 0;
+        }
+        if (!ok || (changed && face_recognition_set_duplicate_config(&config) != ESP_OK)) {
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid policy or threshold (0 < threshold < 1)");
+            return ESP_FAIL;
+        }
+    }
+    
+    // Enrollment is the only other writer of the database and also runs in this task
+    face_duplicate_pair_t pairs[MAX_FACE_ID_COUNT];
+    int n = face_recognition_find_duplicates(config.threshold, merge, pairs, MAX_FACE_ID_COUNT);
+    
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_str(&w, "policy", face_duplicate_policy_name(config.policy));
+    json_num(&w, "threshold", config.threshold, 2);
+    json_bool(&w, "merged", merge && n > 0);
+    json_bool(&w, "ok", n >= 0);
+    json_arr_begin(&w, "pairs");
+    for (int i = 0; i < n; i++) {
+        json_obj_begin(&w, NULL);
+        json_int(&w, "keep", pairs[i].keep);
+        json_int(&w, "merge", pairs[i].merge);
+        json_num(&w, "similarity", pairs[i].similarity, 4);
+        json_obj_end(&w);
+    }
+    json_arr_end(&w);
+    json_obj_end(&w);
+    return json_writer_end(&w);
+}
+
+// Trace handler - recent pipeline spans as Chrome trace-event JSON
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+    trace_record_t *records = (trace_record_t *)heap_caps_malloc(TRACE_RING_SIZE * sizeof(trace_record_t),
+                                                                   MALLOC_CAP_SPIRAM);
+    if (!records) {
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+    int n = trace_read(records, TRACE_RING_SIZE);
+    
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"trace.json\"");
+    json_obj_begin(&w, NULL);
+    json_str(&w, "displayTimeUnit", "ms");
+    json_arr_begin(&w, "traceEvents");
+    for (int i = 0; i < n && w.err == ESP_OK; i++) {
+        const trace_record_t *r = &records[i];
+        json_obj_begin(&w, NULL);
+        json_str(&w, "name", trace_stage_name((trace_stage_t)r->stage));
+        json_str(&w, "cat", "pipeline");
+        json_str(&w, "ph", "X");
+        json_int(&w, "ts", r->start_us);
+        json_uint(&w, "dur", r->dur_us);
+        json_int(&w, "pid", 1);
+        json_uint(&w, "tid", r->core);
+        json_obj_begin(&w, "args");
+        json_uint(&w, "frame", r->frame_seq);
+        json_obj_end(&w);
+        json_obj_end(&w);
+    }
+    heap_caps_free(records);
+    json_arr_end(&w);
+    json_obj_end(&w);
+    return json_writer_end(&w);
+}
+
+// Runs in the HTTP server task for every new connection; everything that task
+// allocates from here on is counted as http
+static esp_err_t http_open_fn(httpd_handle_t hd, int sockfd)
+{
+    telemetry_enter(TELEMETRY_SUBSYS_HTTP);
+    return ESP_OK;
+}
+
+static esp_err_t recognized_name_handler(httpd_req_t *req)
+{
+    recognition_state_t state;
+    recognition_state_read(&state);
+
+    int id = -1;
+    float similarity = 0.0f;
+    if (state.identity_count > 0) {
+        id = state.identities[0].id;
+        similarity = state.identities[0].similarity;
+    }
+    int64_t now = esp_timer_get_time();
+    long long age_ms = state.frame_seq ? (now - state.timestamp_us) / 1000 : -1;
+    long long capture_age_ms = state.frame_seq ? (now - state.capture_us) / 1000 : -1;
+
+    json_writer_t w;
+    json_writer_begin(&w, req);
+    json_obj_begin(&w, NULL);
+    json_str(&w, "name", recognition_state_best_name(&state));
+    json_int(&w, "id", id);
+    json_num(&w, "similarity", similarity, 4);
+    json_int(&w, "faces", state.face_count);
+    json_uint(&w, "seq", state.frame_seq);
+    json_int(&w, "age_ms", age_ms);
+    json_int(&w, "capture_age_ms", capture_age_ms);
+    json_obj_end(&w);
+    return json_writer_end(&w);
 }
 
 // Start HTTP server
 void start_camera_server(void)
 {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
-    config.server_port = 80;
+    config.server_port = HTTP_SERVER_PORT;
     config.ctrl_port = 32768;
-    config.max_uri_handlers = 16;  // Increased from 8 to support all our endpoints
+    config.max_uri_handlers = 24;  // Increased from 8 to support all our endpoints
+    config.open_fn = http_open_fn;
 
     httpd_uri_t index_uri = {
         .uri = "/",
@@ -977,6 +1817,20 @@ void start_camera_server(void)
         .user_ctx = NULL
     };
 
+    httpd_uri_t recognize_uri = {
+        .uri = "/recognize",
+        .method = HTTP_POST,
+        .handler = recognize_handler,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t delete_uri = {
+        .uri = "/delete",
+        .method = HTTP_GET,
+        .handler = delete_handler,
+        .user_ctx = NULL
+    };
+
     httpd_uri_t delete_all_uri = {
         .uri = "/delete_all",
         .method = HTTP_GET,
@@ -1005,6 +1859,13 @@ void start_camera_server(void)
         .user_ctx = NULL
     };
 
+    httpd_uri_t clip_uri = {
+        .uri = "/clip",
+        .method = HTTP_GET,
+        .handler = clip_handler,
+        .user_ctx = NULL
+    };
+
     httpd_uri_t recognition_stream_uri = {
         .uri = "/recognition",
         .method = HTTP_GET,
@@ -1026,6 +1887,55 @@ void start_camera_server(void)
         .user_ctx = NULL
     };
 
+    httpd_uri_t events_uri = {
+        .uri = "/events",
+        .method = HTTP_GET,
+        .handler = events_handler,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t telemetry_uri = {
+        .uri = "/telemetry",
+        .method = HTTP_GET,
+        .handler = telemetry_handler,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t duplicates_uri = {
+        .uri = "/duplicates",
+        .method = HTTP_GET,
+        .handler = duplicates_handler,
+        .user_ctx = NULL
+    };
+    
+    httpd_uri_t jobs_uri = {
+        .uri = "/jobs",
+        .method = HTTP_GET,
+        .handler = jobs_handler,
+        .user_ctx = NULL
+    };
+    
+    httpd_uri_t roi_uri = {
+        .uri = "/roi",
+        .method = HTTP_GET,
+        .handler = roi_handler,
+        .user_ctx = NULL
+    };
+    
+    httpd_uri_t pipeline_uri = {
+        .uri = "/pipeline",
+        .method = HTTP_GET,
+        .handler = pipeline_handler,
+        .user_ctx = NULL
+    };
+
+    httpd_uri_t trace_uri = {
+        .uri = "/trace",
+        .method = HTTP_GET,
+        .handler = trace_handler,
+        .user_ctx = NULL
+    };
+
     ESP_LOGI(TAG, "Starting web server on port: '%d'", config.server_port);
     if (httpd_start(&stream_httpd, &config) == ESP_OK) {
         ESP_LOGI(TAG, "Registering URI handlers...");
@@ -1038,6 +1948,10 @@ void start_camera_server(void)
         ESP_LOGI(TAG, "Registered: /enroll (GET and POST)");
         httpd_register_uri_handler(stream_httpd, &faces_uri);
         ESP_LOGI(TAG, "Registered: /faces");
+        httpd_register_uri_handler(stream_httpd, &recognize_uri);
+        ESP_LOGI(TAG, "Registered: /recognize (POST)");
+        httpd_register_uri_handler(stream_httpd, &delete_uri);
+        ESP_LOGI(TAG, "Registered: /delete");
         httpd_register_uri_handler(stream_httpd, &delete_all_uri);
         ESP_LOGI(TAG, "Registered: /delete_all");
         httpd_register_uri_handler(stream_httpd, &reset_database_uri);
@@ -1046,6 +1960,8 @@ void start_camera_server(void)
         ESP_LOGI(TAG, "Registered: /ping");
         httpd_register_uri_handler(stream_httpd, &capture_uri);
         ESP_LOGI(TAG, "Registered: /capture");
+        httpd_register_uri_handler(stream_httpd, &clip_uri);
+        ESP_LOGI(TAG, "Registered: /clip");
         httpd_register_uri_handler(stream_httpd, &recognized_name_uri);
         ESP_LOGI(TAG, "Registered: /recognized_name");
         
@@ -1055,6 +1971,27 @@ void start_camera_server(void)
         esp_err_t rec_stream_reg = httpd_register_uri_handler(stream_httpd, &recognition_stream_data_uri);
         ESP_LOGI(TAG, "Registered: /recognition_stream (result: %d)", rec_stream_reg);
         
+        httpd_register_uri_handler(stream_httpd, &events_uri);
+        ESP_LOGI(TAG, "Registered: /events");
+        httpd_register_uri_handler(stream_httpd, &telemetry_uri);
+        ESP_LOGI(TAG, "Registered: /telemetry");
+        httpd_register_uri_handler(stream_httpd, &trace_uri);
+        ESP_LOGI(TAG, "Registered: /trace");
+        httpd_register_uri_handler(stream_httpd, &pipeline_uri);
+        ESP_LOGI(TAG, "Registered: /pipeline");
+        
+        httpd_register_uri_handler(stream_httpd, &roi_uri);
+        ESP_LOGI(TAG, "Registered: /roi");
+        
+        httpd_register_uri_handler(stream_httpd, &duplicates_uri);
+        ESP_LOGI(TAG, "Registered: /duplicates");
+        
+        httpd_register_uri_handler(stream_httpd, &jobs_uri);
+        ESP_LOGI(TAG, "Registered: /jobs");
+        
+#if CONFIG_IDF_TARGET_LINUX
+        ESP_LOGI(TAG, "Web interface started at http://localhost:%d", HTTP_SERVER_PORT);
+#else
         esp_netif_ip_info_t ip_info;
         esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
         if (netif != NULL && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
@@ -1062,11 +1999,13 @@ void start_camera_server(void)
         } else {
             ESP_LOGI(TAG, "Web interface started at http://[YOUR_IP]");
         }
+#endif
     } else {
         ESP_LOGE(TAG, "Failed to start stream server");
     }
 }
 
+#if !CONFIG_IDF_TARGET_LINUX
 esp_err_t _http_event_handler(esp_http_client_event_t *evt)
 {
     static char *output_buffer;  // Buffer to store response of http request from event handler
@@ -1162,6 +2101,11 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
+static void led_reset_cb(void *arg)
+{
+    set_neopixel_color(0, 0, 255);  // Back to blue
+}
+
 void init_neopixel(void)
 {
     /* LED strip initialization with the GPIO and pixels number */
@@ -1188,6 +2132,15 @@ void init_neopixel(void)
     }
     
     ESP_LOGI(TAG, "NeoPixel LED initialized on GPIO %d", WS2812_PIN);
+
+    // One-shot timer that ends the recognition blink without stalling the caller
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = led_reset_cb;
+    timer_args.name = "led_reset";
+    if (esp_timer_create(&timer_args, &led_reset_timer) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to create LED reset timer");
+        led_reset_timer = NULL;
+    }
 }
 
 void set_neopixel_color(int r, int g, int b)
@@ -1211,6 +2164,7 @@ void set_neopixel_color(int r, int g, int b)
 
 // Task to send Discord message (needs larger stack than main task)
 void discord_task(void *param) {
+    telemetry_enter(TELEMETRY_SUBSYS_NOTIFY);
     char *message = (char *)param;
     char local_response_buffer[MAX_HTTP_OUTPUT_BUFFER + 1] = {0};
     char json_data[512];
@@ -1263,75 +2217,200 @@ bool sendDiscordMessage(const char* message) {
     }
     return true;
 }
+#else
+// Host build: no LED and no outbound notifications
+void init_neopixel(void)
+{
+}
 
-// Background task to continuously perform face recognition
-void face_recognition_task(void *param)
+void set_neopixel_color(int r, int g, int b)
 {
-    ESP_LOGI(TAG, "Face recognition background task started");
-    char local_name[MAX_NAME_LENGTH];
+}
+
+bool sendDiscordMessage(const char* message) {
+    ESP_LOGI(TAG, "Discord message (not sent in host build): %s", message);
+    return true;
+}
+#endif
+
+// Live recognition, the never-ending job at the top priority: one camera frame
+// per step, repeated at the recognition interval; the cheaper pipeline modes run
+// at video rate. While clips are recorded and no stream or poller is capturing,
+// steps in between only grab a frame for them, so a clip is not a handful of
+// frames 2 s apart. Uploads and enrollments run in between.
+static int live_recognition_step(inference_job_t *job)
+{
+    static char local_name[MAX_NAME_LENGTH];
+    static char confirmed_name[MAX_NAME_LENGTH];
+    static char last_sent_name[MAX_NAME_LENGTH] = "";
+    static int64_t last_unknown_clip_us = -CLIP_UNKNOWN_COOLDOWN_MS * 1000LL;
+    static TickType_t last_recognition_time = 0;
+    static uint32_t frame_seq = 0;
+    static int64_t next_recognition_us = 0;
+    static face_match_t match;
+    static identity_vote_t votes;
+    static bool started = false;
+    if (!started) {
+        ESP_LOGI(TAG, "Live face recognition started");
+        identity_vote_init(&votes);
+        started = true;
+    }
     
-    while (true) {
-        // Wait for the recognition interval
-        vTaskDelay(pdMS_TO_TICKS(RECOGNITION_INTERVAL_MS));
+    face_pipeline_config_t pipeline;
+    face_recognition_get_pipeline(&pipeline);
+    int interval_ms = pipeline.mode == FACE_PIPELINE_FULL ? RECOGNITION_INTERVAL_MS : PRESENCE_INTERVAL_MS;
+    int clip_ms = clip_recorder_enabled() ? CLIP_FRAME_INTERVAL_MS : interval_ms;
+    int64_t step_us = esp_timer_get_time();
+    
+    int64_t wait_us = next_recognition_us - step_us;
+    if (wait_us > 0) {
+        // Not due yet: grab a frame for the clip recorder only if nobody else
+        // does. A stream caches every frame anyway, and each grab here would
+        // take one it would otherwise have sent.
+        frame_cache_entry_t *latest = frame_cache_get();
+        bool fresh = latest && step_us - latest->capture_us < CLIP_FRAME_INTERVAL_MS * 1000LL;
+        frame_cache_release(latest);
+        if (!fresh && xSemaphoreTake(camera_mutex, 0) == pdTRUE) {
+            camera_fb_t *fb = capture_frame();
+            if (fb) {
+                camera_source_fb_return(fb);
+            }
+            xSemaphoreGive(camera_mutex);
+        }
+        return std::min<int64_t>(wait_us / 1000 + 1, clip_ms);
+    }
+    
+    // Never block the executor on the camera
+    if (xSemaphoreTake(camera_mutex, 0) != pdTRUE) {
+        return std::min(interval_ms, clip_ms);  // Camera busy, skip this cycle
+    }
+    
+    camera_fb_t *fb = capture_frame();
+    
+    if (fb) {
+        // Stamp the frame so every stage below is traced against it
+        frame_seq++;
+        trace_set_frame(frame_seq);
+        int64_t capture_us = trace_fb_capture_us(fb);
+        trace_span(TRACE_STAGE_CAPTURE, capture_us, trace_now());
         
-        // Try to acquire camera with short timeout
-        if (xSemaphoreTake(camera_mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-            continue;  // Camera busy, skip this cycle
+        // Perform face recognition
+        int result = face_recognition_recognize(fb, local_name, &match);
+        
+        // Record every detected face, recognized or not
+        for (int i = 0; i < match.result_count; i++) {
+            event_log_append(match.faces[i].id, match.faces[i].similarity, match.faces[i].box);
+        }
+        if (match.face_count > 0 && result < 0 &&
+            esp_timer_get_time() - last_unknown_clip_us > CLIP_UNKNOWN_COOLDOWN_MS * 1000LL &&
+            clip_recorder_trigger("unknown")) {
+            last_unknown_clip_us = esp_timer_get_time();
         }
         
-        camera_fb_t *fb = esp_camera_fb_get();
+        // Vote over the last identifications of this face so a single
+        // bad frame neither drops nor switches the published identity
+        int64_t now = esp_timer_get_time();
+        identity_vote_expire(&votes, now);
+        int tracks[FACE_RESULT_MAX_FACES];
+        for (int i = 0; i < match.result_count; i++) {
+            const face_match_face_t *face = &match.faces[i];
+            tracks[i] = identity_vote_observe(&votes, face->box, face->identified, face->id, face->similarity, now);
+        }
+        // The track of the best match leads, the identities of the others follow it
+        int track = match.result_count > 0 ? tracks[0] : -1;
+        for (int i = 0; i < match.result_count; i++) {
+            if (match.faces[i].id == result && result >= 0) {
+                track = tracks[i];
+            }
+        }
         
-        if (fb) {
-            // Perform face recognition
-            int result = face_recognition_recognize(fb, local_name);
+        // Publish the confirmed identities, this face first; readers never wait on
+        // this task or it on them
+        int64_t publish_start = trace_now();
+        recognition_state_t state = {};
+        state.frame_seq = frame_seq;
+        state.timestamp_us = publish_start;
+        state.capture_us = capture_us;
+        state.face_count = match.face_count;
+        int confirmed = -1;
+        face_id_t info;
+        for (int i = 0; i < IDENTITY_VOTE_MAX_TRACKS && state.identity_count < RECOGNITION_STATE_MAX_FACES; i++) {
+            int t = (std::max(track, 0) + i) % IDENTITY_VOTE_MAX_TRACKS;
+            float similarity = 0.0f;
+            int id = identity_vote_confirmed(&votes, t, &similarity);
+            if (id < 0 || face_recognition_get_info(id, &info) != ESP_OK) {
+                continue;  // Nothing confirmed, or the face was deleted since
+            }
+            if (t == track) {
+                confirmed = id;
+                snprintf(confirmed_name, sizeof(confirmed_name), "%s", info.name);
+            }
+            recognition_identity_t *identity = &state.identities[state.identity_count++];
+            identity->id = id;
+            snprintf(identity->name, sizeof(identity->name), "%s", info.name);
+            identity->similarity = similarity;
+        }
+        recognition_state_publish(&state);
+        
+        // Stay at high resolution while there is a face nobody was confirmed for
+        bool unconfirmed = match.face_count > match.result_count;
+        for (int i = 0; i < match.result_count && !unconfirmed; i++) {
+            float similarity;
+            unconfirmed = identity_vote_confirmed(&votes, tracks[i], &similarity) < 0;
+        }
+        if (unconfirmed) {
+            capture_profile_burst(CAMERA_BURST_MS);
+        }
+        if (capture_profile_get() == CAPTURE_PROFILE_BURST) {
+            interval_ms = std::min(interval_ms, CAMERA_BURST_INTERVAL_MS);
+        }
+        int64_t published = trace_now();
+        trace_span(TRACE_STAGE_PUBLISH, publish_start, published);
+        trace_span(TRACE_STAGE_FRAME, capture_us, published);
+        
+        if (confirmed >= 0) {
+            // Check if this is a new recognition or enough time has passed
+            TickType_t current_time = xTaskGetTickCount();
+            bool should_send = false;
             
-            // Update global name with mutex protection
-            if (xSemaphoreTake(name_mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-                if (result >= 0) {
-                    // Face recognized
-                    strcpy(name, local_name);
-                    
-                    // Check if this is a new recognition or enough time has passed
-                    TickType_t current_time = xTaskGetTickCount();
-                    bool should_send = false;
-                    
-                    if (strcmp(name, last_sent_name) != 0) {
-                        // Different person detected
-                        should_send = true;
-                        ESP_LOGI(TAG, "New person recognized: %s", name);
-                    } else if ((current_time - last_recognition_time) > pdMS_TO_TICKS(RECOGNITION_COOLDOWN_MS)) {
-                        // Same person but cooldown period has passed
-                        should_send = true;
-                        ESP_LOGI(TAG, "Re-sending recognition for: %s (cooldown expired)", name);
-                    }
-                    
-                    if (should_send) {
-                        // Send Discord notification
-                        char discord_msg[128];
-                        snprintf(discord_msg, sizeof(discord_msg), "🎥 Spotted: %s", name);
-                        sendDiscordMessage(discord_msg);
-                        
-                        // Update tracking variables
-                        strcpy(last_sent_name, name);
-                        last_recognition_time = current_time;
-                        
-                        // Set LED to green for recognized face
-                        set_neopixel_color(0, 255, 0);
-                        vTaskDelay(pdMS_TO_TICKS(500));
-                        set_neopixel_color(0, 0, 255);  // Back to blue
-                    }
-                } else {
-                    // No face or unknown face
-                    strcpy(name, "Unknown");
-                }
-                xSemaphoreGive(name_mutex);
+            if (strcmp(confirmed_name, last_sent_name) != 0) {
+                // Different person detected
+                should_send = true;
+                ESP_LOGI(TAG, "New person recognized: %s", confirmed_name);
+            } else if ((current_time - last_recognition_time) > pdMS_TO_TICKS(RECOGNITION_COOLDOWN_MS)) {
+                // Same person but cooldown period has passed
+                should_send = true;
+                ESP_LOGI(TAG, "Re-sending recognition for: %s (cooldown expired)", confirmed_name);
             }
             
-            esp_camera_fb_return(fb);
+            if (should_send) {
+                // Send Discord notification
+                char discord_msg[128];
+                snprintf(discord_msg, sizeof(discord_msg), "🎥 Spotted: %s", confirmed_name);
+                int64_t notify_start = trace_now();
+                sendDiscordMessage(discord_msg);
+                trace_span(TRACE_STAGE_NOTIFY, notify_start, trace_now());
+                clip_recorder_trigger(confirmed_name);
+                
+                // Update tracking variables
+                strcpy(last_sent_name, confirmed_name);
+                last_recognition_time = current_time;
+                
+                // Set LED to green for recognized face, the timer turns it back to blue
+                set_neopixel_color(0, 255, 0);
+                if (led_reset_timer) {
+                    esp_timer_stop(led_reset_timer);
+                    esp_timer_start_once(led_reset_timer, 500 * 1000);
+                }
+            }
         }
         
-        xSemaphoreGive(camera_mutex);
+        camera_source_fb_return(fb);
     }
+    
+    xSemaphoreGive(camera_mutex);
+    next_recognition_us = step_us + interval_ms * 1000LL;
+    return std::min(interval_ms, clip_ms);
 }
 
 extern "C" void app_main(void)
@@ -1344,6 +2423,14 @@ extern "C" void app_main(void)
     }
     ESP_ERROR_CHECK(ret);
 
+    // Start memory telemetry first so early allocations are counted
+    if (telemetry_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Telemetry unavailable");
+    }
+
+    // Regions of interest for detection, the whole frame if none are saved
+    roi_init();
+
     // Create camera mutex
     camera_mutex = xSemaphoreCreateMutex();
     if (camera_mutex == NULL) {
@@ -1351,18 +2438,17 @@ extern "C" void app_main(void)
         return;
     }
 
-    // Create name mutex
-    name_mutex = xSemaphoreCreateMutex();
-    if (name_mutex == NULL) {
-        ESP_LOGE(TAG, "Failed to create name mutex");
-        return;
-    }
-
+#if CONFIG_IDF_TARGET_LINUX
+    // The host build uses the host network stack
+    esp_netif_init();
+    esp_event_loop_create_default();
+#else
     ESP_LOGI(TAG, "Initializing WiFi...");
     wifi_init_sta();
 
     // Wait for WiFi connection
     vTaskDelay(5000 / portTICK_PERIOD_MS);
+#endif
 
     ESP_LOGI(TAG, "Initializing camera...");
     if (init_camera() != ESP_OK) {
@@ -1372,6 +2458,27 @@ extern "C" void app_main(void)
 
     ESP_LOGI(TAG, "Initializing face recognition...");
     face_recognition_init();
+    face_recognition_warmup(CAMERA_BURST_WIDTH, CAMERA_BURST_HEIGHT);
+
+    // Every model inference from here on runs as a job on the executor
+    if (inference_init() != ESP_OK) {
+        ESP_LOGE(TAG, "Inference executor failed to start");
+        return;
+    }
+
+    ESP_LOGI(TAG, "Initializing event log...");
+    if (event_log_init() != ESP_OK) {
+        ESP_LOGW(TAG, "Event log unavailable, recognitions will not be recorded");
+    }
+    
+    clip_recorder_config_t clip_config = {
+        .budget_bytes = CLIP_BUDGET_BYTES,
+        .pre_roll_ms = CLIP_PRE_ROLL_MS,
+        .post_roll_ms = CLIP_POST_ROLL_MS,
+    };
+    if (clip_recorder_init(&clip_config) != ESP_OK) {
+        ESP_LOGW(TAG, "Clip recorder unavailable, events are recorded without footage");
+    }
 
     ESP_LOGI(TAG, "Initializing NeoPixel LED...");
     init_neopixel();
@@ -1379,6 +2486,9 @@ extern "C" void app_main(void)
     ESP_LOGI(TAG, "Starting camera server...");
     start_camera_server();
 
+#if CONFIG_IDF_TARGET_LINUX
+    ESP_LOGI(TAG, "Setup complete. Access web interface at http://localhost:%d", HTTP_SERVER_PORT);
+#else
     esp_netif_ip_info_t ip_info;
     esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
     if (netif != NULL && esp_netif_get_ip_info(netif, &ip_info) == ESP_OK) {
@@ -1390,11 +2500,12 @@ extern "C" void app_main(void)
         ESP_LOGI(TAG, "Setup complete. Access web interface at http://[YOUR_IP]");
         sendDiscordMessage("ESP32-S3-CAM started. IP Address: Unknown");
     }
+#endif
     
     // Set Neopixel to blue to indicate ready
     set_neopixel_color(0, 0, 255);
     
-    // Start background face recognition task
-    ESP_LOGI(TAG, "Starting background face recognition task...");
-    xTaskCreate(face_recognition_task, "face_recog", 8192, NULL, 5, NULL);
+    // Start live face recognition
+    ESP_LOGI(TAG, "Starting background face recognition...");
+    inference_submit("recognize", INFERENCE_PRIORITY_LIVE, 0, live_recognition_step, NULL, NULL);
 }
\ No newline at end of file
@@ -0,0 +1,48 @@
+#include "rcu.h"
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+static std::atomic<uint32_t> generation{0};
+static std::atomic<int> readers[2];
+static SemaphoreHandle_t sync_mutex = NULL;  // One grace period at a time
+
+esp_err_t rcu_init(void)
+{
+    if (!sync_mutex) {
+        sync_mutex = xSemaphoreCreateMutex();
+    }
+    return sync_mutex ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+uint32_t rcu_read_lock(void)
+{
+    while (true) {
+        uint32_t gen = generation.load(std::memory_order_acquire);
+        readers[gen & 1].fetch_add(1, std::memory_order_seq_cst);
+        // A writer that moved on in between may already be waiting on the other
+        // counter only, so count again under the new generation
+        if (generation.load(std::memory_order_seq_cst) == gen) {
+            return gen;
+        }
+        readers[gen & 1].fetch_sub(1, std::memory_order_release);
+    }
+}
+
+void rcu_read_unlock(uint32_t token)
+{
+    readers[token & 1].fetch_sub(1, std::memory_order_release);
+}
+
+void rcu_synchronize(void)
+{
+    xSemaphoreTake(sync_mutex, portMAX_DELAY);
+    // Readers entering from here on count under the new generation and see
+    // everything published before the call
+    uint32_t gen = generation.fetch_add(1, std::memory_order_seq_cst);
+    while (readers[gen & 1].load(std::memory_order_acquire) != 0) {
+        vTaskDelay(1);
+    }
+    xSemaphoreGive(sync_mutex);
+}
@@ -0,0 +1,37 @@
+#ifndef RCU_H
+#define RCU_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "esp_err.h"
+
+// Read-copy-update for data that is read on every frame and changed rarely.
+// Readers mark a read section with two atomic counter updates and never wait.
+// A writer publishes its change, then calls rcu_synchronize to wait until every
+// reader that might still see the old data has left its section, after which
+// the old data can be reused or freed.
+//
+// Readers count themselves in one of two counters, picked by the parity of the
+// current generation. rcu_synchronize moves to the next generation and waits
+// for the counter of the previous one to drain.
+
+// Create the writer lock, before the first rcu_synchronize
+esp_err_t rcu_init(void);
+
+// Enter a read section. Sections may nest and never block. Returns a token for
+// rcu_read_unlock.
+uint32_t rcu_read_lock(void);
+void rcu_read_unlock(uint32_t token);
+
+// Wait until every read section that was entered before the call has ended.
+// Must not be called inside a read section.
+void rcu_synchronize(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RCU_H
@@ -0,0 +1,44 @@
+#include "recognition_state.h"
+#include <string.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+
+// Seqlock: the sequence number is odd while a write is in progress. A reader copies
+// the state and retries if the sequence was odd or changed during the copy.
+//
+// The writer holds a spinlock with interrupts off on its core for the ~200 byte copy,
+// so it cannot be preempted halfway through. A reader on the same core therefore never
+// sees an odd sequence, and a reader on the other core retries for at most the length
+// of one copy. The spinlock is only ever taken by the single writer.
+
+static std::atomic<uint32_t> state_seq{0};
+static recognition_state_t state;
+static portMUX_TYPE write_lock = portMUX_INITIALIZER_UNLOCKED;
+
+void recognition_state_publish(const recognition_state_t *new_state)
+{
+    portENTER_CRITICAL(&write_lock);
+    uint32_t seq = state_seq.load(std::memory_order_relaxed);
+    state_seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(&state, new_state, sizeof(state));
+    state_seq.store(seq + 2, std::memory_order_release);
+    portEXIT_CRITICAL(&write_lock);
+}
+
+void recognition_state_read(recognition_state_t *out)
+{
+    uint32_t before;
+    uint32_t after;
+    do {
+        before = state_seq.load(std::memory_order_acquire);
+        memcpy(out, &state, sizeof(*out));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = state_seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+const char *recognition_state_best_name(const recognition_state_t *s)
+{
+    return s->identity_count > 0 ? s->identities[0].name : "Unknown";
+}
@@ -0,0 +1,42 @@
+#ifndef RECOGNITION_STATE_H
+#define RECOGNITION_STATE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "face_recognition.h"
+
+#define RECOGNITION_STATE_MAX_FACES 4
+
+typedef struct {
+    int id;                      // Face ID, -1 if unknown
+    char name[MAX_NAME_LENGTH];
+    float similarity;
+} recognition_identity_t;
+
+// Result of the latest recognition tick
+typedef struct {
+    uint32_t frame_seq;     // Sequence number of the frame the result describes, 0 before the first result
+    int64_t timestamp_us;   // esp_timer time the result was published
+    int64_t capture_us;     // esp_timer time the sensor captured the frame
+    int face_count;         // Faces detected in the frame
+    int identity_count;     // Valid entries in identities, best match first
+    recognition_identity_t identities[RECOGNITION_STATE_MAX_FACES];
+} recognition_state_t;
+
+// Publish a new state. Only one task may publish; it never waits for readers.
+void recognition_state_publish(const recognition_state_t *state);
+
+// Copy the latest consistent state. Never blocks and never returns a torn copy.
+void recognition_state_read(recognition_state_t *out);
+
+// Name of the best identity in a state, "Unknown" if there is none
+const char *recognition_state_best_name(const recognition_state_t *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // RECOGNITION_STATE_H
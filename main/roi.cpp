@@ -0,0 +1,319 @@
+#include "roi.h"
+#include <string.h>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "nvs.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_jpg_decode.h"
+#endif
+
+static const char *TAG = "roi";
+static const char *nvs_namespace = "roi";
+static const char *nvs_key = "rects";
+
+// Set from the HTTP task, read by the recognition task for every frame
+static roi_rect_t rects[ROI_MAX_COUNT];
+static int rect_count = 0;
+static portMUX_TYPE rect_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Blob saved in NVS
+typedef struct {
+    int32_t count;
+    roi_rect_t rects[ROI_MAX_COUNT];
+} roi_blob_t;
+
+static bool rects_valid(const roi_rect_t *r, int count)
+{
+    if (count < 0 || count > ROI_MAX_COUNT) {
+        return false;
+    }
+    for (int i = 0; i < count; i++) {
+        if (r[i].w == 0 || r[i].h == 0 || r[i].x + r[i].w > 4096 || r[i].y + r[i].h > 4096) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void roi_init(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(nvs_namespace, NVS_READONLY, &handle) != ESP_OK) {
+        return;
+    }
+    roi_blob_t blob;
+    size_t len = sizeof(blob);
+    if (nvs_get_blob(handle, nvs_key, &blob, &len) == ESP_OK && len == sizeof(blob) &&
+        rects_valid(blob.rects, blob.count)) {
+        memcpy(rects, blob.rects, sizeof(rects));
+        rect_count = blob.count;
+        ESP_LOGI(TAG, "%d region(s) of interest", rect_count);
+    }
+    nvs_close(handle);
+}
+
+int roi_get(roi_rect_t *out, int max)
+{
+    portENTER_CRITICAL(&rect_lock);
+    int count = rect_count;
+    if (out) {
+        memcpy(out, rects, std::min(count, max) * sizeof(roi_rect_t));
+    }
+    portEXIT_CRITICAL(&rect_lock);
+    return count;
+}
+
+esp_err_t roi_set(const roi_rect_t *new_rects, int count)
+{
+    if (!rects_valid(new_rects, count)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    roi_blob_t blob = {};
+    blob.count = count;
+    memcpy(blob.rects, new_rects, count * sizeof(roi_rect_t));
+
+    portENTER_CRITICAL(&rect_lock);
+    memcpy(rects, blob.rects, sizeof(rects));
+    rect_count = count;
+    portEXIT_CRITICAL(&rect_lock);
+
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(nvs_namespace, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = nvs_set_blob(handle, nvs_key, &blob, sizeof(blob));
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Regions applied but not saved (%s)", esp_err_to_name(err));
+    }
+    ESP_LOGI(TAG, "%d region(s) of interest set", count);
+    return ESP_OK;
+}
+
+float roi_box_iou(const int a[4], const int b[4])
+{
+    int w = std::min(a[2], b[2]) - std::max(a[0], b[0]);
+    int h = std::min(a[3], b[3]) - std::max(a[1], b[1]);
+    if (w <= 0 || h <= 0) {
+        return 0.0f;
+    }
+    float inter = (float)w * h;
+    float area_a = (float)(a[2] - a[0]) * (a[3] - a[1]);
+    float area_b = (float)(b[2] - b[0]) * (b[3] - b[1]);
+    return inter / (area_a + area_b - inter);
+}
+
+float roi_box_containment(const int a[4], const int b[4])
+{
+    int w = std::min(a[2], b[2]) - std::max(a[0], b[0]);
+    int h = std::min(a[3], b[3]) - std::max(a[1], b[1]);
+    if (w <= 0 || h <= 0) {
+        return 0.0f;
+    }
+    float area_a = (float)(a[2] - a[0]) * (a[3] - a[1]);
+    float area_b = (float)(b[2] - b[0]) * (b[3] - b[1]);
+    return (float)w * h / std::min(area_a, area_b);
+}
+
+void roi_free_crops(roi_crop_t *crops, int count)
+{
+    for (int i = 0; i < count; i++) {
+        heap_caps_free(crops[i].rgb);
+        crops[i].rgb = NULL;
+    }
+}
+
+#if !CONFIG_IDF_TARGET_LINUX
+// State of one partial decode, shared by the decoder callbacks
+typedef struct {
+    const uint8_t *jpg;
+    size_t len;
+    const roi_rect_t *rects;  // Requested regions
+    int rect_count;
+    int overview_scale;       // 0 for no overview
+    roi_crop_t *crops;
+    int crop_count;
+    uint32_t done_mask;       // Crops reported complete
+    roi_crop_done_fn_t done;
+    void *done_arg;
+    int stop_y;    // First frame row no crop needs
+    bool stopped;  // Decoding was stopped at stop_y on purpose
+    bool failed;   // Out of memory while laying out the crops
+} roi_decoder_t;
+
+static size_t roi_reader(void *arg, size_t index, uint8_t *buf, size_t len)
+{
+    roi_decoder_t *dec = (roi_decoder_t *)arg;
+    if (index >= dec->len) {
+        return 0;
+    }
+    len = std::min(len, dec->len - index);
+    if (buf) {
+        memcpy(buf, dec->jpg + index, len);
+    }
+    return len;
+}
+
+static inline int align_down(int v)
+{
+    return v & ~(ROI_ALIGN - 1);
+}
+
+static inline int align_up(int v)
+{
+    return (v + ROI_ALIGN - 1) & ~(ROI_ALIGN - 1);
+}
+
+// Called once the frame size is known: clip the regions to the frame, widen
+// them to whole MCUs and allocate their pixels
+static bool roi_layout(roi_decoder_t *dec, int frame_w, int frame_h)
+{
+    dec->stop_y = 0;
+    for (int i = 0; i < dec->rect_count; i++) {
+        const roi_rect_t *r = &dec->rects[i];
+        int x1 = align_down(r->x);
+        int y1 = align_down(r->y);
+        int x2 = std::min(align_up(r->x + r->w), frame_w);
+        int y2 = std::min(align_up(r->y + r->h), frame_h);
+        if (x2 <= x1 || y2 <= y1) {
+            continue;
+        }
+        roi_crop_t *c = &dec->crops[dec->crop_count];
+        c->rect = {(uint16_t)x1, (uint16_t)y1, (uint16_t)(x2 - x1), (uint16_t)(y2 - y1)};
+        c->scale = 1;
+        c->rgb = (uint8_t *)heap_caps_malloc((size_t)c->rect.w * c->rect.h * 3, MALLOC_CAP_SPIRAM);
+        if (!c->rgb) {
+            dec->failed = true;
+            return false;
+        }
+        dec->crop_count++;
+        dec->stop_y = std::max(dec->stop_y, y2);
+    }
+    if (dec->overview_scale > 1) {
+        roi_crop_t *c = &dec->crops[dec->crop_count];
+        c->rect = {0, 0, (uint16_t)frame_w, (uint16_t)frame_h};
+        c->scale = dec->overview_scale;
+        c->rgb = (uint8_t *)heap_caps_malloc((size_t)(frame_w / c->scale) * (frame_h / c->scale) * 3,
+                                             MALLOC_CAP_SPIRAM);
+        if (!c->rgb) {
+            dec->failed = true;
+            return false;
+        }
+        dec->crop_count++;
+        dec->stop_y = frame_h;
+    }
+    return true;
+}
+
+// Every other pixel of every other row of a block for a scale of 2, and so on
+static void roi_sample(roi_crop_t *c, uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *data)
+{
+    int s = c->scale;
+    int out_w = c->rect.w / s;
+    int out_h = c->rect.h / s;
+    for (int row = (y + s - 1) / s * s; row < y + h && row / s < out_h; row += s) {
+        uint8_t *dst = c->rgb + (size_t)(row / s) * out_w * 3;
+        for (int col = (x + s - 1) / s * s; col < x + w && col / s < out_w; col += s) {
+            memcpy(dst + (col / s) * 3, data + ((size_t)(row - y) * w + (col - x)) * 3, 3);
+        }
+    }
+}
+
+// Report the crops this block completed: blocks arrive left to right, top to bottom
+static void roi_report(roi_decoder_t *dec, uint16_t x, uint16_t y, uint16_t w, uint16_t h)
+{
+    for (int i = 0; dec->done && i < dec->crop_count; i++) {
+        const roi_rect_t *r = &dec->crops[i].rect;
+        if (!(dec->done_mask & (1u << i)) && y + h >= r->y + r->h && x + w >= r->x + r->w) {
+            dec->done_mask |= 1u << i;
+            dec->done(i, dec->done_arg);
+        }
+    }
+}
+
+// Receives one decoded block of RGB888 pixels at a time, top to bottom
+static bool roi_writer(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data)
+{
+    roi_decoder_t *dec = (roi_decoder_t *)arg;
+    if (!data) {
+        // Start of the frame carries its size, the end has nothing to do
+        return (x == 0 && y == 0) ? roi_layout(dec, w, h) : true;
+    }
+    if (y >= dec->stop_y) {
+        dec->stopped = true;
+        return false;
+    }
+
+    for (int i = 0; i < dec->crop_count; i++) {
+        roi_crop_t *c = &dec->crops[i];
+        if (c->scale > 1) {
+            roi_sample(c, x, y, w, h, data);
+            continue;
+        }
+        int x1 = std::max((int)x, (int)c->rect.x);
+        int x2 = std::min(x + w, c->rect.x + c->rect.w);
+        int y1 = std::max((int)y, (int)c->rect.y);
+        int y2 = std::min(y + h, c->rect.y + c->rect.h);
+        if (x2 <= x1 || y2 <= y1) {
+            continue;
+        }
+        for (int row = y1; row < y2; row++) {
+            memcpy(c->rgb + ((size_t)(row - c->rect.y) * c->rect.w + (x1 - c->rect.x)) * 3,
+                   data + ((size_t)(row - y) * w + (x1 - x)) * 3, (x2 - x1) * 3);
+        }
+    }
+    roi_report(dec, x, y, w, h);
+    return true;
+}
+
+int roi_decode_rects(const uint8_t *jpg, size_t len, const roi_rect_t *rects, int count, int overview_scale,
+                     roi_crop_t *crops, roi_crop_done_fn_t done, void *arg)
+{
+    roi_decoder_t dec = {};
+    dec.jpg = jpg;
+    dec.len = len;
+    dec.crops = crops;
+    dec.rects = rects;
+    dec.rect_count = std::min(count, ROI_DECODE_MAX_RECTS);
+    dec.overview_scale = overview_scale;
+    dec.done = done;
+    dec.done_arg = arg;
+    for (int i = 0; i < dec.rect_count + (overview_scale > 1); i++) {
+        crops[i].rgb = NULL;
+    }
+
+    // Stopping the decoder below the last region is reported as an error by it, so
+    // its log is muted for this decode only; real failures are logged below
+    esp_log_level_t log_level = esp_log_level_get("esp_jpg_decode");
+    esp_log_level_set("esp_jpg_decode", ESP_LOG_NONE);
+    esp_err_t err = esp_jpg_decode(len, JPG_SCALE_NONE, roi_reader, roi_writer, &dec);
+    esp_log_level_set("esp_jpg_decode", log_level);
+    if (dec.failed || (err != ESP_OK && !dec.stopped)) {
+        ESP_LOGE(TAG, "%s", dec.failed ? "Out of memory for region crops" : "Failed to decode JPEG");
+        if (!done) {
+            roi_free_crops(crops, dec.crop_count);
+        }
+        return -1;
+    }
+    // Crops whose last block ended exactly on the frame edge
+    for (int i = 0; done && i < dec.crop_count; i++) {
+        if (!(dec.done_mask & (1u << i))) {
+            done(i, arg);
+        }
+    }
+    return dec.crop_count;
+}
+
+int roi_decode_jpeg(const uint8_t *jpg, size_t len, roi_crop_t *crops)
+{
+    roi_rect_t configured[ROI_MAX_COUNT];
+    int count = roi_get(configured, ROI_MAX_COUNT);
+    return roi_decode_rects(jpg, len, configured, count, 0, crops, NULL, NULL);
+}
+#endif
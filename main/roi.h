@@ -0,0 +1,74 @@
+#ifndef ROI_H
+#define ROI_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+#define ROI_MAX_COUNT 4
+#define ROI_ALIGN 16   // Largest JPEG MCU (4:2:0), crops are widened to whole MCUs
+#define ROI_DECODE_MAX_RECTS 16  // Rectangles one roi_decode_rects call can crop
+
+// Rectangle in frame pixels
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+} roi_rect_t;
+
+// One decoded region of interest
+typedef struct {
+    roi_rect_t rect;   // Frame coordinates, MCU aligned and clipped to the frame
+    uint8_t *rgb;      // RGB888, (rect.w / scale) * (rect.h / scale) * 3 bytes in PSRAM
+    uint8_t scale;     // 1, or the downscale of an overview
+} roi_crop_t;
+
+// Called by roi_decode_rects on the decoding task once crops[index] is complete
+typedef void (*roi_crop_done_fn_t)(int index, void *arg);
+
+// Load the saved regions from NVS
+void roi_init(void);
+
+// Copy up to max configured regions into out (which may be NULL), returns how many are configured.
+// No regions means the whole frame is scanned.
+int roi_get(roi_rect_t *out, int max);
+
+// Replace the regions and save them, count 0 clears them
+esp_err_t roi_set(const roi_rect_t *rects, int count);
+
+// Decode only the configured regions of a JPEG frame into crops (ROI_MAX_COUNT entries).
+// Rows below the lowest region are not decoded at all.
+// Returns the number of crops, 0 if no region overlaps the frame (the caller
+// decodes the whole frame then), -1 on error. Free the crops with roi_free_crops.
+int roi_decode_jpeg(const uint8_t *jpg, size_t len, roi_crop_t *crops);
+
+// Decode any count rectangles (at most ROI_DECODE_MAX_RECTS, may overlap) of a
+// JPEG frame into crops in one pass. With overview_scale above 1 the whole frame
+// is also sampled down by that factor into crops[count], so crops needs count + 1
+// entries. done, if not NULL, is told about each crop as soon as its last pixel is
+// decoded, so it can be processed while the rest of the frame is still decoding.
+// Returns the number of crops, or -1 on error. Without done the crops are freed
+// on error; with done some may already be in use, so they are left to the
+// caller to free with roi_free_crops(crops, count + 1) once nobody reads them,
+// entries that were never allocated being NULL.
+int roi_decode_rects(const uint8_t *jpg, size_t len, const roi_rect_t *rects, int count, int overview_scale,
+                     roi_crop_t *crops, roi_crop_done_fn_t done, void *arg);
+
+void roi_free_crops(roi_crop_t *crops, int count);
+
+// Intersection over union of two boxes [x1, y1, x2, y2]
+float roi_box_iou(const int a[4], const int b[4]);
+
+// Intersection over the area of the smaller of two boxes [x1, y1, x2, y2]
+float roi_box_containment(const int a[4], const int b[4]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // ROI_H
@@ -0,0 +1,213 @@
+#include "telemetry.h"
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
+
+static const char *TAG = "telemetry";
+
+static const char *subsys_names[TELEMETRY_SUBSYS_COUNT] = {
+    "other", "decode", "detect", "recognize", "http", "notify",
+};
+
+static const char *heap_names[TELEMETRY_HEAP_COUNT] = {
+    "internal", "spiram", "dma",
+};
+
+static const uint32_t heap_caps[TELEMETRY_HEAP_COUNT] = {
+    MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT,
+    MALLOC_CAP_SPIRAM,
+    MALLOC_CAP_DMA,
+};
+
+// Subsystem of the running task, read by the allocation hooks
+static __thread uint8_t current_subsys = TELEMETRY_SUBSYS_OTHER;
+
+// Written from the allocation hooks on both cores, so a spinlock that is also
+// safe from ISRs protects the 64-bit byte counters
+static DRAM_ATTR telemetry_subsys_stats_t subsys_stats[TELEMETRY_SUBSYS_COUNT];
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static telemetry_snapshot_t snapshot;
+static SemaphoreHandle_t snapshot_mutex = NULL;
+
+// Free bytes per heap at the last TELEMETRY_HISTORY samples, for the trend
+static size_t history_free[TELEMETRY_HISTORY][TELEMETRY_HEAP_COUNT];
+static int64_t history_time[TELEMETRY_HISTORY];
+static int history_count = 0;
+static int history_next = 0;
+
+telemetry_subsys_t telemetry_enter(telemetry_subsys_t subsys)
+{
+    telemetry_subsys_t previous = (telemetry_subsys_t)current_subsys;
+    current_subsys = (uint8_t)subsys;
+    return previous;
+}
+
+void telemetry_exit(telemetry_subsys_t previous)
+{
+    current_subsys = (uint8_t)previous;
+}
+
+#if CONFIG_HEAP_USE_HOOKS
+// Called by the heap component for every allocation and free
+extern "C" IRAM_ATTR void esp_heap_trace_alloc_hook(void *ptr, size_t size, uint32_t caps)
+{
+    telemetry_subsys_stats_t *s = &subsys_stats[current_subsys];
+    portENTER_CRITICAL_SAFE(&stats_lock);
+    s->allocs++;
+    s->alloc_bytes += size;
+    portEXIT_CRITICAL_SAFE(&stats_lock);
+}
+
+extern "C" IRAM_ATTR void esp_heap_trace_free_hook(void *ptr)
+{
+    telemetry_subsys_stats_t *s = &subsys_stats[current_subsys];
+    portENTER_CRITICAL_SAFE(&stats_lock);
+    s->frees++;
+    portEXIT_CRITICAL_SAFE(&stats_lock);
+}
+#endif
+
+static void alloc_failed_hook(size_t size, uint32_t caps, const char *function_name)
+{
+    telemetry_subsys_stats_t *s = &subsys_stats[current_subsys];
+    portENTER_CRITICAL_SAFE(&stats_lock);
+    s->failed++;
+    portEXIT_CRITICAL_SAFE(&stats_lock);
+    ESP_EARLY_LOGW(TAG, "%s failed: %u bytes, caps 0x%lx (%s)", function_name, (unsigned)size,
+                   (unsigned long)caps, subsys_names[current_subsys]);
+}
+
+static int sample_tasks(telemetry_task_t *out)
+{
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    UBaseType_t capacity = uxTaskGetNumberOfTasks() + 4;
+    TaskStatus_t *status = (TaskStatus_t *)malloc(capacity * sizeof(TaskStatus_t));
+    if (status == NULL) {
+        return 0;
+    }
+    int n = uxTaskGetSystemState(status, capacity, NULL);
+
+    // Keep the tasks closest to overflowing their stack if there are too many
+    std::sort(status, status + n, [](const TaskStatus_t &a, const TaskStatus_t &b) {
+        return a.usStackHighWaterMark < b.usStackHighWaterMark;
+    });
+    n = std::min(n, TELEMETRY_MAX_TASKS);
+    for (int i = 0; i < n; i++) {
+        snprintf(out[i].name, sizeof(out[i].name), "%s", status[i].pcTaskName);
+        out[i].priority = status[i].uxCurrentPriority;
+        out[i].stack_free_min = status[i].usStackHighWaterMark * sizeof(StackType_t);
+#if CONFIG_FREERTOS_VTASKLIST_INCLUDE_COREID
+        out[i].core = status[i].xCoreID == tskNO_AFFINITY ? -1 : (int)status[i].xCoreID;
+#else
+        out[i].core = -1;
+#endif
+    }
+    free(status);
+    return n;
+#else
+    return 0;
+#endif
+}
+
+static void sample_heaps(telemetry_heap_t *out, int64_t now)
+{
+    for (int k = 0; k < TELEMETRY_HEAP_COUNT; k++) {
+        memset(&out[k], 0, sizeof(out[k]));
+#if !CONFIG_IDF_TARGET_LINUX
+        multi_heap_info_t info;
+        heap_caps_get_info(&info, heap_caps[k]);
+        out[k].total = heap_caps_get_total_size(heap_caps[k]);
+        out[k].free = info.total_free_bytes;
+        out[k].min_free = info.minimum_free_bytes;
+        out[k].largest_free_block = info.largest_free_block;
+        out[k].free_blocks = info.free_blocks;
+        out[k].fragmentation = info.total_free_bytes ?
+            1.0f - (float)info.largest_free_block / info.total_free_bytes : 0.0f;
+#endif
+        history_free[history_next][k] = out[k].free;
+    }
+    history_time[history_next] = now;
+    history_next = (history_next + 1) % TELEMETRY_HISTORY;
+    history_count = std::min(history_count + 1, TELEMETRY_HISTORY);
+
+    // Slope between the oldest and newest sample in the window
+    if (history_count > 1) {
+        int oldest = (history_next - history_count + TELEMETRY_HISTORY) % TELEMETRY_HISTORY;
+        int newest = (history_next - 1 + TELEMETRY_HISTORY) % TELEMETRY_HISTORY;
+        int64_t span_us = history_time[newest] - history_time[oldest];
+        for (int k = 0; span_us > 0 && k < TELEMETRY_HEAP_COUNT; k++) {
+            int64_t delta = (int64_t)history_free[newest][k] - (int64_t)history_free[oldest][k];
+            out[k].trend_per_min = (int32_t)(delta * 60000000LL / span_us);
+        }
+    }
+}
+
+static void telemetry_task(void *arg)
+{
+    static telemetry_snapshot_t sample;
+
+    while (true) {
+        sample.timestamp_us = esp_timer_get_time();
+        sample.task_count = sample_tasks(sample.tasks);
+        sample_heaps(sample.heap, sample.timestamp_us);
+
+        xSemaphoreTake(snapshot_mutex, portMAX_DELAY);
+        memcpy(&snapshot, &sample, sizeof(snapshot));
+        xSemaphoreGive(snapshot_mutex);
+
+        vTaskDelay(pdMS_TO_TICKS(TELEMETRY_SAMPLE_INTERVAL_MS));
+    }
+}
+
+esp_err_t telemetry_init(void)
+{
+    snapshot_mutex = xSemaphoreCreateMutex();
+    if (snapshot_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+#if !CONFIG_IDF_TARGET_LINUX
+    heap_caps_register_failed_alloc_callback(alloc_failed_hook);
+#else
+    (void)alloc_failed_hook;
+    (void)heap_caps;
+#endif
+#if !CONFIG_HEAP_USE_HOOKS
+    ESP_LOGW(TAG, "CONFIG_HEAP_USE_HOOKS is off, per-subsystem allocation counts stay at zero");
+#endif
+
+    if (xTaskCreate(telemetry_task, "telemetry", 3072, NULL, 1, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create telemetry task");
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+void telemetry_get_snapshot(telemetry_snapshot_t *out)
+{
+    xSemaphoreTake(snapshot_mutex, portMAX_DELAY);
+    memcpy(out, &snapshot, sizeof(*out));
+    xSemaphoreGive(snapshot_mutex);
+
+    portENTER_CRITICAL_SAFE(&stats_lock);
+    memcpy(out->subsys, subsys_stats, sizeof(subsys_stats));
+    portEXIT_CRITICAL_SAFE(&stats_lock);
+}
+
+const char *telemetry_subsys_name(telemetry_subsys_t subsys)
+{
+    return subsys < TELEMETRY_SUBSYS_COUNT ? subsys_names[subsys] : "?";
+}
+
+const char *telemetry_heap_name(telemetry_heap_kind_t kind)
+{
+    return kind < TELEMETRY_HEAP_COUNT ? heap_names[kind] : "?";
+}
@@ -0,0 +1,91 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Memory telemetry: per-task stack high-water marks, heap usage and
+// fragmentation per capability, and allocation counts per subsystem. A low
+// priority task samples everything every TELEMETRY_SAMPLE_INTERVAL_MS.
+//
+// Allocations are attributed through heap hooks (CONFIG_HEAP_USE_HOOKS) to the
+// subsystem the allocating task is currently in, so allocations made inside
+// esp-dl or the HTTP client are counted too.
+
+#define TELEMETRY_SAMPLE_INTERVAL_MS 5000
+#define TELEMETRY_MAX_TASKS 24
+#define TELEMETRY_HISTORY 12  // Samples kept for the free-memory trend
+
+typedef enum {
+    TELEMETRY_SUBSYS_OTHER = 0,
+    TELEMETRY_SUBSYS_DECODE,
+    TELEMETRY_SUBSYS_DETECT,
+    TELEMETRY_SUBSYS_RECOGNIZE,
+    TELEMETRY_SUBSYS_HTTP,
+    TELEMETRY_SUBSYS_NOTIFY,
+    TELEMETRY_SUBSYS_COUNT
+} telemetry_subsys_t;
+
+typedef struct {
+    char name[16];
+    uint32_t priority;
+    int core;                // -1 if not pinned
+    uint32_t stack_free_min; // Stack high-water mark in bytes (least free ever)
+} telemetry_task_t;
+
+typedef struct {
+    size_t total;
+    size_t free;
+    size_t min_free;            // Lowest free since boot
+    size_t largest_free_block;
+    size_t free_blocks;
+    float fragmentation;        // 1 - largest_free_block / free
+    int32_t trend_per_min;      // Change of free bytes per minute over the history window
+} telemetry_heap_t;
+
+typedef enum {
+    TELEMETRY_HEAP_INTERNAL = 0,
+    TELEMETRY_HEAP_SPIRAM,
+    TELEMETRY_HEAP_DMA,
+    TELEMETRY_HEAP_COUNT
+} telemetry_heap_kind_t;
+
+typedef struct {
+    uint32_t allocs;
+    uint32_t frees;
+    uint64_t alloc_bytes;
+    uint32_t failed;
+} telemetry_subsys_stats_t;
+
+typedef struct {
+    int64_t timestamp_us;
+    int task_count;
+    telemetry_task_t tasks[TELEMETRY_MAX_TASKS];
+    telemetry_heap_t heap[TELEMETRY_HEAP_COUNT];
+    telemetry_subsys_stats_t subsys[TELEMETRY_SUBSYS_COUNT];
+} telemetry_snapshot_t;
+
+// Install the allocation hooks and start the sampling task
+esp_err_t telemetry_init(void);
+
+// Attribute the calling task's allocations to subsys until telemetry_exit.
+// Returns the previous subsystem, which telemetry_exit restores; scopes nest.
+telemetry_subsys_t telemetry_enter(telemetry_subsys_t subsys);
+void telemetry_exit(telemetry_subsys_t previous);
+
+// Copy of the latest sample (subsystem counters are read live)
+void telemetry_get_snapshot(telemetry_snapshot_t *out);
+
+const char *telemetry_subsys_name(telemetry_subsys_t subsys);
+const char *telemetry_heap_name(telemetry_heap_kind_t kind);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TELEMETRY_H
@@ -0,0 +1,81 @@
+#include "trace.h"
+#include <string.h>
+#include <atomic>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_attr.h"
+
+static const char *stage_names[TRACE_STAGE_COUNT] = {
+    "capture", "decode", "detect", "recognize", "publish", "notify", "frame",
+};
+
+// Writers claim a slot with one atomic increment and mark it complete by
+// storing its generation last. Readers skip slots whose generation does not
+// match the position they expect, which covers both torn and overwritten slots.
+static EXT_RAM_BSS_ATTR trace_record_t ring[TRACE_RING_SIZE];
+static std::atomic<uint32_t> ring_head{0};
+
+static __thread uint32_t current_frame = 0;
+
+void trace_set_frame(uint32_t frame_seq)
+{
+    current_frame = frame_seq;
+}
+
+uint32_t trace_get_frame(void)
+{
+    return current_frame;
+}
+
+void trace_span_frame(uint32_t frame_seq, trace_stage_t stage, int64_t start_us, int64_t end_us)
+{
+    uint32_t pos = ring_head.fetch_add(1, std::memory_order_relaxed);
+    trace_record_t *rec = &ring[pos & (TRACE_RING_SIZE - 1)];
+
+    __atomic_store_n(&rec->gen, 0, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+    rec->start_us = start_us;
+    rec->dur_us = end_us > start_us ? (uint32_t)(end_us - start_us) : 0;
+    rec->frame_seq = frame_seq;
+    rec->stage = (uint8_t)stage;
+    rec->core = (uint8_t)xPortGetCoreID();
+    __atomic_store_n(&rec->gen, pos + 1, __ATOMIC_RELEASE);
+}
+
+void trace_span(trace_stage_t stage, int64_t start_us, int64_t end_us)
+{
+    trace_span_frame(current_frame, stage, start_us, end_us);
+}
+
+int64_t trace_fb_capture_us(const camera_fb_t *fb)
+{
+    return (int64_t)fb->timestamp.tv_sec * 1000000LL + fb->timestamp.tv_usec;
+}
+
+int trace_read(trace_record_t *out, int max)
+{
+    uint32_t head = ring_head.load(std::memory_order_acquire);
+    uint32_t count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+    if (count > (uint32_t)max) {
+        count = max;
+    }
+
+    int n = 0;
+    for (uint32_t pos = head - count; pos != head; pos++) {
+        const trace_record_t *rec = &ring[pos & (TRACE_RING_SIZE - 1)];
+        if (__atomic_load_n(&rec->gen, __ATOMIC_ACQUIRE) != pos + 1) {
+            continue;
+        }
+        memcpy(&out[n], rec, sizeof(*rec));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (__atomic_load_n(&rec->gen, __ATOMIC_RELAXED) == pos + 1) {
+            n++;
+        }
+    }
+    return n;
+}
+
+const char *trace_stage_name(trace_stage_t stage)
+{
+    return stage < TRACE_STAGE_COUNT ? stage_names[stage] : "?";
+}
@@ -0,0 +1,71 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_timer.h"
+#include "esp_camera.h"
+
+// Pipeline latency tracing. Every recognition frame gets a sequence number that
+// the recognition task sets as the current trace frame; the time spent in each
+// stage is recorded as a span into a fixed ring buffer in PSRAM and can be
+// exported as Chrome trace-event JSON (chrome://tracing, Perfetto).
+//
+// Recording a span is one atomic increment and a 24-byte store, lock-free from
+// any task.
+
+#define TRACE_RING_SIZE 1024  // Power of two
+
+typedef enum {
+    TRACE_STAGE_CAPTURE = 0,  // Sensor capture timestamp until the frame reached the application
+    TRACE_STAGE_DECODE,
+    TRACE_STAGE_DETECT,
+    TRACE_STAGE_RECOGNIZE,    // Embedding and template match
+    TRACE_STAGE_PUBLISH,
+    TRACE_STAGE_NOTIFY,
+    TRACE_STAGE_FRAME,        // Sensor capture until the result was published
+    TRACE_STAGE_COUNT
+} trace_stage_t;
+
+typedef struct {
+    int64_t start_us;
+    uint32_t dur_us;
+    uint32_t frame_seq;
+    uint32_t gen;    // Ring position + 1 once the record is complete
+    uint8_t stage;
+    uint8_t core;
+    uint8_t reserved[2];
+} trace_record_t;
+
+static inline int64_t trace_now(void)
+{
+    return esp_timer_get_time();
+}
+
+// Frame the calling task is working on (0 for work outside the recognition pipeline)
+void trace_set_frame(uint32_t frame_seq);
+uint32_t trace_get_frame(void);
+
+// Record a span for the calling task's current frame
+void trace_span(trace_stage_t stage, int64_t start_us, int64_t end_us);
+
+// Record a span for an explicit frame
+void trace_span_frame(uint32_t frame_seq, trace_stage_t stage, int64_t start_us, int64_t end_us);
+
+// Sensor capture time of a frame buffer on the esp_timer clock
+int64_t trace_fb_capture_us(const camera_fb_t *fb);
+
+// Copy up to max complete records, oldest first. Returns the number copied.
+int trace_read(trace_record_t *out, int max);
+
+const char *trace_stage_name(trace_stage_t stage);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TRACE_H
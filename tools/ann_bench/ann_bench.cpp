@@ -0,0 +1,228 @@
+// Host benchmark of the face index (face_index.cpp): recall and latency of
+// IVF-PQ search against an exact scan, on synthetic identity galleries.
+//
+// Each identity is a random point on a low-dimensional subspace of the embedding
+// space, as real face embeddings are far from uniform. Its gallery template and
+// the query are two noisy captures of it, about 0.7 similar to each other. Recall
+// is the share of queries whose best match from the index is the exact best match.
+//
+// Build and run from the repository root:
+//     g++ -std=c++20 -O2 -march=native -Itools/ann_bench/host -Itools/ann_bench tools/ann_bench/ann_bench.cpp tools/ann_bench/face_index.cpp -o ann_bench
+//     ./ann_bench                      # 1k, 10k and 50k identities
+//     ./ann_bench --queries 500 20000  # other gallery sizes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include <algorithm>
+#include "face_index.h"
+
+#define DIM 512
+#define LATENT_DIM 64        // Dimension of the identity subspace
+#define CAPTURE_NOISE 0.55f  // Per-capture noise, relative to the unit identity vector
+#define SUBSPACES 32         // 16 dimensions per code byte
+#define RERANK 32
+#define MAX_TRAIN 8192       // Training samples, the gallery is subsampled beyond this
+
+static const int nprobes[] = {1, 2, 4, 8, 16, 32};
+
+static double now_us(void)
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double, std::micro>>(steady_clock::now().time_since_epoch()).count();
+}
+
+static void normalize(float *v)
+{
+    float norm = 0.0f;
+    for (int i = 0; i < DIM; i++) {
+        norm += v[i] * v[i];
+    }
+    norm = 1.0f / sqrtf(norm);
+    for (int i = 0; i < DIM; i++) {
+        v[i] *= norm;
+    }
+}
+
+static float dot(const float *a, const float *b)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < DIM; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+// Identity centers and two noisy captures of every one: gallery templates and queries
+static void make_gallery(int n, int n_queries, std::vector<float> &gallery, std::vector<float> &queries,
+                         std::vector<int> &query_ids)
+{
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> gauss(0.0f, 1.0f);
+    std::vector<float> basis((size_t)DIM * LATENT_DIM);
+    for (float &x : basis) {
+        x = gauss(rng);
+    }
+
+    std::vector<float> center(DIM);
+    gallery.assign((size_t)n * DIM, 0.0f);
+    queries.assign((size_t)n_queries * DIM, 0.0f);
+    query_ids.resize(n_queries);
+    for (int q = 0; q < n_queries; q++) {
+        query_ids[q] = (int)((size_t)q * n / n_queries);
+    }
+
+    float sigma = CAPTURE_NOISE / sqrtf(DIM);
+    int next_query = 0;
+    for (int id = 0; id < n; id++) {
+        float z[LATENT_DIM];
+        for (float &x : z) {
+            x = gauss(rng);
+        }
+        for (int i = 0; i < DIM; i++) {
+            center[i] = 0.0f;
+            for (int j = 0; j < LATENT_DIM; j++) {
+                center[i] += basis[(size_t)i * LATENT_DIM + j] * z[j];
+            }
+        }
+        normalize(center.data());
+
+        float *tmpl = &gallery[(size_t)id * DIM];
+        for (int i = 0; i < DIM; i++) {
+            tmpl[i] = center[i] + sigma * gauss(rng);
+        }
+        normalize(tmpl);
+        while (next_query < n_queries && query_ids[next_query] == id) {
+            float *query = &queries[(size_t)next_query++ * DIM];
+            for (int i = 0; i < DIM; i++) {
+                query[i] = center[i] + sigma * gauss(rng);
+            }
+            normalize(query);
+        }
+    }
+}
+
+static const float *gallery_row(int key, void *arg)
+{
+    return (const float *)arg + (size_t)key * DIM;
+}
+
+static void run(int n, int n_queries)
+{
+    std::vector<float> gallery;
+    std::vector<float> queries;
+    std::vector<int> query_ids;
+    make_gallery(n, n_queries, gallery, queries, query_ids);
+
+    // Exact scan: the ground truth and the baseline latency
+    std::vector<int> truth(n_queries);
+    int correct = 0;
+    double start = now_us();
+    for (int q = 0; q < n_queries; q++) {
+        const float *query = &queries[(size_t)q * DIM];
+        float best = -2.0f;
+        for (int id = 0; id < n; id++) {
+            float sim = dot(query, &gallery[(size_t)id * DIM]);
+            if (sim > best) {
+                best = sim;
+                truth[q] = id;
+            }
+        }
+        correct += truth[q] == query_ids[q];
+    }
+    double scan_us = (now_us() - start) / n_queries;
+
+    face_index_config_t config = {
+        .dim = DIM,
+        .max_keys = n,
+        .lists = std::max(4, std::min(FACE_INDEX_MAX_LISTS, (int)lround(sqrt(n)))),
+        .subspaces = SUBSPACES,
+        .nprobe = 1,
+        .rerank = RERANK,
+    };
+    face_index_t *index = face_index_create(&config);
+    if (!index) {
+        fprintf(stderr, "face_index_create failed\n");
+        exit(1);
+    }
+
+    // Train on a subsample spread over the gallery
+    int n_train = std::min(n, MAX_TRAIN);
+    std::vector<float> train((size_t)n_train * DIM);
+    for (int i = 0; i < n_train; i++) {
+        memcpy(&train[(size_t)i * DIM], &gallery[(size_t)i * n / n_train * DIM], DIM * sizeof(float));
+    }
+    start = now_us();
+    if (face_index_train(index, train.data(), n_train) != ESP_OK) {
+        fprintf(stderr, "face_index_train failed\n");
+        exit(1);
+    }
+    double train_ms = (now_us() - start) / 1000.0;
+    start = now_us();
+    for (int id = 0; id < n; id++) {
+        face_index_insert(index, id, &gallery[(size_t)id * DIM]);
+    }
+    double insert_us = (now_us() - start) / n;
+
+    printf("\n%d identities, %d lists, %d-byte codes: train %.0f ms, insert %.1f us each\n", n, config.lists,
+           SUBSPACES, train_ms, insert_us);
+    printf("memory: %zu KB index vs %zu KB float templates\n", face_index_memory(index) / 1024,
+           (size_t)n * DIM * sizeof(float) / 1024);
+    printf("exact scan: %8.1f us/query, top-1 is the right identity for %.1f%%\n", scan_us,
+           100.0 * correct / n_queries);
+    printf("%7s %12s %10s %10s\n", "nprobe", "us/query", "speedup", "recall@1");
+    for (int nprobe : nprobes) {
+        if (nprobe > config.lists) {
+            break;
+        }
+        face_index_set_nprobe(index, nprobe);
+        int hits = 0;
+        start = now_us();
+        for (int q = 0; q < n_queries; q++) {
+            int key;
+            float score;
+            if (face_index_search(index, &queries[(size_t)q * DIM], gallery_row, gallery.data(), &key, &score, 1) &&
+                key == truth[q]) {
+                hits++;
+            }
+        }
+        double us = (now_us() - start) / n_queries;
+        printf("%7d %12.1f %9.1fx %9.1f%%\n", nprobe, us, scan_us / us, 100.0 * hits / n_queries);
+    }
+
+    // Deletes follow enrollment changes without retraining
+    for (int id = 0; id < n; id += 2) {
+        face_index_remove(index, id);
+    }
+    face_index_reclaim(index);
+    printf("after removing every other identity: %d keys, %zu KB\n", face_index_count(index),
+           face_index_memory(index) / 1024);
+    face_index_destroy(index);
+}
+
+int main(int argc, char **argv)
+{
+    int n_queries = 200;
+    std::vector<int> sizes;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--queries") == 0 && i + 1 < argc) {
+            n_queries = atoi(argv[++i]);
+        } else if (atoi(argv[i]) > 0) {
+            sizes.push_back(atoi(argv[i]));
+        } else {
+            fprintf(stderr, "usage: %s [--queries N] [identities ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (sizes.empty()) {
+        sizes = {1000, 10000, 50000};
+    }
+    for (int n : sizes) {
+        run(n, std::min(n_queries, n));
+    }
+    return 0;
+}
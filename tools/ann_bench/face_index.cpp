@@ -0,0 +1,458 @@
+#include "face_index.h"
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <new>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "esp_heap_caps.h"
+
+#define FACE_INDEX_TRAIN_ITERS 10
+#define FACE_INDEX_MIN_LIST_CAPACITY 8
+#define FACE_INDEX_MAX_DSUB 64           // Dimensions per subspace
+
+// One partition: keys and codes for capacity entries in a single allocation.
+// Entries below count are published; a removed entry keeps its slot with key -1
+// until the partition is rebuilt.
+typedef struct {
+    int capacity;
+    int count;
+    int dead;          // Removed entries below count, writer only
+    int32_t *keys;
+    uint8_t *codes;    // subspaces bytes per entry
+} index_list_t;
+
+struct face_index {
+    face_index_config_t config;
+    int dsub;                                  // Dimensions per subspace
+    int ksub;                                  // Centroids per subspace
+    bool trained;
+    std::atomic<int> nprobe;
+    float *centroids;                          // lists x dim
+    float *codebooks;                          // subspaces x ksub x dsub
+    std::atomic<index_list_t *> *lists;
+    int16_t *key_list;                         // Partition of every key, -1 if not indexed
+    int32_t *key_pos;                          // Entry of every key in its partition
+    int count;
+    std::vector<index_list_t *> garbage;       // Swapped out, freed by face_index_reclaim
+    float *scratch;                            // Lookup tables of one search, see scratch_size
+    mutable std::atomic<bool> scratch_busy;    // A search is using scratch
+};
+
+// Lookup table of the query against every codebook entry, the score of every
+// partition, and the partitions to scan
+static size_t scratch_size(const face_index_config_t *c)
+{
+    return ((size_t)c->subspaces * FACE_INDEX_CODEBOOK_SIZE + c->lists) * sizeof(float) +
+           c->lists * (sizeof(int) + sizeof(float));
+}
+
+static float dot(const float *a, const float *b, int len)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < len; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+static float distance2(const float *a, const float *b, int len)
+{
+    float sum = 0.0f;
+    for (int i = 0; i < len; i++) {
+        float d = a[i] - b[i];
+        sum += d * d;
+    }
+    return sum;
+}
+
+// Nearest of k centroids of len floats: by inner product for the normalized coarse
+// centroids, by L2 distance for the codebooks
+static int nearest(const float *x, const float *centroids, int k, int len, bool spherical)
+{
+    int best = 0;
+    float best_score = -FLT_MAX;
+    for (int c = 0; c < k; c++) {
+        const float *centroid = centroids + (size_t)c * len;
+        float score = spherical ? dot(x, centroid, len) : -distance2(x, centroid, len);
+        if (score > best_score) {
+            best_score = score;
+            best = c;
+        }
+    }
+    return best;
+}
+
+// Lloyd's k-means over n vectors of len floats that are stride floats apart,
+// starting from samples spread over the input. Spherical k-means keeps the
+// centroids normalized. A centroid that loses all its vectors keeps its place.
+static esp_err_t kmeans(const float *data, int n, int len, int stride, float *centroids, int k, bool spherical)
+{
+    float *sums = (float *)heap_caps_malloc((size_t)k * len * sizeof(float), MALLOC_CAP_SPIRAM);
+    int *sizes = (int *)heap_caps_malloc(k * sizeof(int), MALLOC_CAP_SPIRAM);
+    if (!sums || !sizes) {
+        heap_caps_free(sums);
+        heap_caps_free(sizes);
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int c = 0; c < k; c++) {
+        memcpy(centroids + (size_t)c * len, data + (size_t)c * n / k * stride, len * sizeof(float));
+    }
+    for (int iter = 0; iter < FACE_INDEX_TRAIN_ITERS; iter++) {
+        memset(sums, 0, (size_t)k * len * sizeof(float));
+        memset(sizes, 0, k * sizeof(int));
+        for (int i = 0; i < n; i++) {
+            const float *x = data + (size_t)i * stride;
+            int c = nearest(x, centroids, k, len, spherical);
+            float *sum = sums + (size_t)c * len;
+            for (int j = 0; j < len; j++) {
+                sum[j] += x[j];
+            }
+            sizes[c]++;
+        }
+        for (int c = 0; c < k; c++) {
+            if (sizes[c] == 0) {
+                continue;
+            }
+            float *centroid = centroids + (size_t)c * len;
+            const float *sum = sums + (size_t)c * len;
+            float scale = 1.0f / sizes[c];
+            if (spherical) {
+                float norm = sqrtf(dot(sum, sum, len));
+                scale = norm > 0.0f ? 1.0f / norm : 0.0f;
+            }
+            for (int j = 0; j < len; j++) {
+                centroid[j] = sum[j] * scale;
+            }
+        }
+    }
+
+    heap_caps_free(sums);
+    heap_caps_free(sizes);
+    return ESP_OK;
+}
+
+// Insert into a list of at most max entries, best first. Returns the new size.
+static int push_top(int *keys, float *scores, int n, int max, int key, float score)
+{
+    if (n == max && score <= scores[n - 1]) {
+        return n;
+    }
+    int i = n < max ? n++ : max - 1;
+    while (i > 0 && scores[i - 1] < score) {
+        keys[i] = keys[i - 1];
+        scores[i] = scores[i - 1];
+        i--;
+    }
+    keys[i] = key;
+    scores[i] = score;
+    return n;
+}
+
+static index_list_t *list_alloc(int capacity, int subspaces)
+{
+    size_t size = sizeof(index_list_t) + (size_t)capacity * (sizeof(int32_t) + subspaces);
+    index_list_t *list = (index_list_t *)heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (!list) {
+        return NULL;
+    }
+    list->capacity = capacity;
+    list->count = 0;
+    list->dead = 0;
+    list->keys = (int32_t *)(list + 1);
+    list->codes = (uint8_t *)(list->keys + capacity);
+    return list;
+}
+
+// Replace partition l with a copy of its live entries with room for capacity.
+// Searches still scanning the old copy keep it until face_index_reclaim.
+static index_list_t *list_rebuild(face_index_t *index, int l, int capacity)
+{
+    int m = index->config.subspaces;
+    index_list_t *old = index->lists[l].load(std::memory_order_relaxed);
+    index_list_t *list = list_alloc(capacity, m);
+    if (!list) {
+        return NULL;
+    }
+    for (int i = 0; old && i < old->count; i++) {
+        int32_t key = old->keys[i];
+        if (key < 0) {
+            continue;
+        }
+        memcpy(list->codes + (size_t)list->count * m, old->codes + (size_t)i * m, m);
+        list->keys[list->count] = key;
+        index->key_pos[key] = list->count++;
+    }
+    if (old) {
+        index->garbage.push_back(old);
+    }
+    index->lists[l].store(list, std::memory_order_release);
+    return list;
+}
+
+// Product-quantize the residual of vec to partition l
+static void encode(const face_index_t *index, int l, const float *vec, uint8_t *code)
+{
+    int dim = index->config.dim;
+    int dsub = index->dsub;
+    float residual[FACE_INDEX_MAX_DSUB];  // One subspace at a time
+    const float *centroid = index->centroids + (size_t)l * dim;
+    for (int m = 0; m < index->config.subspaces; m++) {
+        for (int j = 0; j < dsub; j++) {
+            residual[j] = vec[m * dsub + j] - centroid[m * dsub + j];
+        }
+        const float *codebook = index->codebooks + (size_t)m * index->ksub * dsub;
+        code[m] = (uint8_t)nearest(residual, codebook, index->ksub, dsub, false);
+    }
+}
+
+face_index_t *face_index_create(const face_index_config_t *config)
+{
+    const face_index_config_t *c = config;
+    if (c->dim <= 0 || c->subspaces <= 0 || c->dim % c->subspaces != 0 ||
+        c->dim / c->subspaces > FACE_INDEX_MAX_DSUB || c->lists <= 0 || c->lists > FACE_INDEX_MAX_LISTS ||
+        c->rerank <= 0 || c->rerank > FACE_INDEX_MAX_RERANK || c->max_keys <= 0) {
+        return NULL;
+    }
+
+    face_index_t *index = new (std::nothrow) face_index_t();
+    if (!index) {
+        return NULL;
+    }
+    index->config = *c;
+    face_index_set_nprobe(index, c->nprobe);
+    index->dsub = c->dim / c->subspaces;
+    index->centroids = (float *)heap_caps_malloc((size_t)c->lists * c->dim * sizeof(float), MALLOC_CAP_SPIRAM);
+    index->codebooks = (float *)heap_caps_malloc((size_t)FACE_INDEX_CODEBOOK_SIZE * c->dim * sizeof(float),
+                                                 MALLOC_CAP_SPIRAM);
+    index->lists = new (std::nothrow) std::atomic<index_list_t *>[c->lists]();
+    index->key_list = (int16_t *)heap_caps_malloc(c->max_keys * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+    index->key_pos = (int32_t *)heap_caps_malloc(c->max_keys * sizeof(int32_t), MALLOC_CAP_SPIRAM);
+    index->scratch = (float *)heap_caps_malloc(scratch_size(c), MALLOC_CAP_SPIRAM);
+    if (!index->centroids || !index->codebooks || !index->lists || !index->key_list || !index->key_pos ||
+        !index->scratch) {
+        face_index_destroy(index);
+        return NULL;
+    }
+    for (int key = 0; key < c->max_keys; key++) {
+        index->key_list[key] = -1;
+    }
+    return index;
+}
+
+void face_index_destroy(face_index_t *index)
+{
+    if (!index) {
+        return;
+    }
+    face_index_reclaim(index);
+    for (int l = 0; index->lists && l < index->config.lists; l++) {
+        heap_caps_free(index->lists[l].load(std::memory_order_relaxed));
+    }
+    delete[] index->lists;
+    heap_caps_free(index->centroids);
+    heap_caps_free(index->codebooks);
+    heap_caps_free(index->key_list);
+    heap_caps_free(index->key_pos);
+    heap_caps_free(index->scratch);
+    delete index;
+}
+
+esp_err_t face_index_train(face_index_t *index, const float *samples, int n)
+{
+    const face_index_config_t *c = &index->config;
+    if (index->trained) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (n < c->lists) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    // Coarse partitions on the vectors, then one codebook per subspace on the
+    // residuals to their partition
+    esp_err_t err = kmeans(samples, n, c->dim, c->dim, index->centroids, c->lists, true);
+    float *residuals = (float *)heap_caps_malloc((size_t)n * c->dim * sizeof(float), MALLOC_CAP_SPIRAM);
+    if (err != ESP_OK || !residuals) {
+        heap_caps_free(residuals);
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < n; i++) {
+        const float *x = samples + (size_t)i * c->dim;
+        const float *centroid = index->centroids + (size_t)nearest(x, index->centroids, c->lists, c->dim, true) * c->dim;
+        for (int j = 0; j < c->dim; j++) {
+            residuals[(size_t)i * c->dim + j] = x[j] - centroid[j];
+        }
+    }
+    index->ksub = std::min(FACE_INDEX_CODEBOOK_SIZE, n);
+    for (int m = 0; m < c->subspaces && err == ESP_OK; m++) {
+        err = kmeans(residuals + m * index->dsub, n, index->dsub, c->dim,
+                     index->codebooks + (size_t)m * index->ksub * index->dsub, index->ksub, false);
+    }
+    heap_caps_free(residuals);
+    index->trained = err == ESP_OK;
+    return err;
+}
+
+esp_err_t face_index_insert(face_index_t *index, int key, const float *vec)
+{
+    const face_index_config_t *c = &index->config;
+    if (!index->trained) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (key < 0 || key >= c->max_keys) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    face_index_remove(index, key);
+
+    int l = nearest(vec, index->centroids, c->lists, c->dim, true);
+    index_list_t *list = index->lists[l].load(std::memory_order_relaxed);
+    if (!list || list->count == list->capacity) {
+        int live = list ? list->count - list->dead : 0;
+        list = list_rebuild(index, l, std::max(FACE_INDEX_MIN_LIST_CAPACITY, live * 2));
+        if (!list) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // The code is in place before the key, and the key before the count
+    int pos = list->count;
+    encode(index, l, vec, list->codes + (size_t)pos * c->subspaces);
+    std::atomic_ref<int32_t>(list->keys[pos]).store(key, std::memory_order_release);
+    std::atomic_ref<int>(list->count).store(pos + 1, std::memory_order_release);
+    index->key_list[key] = l;
+    index->key_pos[key] = pos;
+    index->count++;
+    return ESP_OK;
+}
+
+void face_index_remove(face_index_t *index, int key)
+{
+    if (key < 0 || key >= index->config.max_keys || index->key_list[key] < 0) {
+        return;
+    }
+    int l = index->key_list[key];
+    index_list_t *list = index->lists[l].load(std::memory_order_relaxed);
+    std::atomic_ref<int32_t>(list->keys[index->key_pos[key]]).store(-1, std::memory_order_release);
+    list->dead++;
+    index->key_list[key] = -1;
+    index->count--;
+
+    // Give the space back once removed entries are most of the partition
+    if (list->dead > FACE_INDEX_MIN_LIST_CAPACITY && list->dead * 2 > list->count) {
+        list_rebuild(index, l, std::max(FACE_INDEX_MIN_LIST_CAPACITY, (list->count - list->dead) * 2));
+    }
+}
+
+int face_index_search(const face_index_t *index, const float *query, face_index_vector_fn_t vector,
+                      void *arg, int *keys, float *scores, int k)
+{
+    const face_index_config_t *c = &index->config;
+    if (!index->trained || k <= 0) {
+        return 0;
+    }
+    int ksub = index->ksub;
+    int dsub = index->dsub;
+    int nprobe = index->nprobe.load(std::memory_order_relaxed);
+
+    // The index's own scratch, or a buffer of its own for a search that runs
+    // alongside another one
+    bool shared = !index->scratch_busy.exchange(true, std::memory_order_acquire);
+    float *lut = shared ? index->scratch : (float *)heap_caps_malloc(scratch_size(c), MALLOC_CAP_SPIRAM);
+    if (!lut) {
+        return 0;
+    }
+    float *coarse = lut + (size_t)c->subspaces * ksub;
+    int *probe = (int *)(coarse + c->lists);
+    float *probe_scores = (float *)(probe + nprobe);
+
+    int n_probe = 0;
+    for (int l = 0; l < c->lists; l++) {
+        coarse[l] = dot(query, index->centroids + (size_t)l * c->dim, c->dim);
+        n_probe = push_top(probe, probe_scores, n_probe, nprobe, l, coarse[l]);
+    }
+    for (int m = 0; m < c->subspaces; m++) {
+        const float *codebook = index->codebooks + (size_t)m * ksub * dsub;
+        for (int j = 0; j < ksub; j++) {
+            lut[m * ksub + j] = dot(query + m * dsub, codebook + (size_t)j * dsub, dsub);
+        }
+    }
+
+    // Approximate score: query . (centroid + quantized residual)
+    int cand_keys[FACE_INDEX_MAX_RERANK];
+    float cand_scores[FACE_INDEX_MAX_RERANK];
+    int n_cand = 0;
+    for (int p = 0; p < n_probe; p++) {
+        int l = probe[p];
+        index_list_t *list = index->lists[l].load(std::memory_order_acquire);
+        if (!list) {
+            continue;
+        }
+        int n = std::atomic_ref<int>(list->count).load(std::memory_order_acquire);
+        for (int i = 0; i < n; i++) {
+            int32_t key = std::atomic_ref<int32_t>(list->keys[i]).load(std::memory_order_acquire);
+            if (key < 0) {
+                continue;
+            }
+            const uint8_t *code = list->codes + (size_t)i * c->subspaces;
+            float score = coarse[l];
+            for (int m = 0; m < c->subspaces; m++) {
+                score += lut[m * ksub + code[m]];
+            }
+            n_cand = push_top(cand_keys, cand_scores, n_cand, c->rerank, key, score);
+        }
+    }
+    if (shared) {
+        index->scratch_busy.store(false, std::memory_order_release);
+    } else {
+        heap_caps_free(lut);
+    }
+
+    // Exact scores for the best candidates
+    int found = 0;
+    for (int i = 0; i < n_cand; i++) {
+        const float *vec = vector(cand_keys[i], arg);
+        if (vec) {
+            found = push_top(keys, scores, found, k, cand_keys[i], dot(query, vec, c->dim));
+        }
+    }
+    return found;
+}
+
+void face_index_set_nprobe(face_index_t *index, int nprobe)
+{
+    index->nprobe.store(std::max(1, std::min(nprobe, index->config.lists)), std::memory_order_relaxed);
+}
+
+int face_index_count(const face_index_t *index)
+{
+    return index->count;
+}
+
+bool face_index_has_garbage(const face_index_t *index)
+{
+    return !index->garbage.empty();
+}
+
+void face_index_reclaim(face_index_t *index)
+{
+    for (index_list_t *list : index->garbage) {
+        heap_caps_free(list);
+    }
+    index->garbage.clear();
+}
+
+size_t face_index_memory(const face_index_t *index)
+{
+    const face_index_config_t *c = &index->config;
+    size_t bytes = (size_t)c->lists * c->dim * sizeof(float) + (size_t)FACE_INDEX_CODEBOOK_SIZE * c->dim * sizeof(float) +
+                   (size_t)c->max_keys * (sizeof(int16_t) + sizeof(int32_t));
+    for (int l = 0; l < c->lists; l++) {
+        const index_list_t *list = index->lists[l].load(std::memory_order_relaxed);
+        if (list) {
+            bytes += sizeof(index_list_t) + (size_t)list->capacity * (sizeof(int32_t) + c->subspaces);
+        }
+    }
+    return bytes;
+}
@@ -0,0 +1,80 @@
+#ifndef FACE_INDEX_H
+#define FACE_INDEX_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+
+// Approximate nearest-neighbour index over L2-normalized embeddings, for
+// galleries too large to scan in full (IVF-PQ). Vectors are split into coarse
+// partitions by their nearest centroid; within a partition each one is stored as
+// a product-quantized code of its residual, one byte per subspace, in PSRAM. A
+// search scores the codes of the nprobe nearest partitions with one lookup table
+// per query, then re-scores the best candidates exactly against the full vectors,
+// which the caller provides.
+//
+// Inserts and removes are incremental. A search may run concurrently with one
+// writer: entries are published with release stores, and partitions that have to
+// grow or shrink are copied and swapped. The old copies are only freed by
+// face_index_reclaim, which the caller must not call until every search that
+// started before the swap has ended (an RCU grace period). Writers must be
+// serialized by the caller. A search uses lookup tables allocated with the
+// index; only a search that overlaps another one allocates its own.
+
+#define FACE_INDEX_MAX_LISTS 1024
+#define FACE_INDEX_MAX_RERANK 64
+#define FACE_INDEX_CODEBOOK_SIZE 256  // Centroids per subspace, codes are one byte
+
+typedef struct face_index face_index_t;
+
+typedef struct {
+    int dim;        // Embedding length, a multiple of subspaces
+    int max_keys;   // Keys are 0 .. max_keys - 1
+    int lists;      // Coarse partitions
+    int subspaces;  // Code bytes per vector
+    int nprobe;     // Partitions scanned per search, see face_index_set_nprobe
+    int rerank;     // Candidates re-scored exactly
+} face_index_config_t;
+
+// Full vector of a key for re-scoring, NULL if the key was removed meanwhile
+typedef const float *(*face_index_vector_fn_t)(int key, void *arg);
+
+// Returns NULL if the configuration is invalid or out of memory
+face_index_t *face_index_create(const face_index_config_t *config);
+void face_index_destroy(face_index_t *index);
+
+// Learn the partitions and codebooks from n sample vectors. Must be called once,
+// before the first insert; n must be at least the number of lists.
+esp_err_t face_index_train(face_index_t *index, const float *samples, int n);
+
+esp_err_t face_index_insert(face_index_t *index, int key, const float *vec);
+void face_index_remove(face_index_t *index, int key);
+
+// Best k keys for the query, best first, with their exact similarity.
+// Returns how many were found.
+int face_index_search(const face_index_t *index, const float *query, face_index_vector_fn_t vector,
+                      void *arg, int *keys, float *scores, int k);
+
+// Change the partitions scanned per search, clamped to [1, lists]
+void face_index_set_nprobe(face_index_t *index, int nprobe);
+
+// Keys in the index
+int face_index_count(const face_index_t *index);
+
+// Free partition copies swapped out since the last call. See above.
+bool face_index_has_garbage(const face_index_t *index);
+void face_index_reclaim(face_index_t *index);
+
+// PSRAM used by the codes, centroids and codebooks
+size_t face_index_memory(const face_index_t *index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // FACE_INDEX_H
@@ -0,0 +1,397 @@
+#!/usr/bin/env python3
+"""HTTP load generator for the camera server.
+
+Runs a scripted mix of stream viewers and API clients against a running server
+(normally the linux target build on top of the fake camera) and reports
+delivered fps per viewer, API latency percentiles, socket errors and
+recognition tick jitter. Exits with status 1 when any configured threshold is
+crossed, so it can gate capacity changes in CI.
+
+Host build:
+    idf.py --preview set-target linux && idf.py build
+    CAMERA_SOURCE_PATH=recording.mjpeg CAMERA_SOURCE_FPS=0 ./build/wifi-cam-v3.elf
+
+Load test:
+    tools/loadtest.py --host localhost:8080 tools/loadtest_scenarios/multi_viewer.json
+"""
+
+import argparse
+import http.client
+import json
+import socket
+import statistics
+import sys
+import threading
+import time
+
+
+def percentile(values, pct):
+    if not values:
+        return None
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, max(0, int(round(pct / 100.0 * (len(ordered) - 1)))))
+    return ordered[index]
+
+
+def is_socket_error(exc):
+    """Errors that mean the server could not give us a connection at all."""
+    return isinstance(exc, (ConnectionRefusedError, ConnectionResetError, BrokenPipeError,
+                            socket.timeout, http.client.RemoteDisconnected))
+
+
+class Clock:
+    """Shared start time so every client measures the same steady-state window."""
+
+    def __init__(self, warmup_s, duration_s):
+        self.start = time.monotonic()
+        self.measure_from = self.start + warmup_s
+        self.stop_at = self.measure_from + duration_s
+        self.stop = threading.Event()
+
+    def measuring(self, t=None):
+        t = time.monotonic() if t is None else t
+        return self.measure_from <= t < self.stop_at
+
+    def running(self):
+        return not self.stop.is_set() and time.monotonic() < self.stop_at
+
+
+class StreamViewer(threading.Thread):
+    """Reads a multipart JPEG stream and counts complete frames."""
+
+    def __init__(self, name, host, port, path, clock, timeout_s):
+        super().__init__(name=name, daemon=True)
+        self.host, self.port, self.path = host, port, path
+        self.clock = clock
+        self.timeout_s = timeout_s
+        self.frames = 0
+        self.frame_gaps_ms = []
+        self.socket_errors = 0
+        self.other_errors = 0
+        self.reconnects = 0
+
+    def run(self):
+        while self.clock.running():
+            try:
+                self.read_stream()
+            except Exception as exc:  # noqa: BLE001 - every failure is a data point
+                if not self.clock.running():
+                    break
+                if is_socket_error(exc):
+                    self.socket_errors += 1
+                else:
+                    self.other_errors += 1
+                self.reconnects += 1
+                time.sleep(0.2)
+
+    def read_stream(self):
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout_s)
+        try:
+            conn.request("GET", self.path)
+            resp = conn.getresponse()
+            if resp.status != 200:
+                raise RuntimeError("HTTP %d" % resp.status)
+            last_frame = None
+            while self.clock.running():
+                length = self.read_part_header(resp)
+                data = resp.read(length)
+                if len(data) != length:
+                    raise ConnectionResetError("short frame")
+                now = time.monotonic()
+                if self.clock.measuring(now):
+                    self.frames += 1
+                    if last_frame is not None:
+                        self.frame_gaps_ms.append((now - last_frame) * 1000.0)
+                last_frame = now
+        finally:
+            conn.close()
+
+    @staticmethod
+    def read_part_header(resp):
+        length = None
+        while True:
+            line = resp.readline()
+            if not line:
+                raise ConnectionResetError("stream closed")
+            line = line.strip()
+            if line.lower().startswith(b"content-length:"):
+                length = int(line.split(b":", 1)[1])
+            elif not line and length is not None:
+                return length
+
+    def report(self, duration_s):
+        return {
+            "path": self.path,
+            "fps": self.frames / duration_s,
+            "frame_gap_p99_ms": percentile(self.frame_gaps_ms, 99),
+            "socket_errors": self.socket_errors,
+            "other_errors": self.other_errors,
+            "reconnects": self.reconnects,
+        }
+
+
+class ApiClient(threading.Thread):
+    """Issues requests at a fixed rate (or back to back with rate_hz 0)."""
+
+    def __init__(self, name, host, port, spec, clock, timeout_s):
+        super().__init__(name=name, daemon=True)
+        self.host, self.port = host, port
+        self.path = spec["path"]
+        self.method = spec.get("method", "GET")
+        self.rate_hz = float(spec.get("rate_hz", 1.0))
+        self.max_p99_ms = spec.get("max_p99_ms")
+        self.clock = clock
+        self.timeout_s = timeout_s
+        self.latencies_ms = []
+        self.status = {}
+        self.socket_errors = 0
+        self.other_errors = 0
+        self.sent = 0
+        self.attempted = 0
+
+    def run(self):
+        period = 1.0 / self.rate_hz if self.rate_hz > 0 else 0.0
+        next_send = time.monotonic()
+        while self.clock.running():
+            if period:
+                delay = next_send - time.monotonic()
+                if delay > 0:
+                    time.sleep(delay)
+                next_send += period
+            self.request_once()
+
+    def request_once(self):
+        path = self.path.replace("{n}", str(self.sent))
+        self.sent += 1
+        start = time.monotonic()
+        if self.clock.measuring(start):
+            self.attempted += 1
+        conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout_s)
+        try:
+            conn.request(self.method, path)
+            resp = conn.getresponse()
+            resp.read()
+            end = time.monotonic()
+            if self.clock.measuring(start):
+                self.latencies_ms.append((end - start) * 1000.0)
+                self.status[resp.status] = self.status.get(resp.status, 0) + 1
+        except Exception as exc:  # noqa: BLE001
+            if self.clock.measuring(start):
+                if is_socket_error(exc):
+                    self.socket_errors += 1
+                else:
+                    self.other_errors += 1
+        finally:
+            conn.close()
+
+    def report(self, duration_s):
+        return {
+            "path": self.path,
+            "attempted": self.attempted,
+            "requests": len(self.latencies_ms),
+            "p50_ms": percentile(self.latencies_ms, 50),
+            "p99_ms": percentile(self.latencies_ms, 99),
+            "max_ms": max(self.latencies_ms) if self.latencies_ms else None,
+            "status": {str(k): v for k, v in sorted(self.status.items())},
+            "socket_errors": self.socket_errors,
+            "other_errors": self.other_errors,
+        }
+
+
+class TickMonitor(threading.Thread):
+    """Reconstructs recognition tick times from /recognized_name.
+
+    Each result carries its frame sequence number and age, so the publish time is
+    poll time minus age. Intervals are only taken between consecutive sequence
+    numbers, which makes the measurement independent of the poll rate.
+    """
+
+    def __init__(self, host, port, clock, poll_ms, timeout_s):
+        super().__init__(name="tick-monitor", daemon=True)
+        self.host, self.port = host, port
+        self.clock = clock
+        self.poll_s = poll_ms / 1000.0
+        self.timeout_s = timeout_s
+        self.published = {}
+        self.errors = 0
+
+    def run(self):
+        conn = None
+        while self.clock.running():
+            try:
+                if conn is None:
+                    conn = http.client.HTTPConnection(self.host, self.port, timeout=self.timeout_s)
+                conn.request("GET", "/recognized_name")
+                body = json.loads(conn.getresponse().read())
+                now = time.monotonic()
+                seq = body.get("seq", 0)
+                if seq and seq not in self.published and body.get("age_ms", -1) >= 0 and self.clock.measuring(now):
+                    self.published[seq] = now - body["age_ms"] / 1000.0
+            except Exception:  # noqa: BLE001
+                self.errors += 1
+                if conn is not None:
+                    conn.close()
+                conn = None
+            time.sleep(self.poll_s)
+        if conn is not None:
+            conn.close()
+
+    def report(self):
+        seqs = sorted(self.published)
+        intervals = [(self.published[b] - self.published[a]) * 1000.0
+                     for a, b in zip(seqs, seqs[1:]) if b == a + 1]
+        if not intervals:
+            return {"ticks": len(seqs), "interval_p50_ms": None, "jitter_p99_ms": None,
+                    "interval_max_ms": None, "poll_errors": self.errors}
+        median = statistics.median(intervals)
+        return {
+            "ticks": len(seqs),
+            "interval_p50_ms": median,
+            "jitter_p99_ms": percentile([abs(i - median) for i in intervals], 99),
+            "interval_max_ms": max(intervals),
+            "poll_errors": self.errors,
+        }
+
+
+def check_thresholds(report, thresholds):
+    failures = []
+
+    def fail(message):
+        failures.append(message)
+
+    min_fps = thresholds.get("min_stream_fps")
+    for name, viewer in report["viewers"].items():
+        if min_fps is not None and viewer["fps"] < min_fps:
+            fail("%s delivered %.2f fps (< %.2f)" % (name, viewer["fps"], min_fps))
+
+    max_p99 = thresholds.get("max_api_p99_ms")
+    for name, api in report["api"].items():
+        limit = api.get("max_p99_ms", max_p99)
+        if limit is not None and api["p99_ms"] is not None and api["p99_ms"] > limit:
+            fail("%s p99 %.0f ms (> %.0f ms)" % (name, api["p99_ms"], limit))
+        if api["attempted"] > 0 and api["requests"] == 0:
+            fail("%s completed no requests" % name)
+
+    max_socket_errors = thresholds.get("max_socket_errors")
+    if max_socket_errors is not None and report["socket_errors"] > max_socket_errors:
+        fail("%d socket errors (> %d)" % (report["socket_errors"], max_socket_errors))
+
+    tick = report.get("recognition_tick")
+    max_jitter = thresholds.get("max_tick_jitter_ms")
+    if tick and max_jitter is not None:
+        if tick["jitter_p99_ms"] is None:
+            fail("no consecutive recognition ticks observed")
+        elif tick["jitter_p99_ms"] > max_jitter:
+            fail("recognition tick jitter p99 %.0f ms (> %.0f ms)" % (tick["jitter_p99_ms"], max_jitter))
+    max_interval = thresholds.get("max_tick_interval_ms")
+    if tick and max_interval is not None and tick["interval_max_ms"] is not None:
+        if tick["interval_max_ms"] > max_interval:
+            fail("recognition tick interval max %.0f ms (> %.0f ms)" % (tick["interval_max_ms"], max_interval))
+
+    return failures
+
+
+def run_scenario(scenario, host, port):
+    duration_s = float(scenario.get("duration_s", 30))
+    warmup_s = float(scenario.get("warmup_s", 5))
+    timeout_s = float(scenario.get("timeout_s", 10))
+    clock = Clock(warmup_s, duration_s)
+
+    viewers, apis = {}, {}
+    for spec in scenario["clients"]:
+        for i in range(int(spec.get("count", 1))):
+            name = "%s#%d" % (spec.get("name", spec["path"]), i)
+            if spec["kind"] == "stream":
+                viewers[name] = StreamViewer(name, host, port, spec["path"], clock, timeout_s)
+            elif spec["kind"] == "api":
+                apis[name] = ApiClient(name, host, port, spec, clock, timeout_s)
+            else:
+                raise ValueError("unknown client kind %r" % spec["kind"])
+
+    monitor = None
+    if scenario.get("monitor_ticks", True):
+        monitor = TickMonitor(host, port, clock, float(scenario.get("tick_poll_ms", 100)), timeout_s)
+
+    threads = list(viewers.values()) + list(apis.values()) + ([monitor] if monitor else [])
+    for t in threads:
+        t.start()
+    try:
+        while clock.running():
+            time.sleep(0.5)
+    except KeyboardInterrupt:
+        pass
+    clock.stop.set()
+    for t in threads:
+        t.join(timeout_s + 1)
+
+    report = {
+        "duration_s": duration_s,
+        "viewers": {n: v.report(duration_s) for n, v in viewers.items()},
+        "api": {},
+    }
+    for n, a in apis.items():
+        entry = a.report(duration_s)
+        if a.max_p99_ms is not None:
+            entry["max_p99_ms"] = a.max_p99_ms
+        report["api"][n] = entry
+    report["socket_errors"] = (sum(v.socket_errors for v in viewers.values()) +
+                               sum(a.socket_errors for a in apis.values()))
+    if monitor:
+        report["recognition_tick"] = monitor.report()
+    return report
+
+
+def print_report(report, failures):
+    print("Viewers:")
+    for name, v in report["viewers"].items():
+        print("  %-28s %6.2f fps  gap p99 %s ms  socket errors %d  reconnects %d" % (
+            name, v["fps"], fmt(v["frame_gap_p99_ms"]), v["socket_errors"], v["reconnects"]))
+    print("API:")
+    for name, a in report["api"].items():
+        print("  %-28s %5d req  p50 %s ms  p99 %s ms  max %s ms  status %s  socket errors %d" % (
+            name, a["requests"], fmt(a["p50_ms"]), fmt(a["p99_ms"]), fmt(a["max_ms"]),
+            a["status"], a["socket_errors"]))
+    tick = report.get("recognition_tick")
+    if tick:
+        print("Recognition ticks: %d  interval p50 %s ms  jitter p99 %s ms  max %s ms" % (
+            tick["ticks"], fmt(tick["interval_p50_ms"]), fmt(tick["jitter_p99_ms"]), fmt(tick["interval_max_ms"])))
+    print("Socket errors: %d" % report["socket_errors"])
+    if failures:
+        print("FAILED:")
+        for f in failures:
+            print("  " + f)
+    else:
+        print("PASSED")
+
+
+def fmt(value):
+    return "-" if value is None else "%.0f" % value
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("scenario", help="scenario JSON file")
+    parser.add_argument("--host", default="localhost:8080", help="server host[:port]")
+    parser.add_argument("--duration", type=float, help="override duration_s of the scenario")
+    parser.add_argument("--json", help="also write the report to this file")
+    args = parser.parse_args()
+
+    with open(args.scenario) as f:
+        scenario = json.load(f)
+    if args.duration:
+        scenario["duration_s"] = args.duration
+
+    host, _, port = args.host.partition(":")
+    report = run_scenario(scenario, host, int(port or 80))
+    failures = check_thresholds(report, scenario.get("thresholds", {}))
+    report["failures"] = failures
+
+    print_report(report, failures)
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(report, f, indent=2)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,86 @@
+#!/usr/bin/env python3
+"""Pack the web UI pages into a C header for the firmware.
+
+Each page is minified (comments, indentation and blank lines removed; line
+breaks are kept so inline scripts keep their statement boundaries) and emitted
+twice, gzipped and plain for clients that do not accept gzip, each as a byte
+array with a strong ETag derived from its bytes. Output is reproducible, so
+the ETags only change when a page does.
+
+Run by the build (see main/CMakeLists.txt):
+    tools/pack_www.py build/esp-idf/main/www_assets.h main/www/index.html ...
+"""
+
+import gzip
+import hashlib
+import os
+import re
+import sys
+
+CONTENT_TYPES = {
+    ".html": "text/html",
+    ".js": "application/javascript",
+    ".css": "text/css",
+}
+
+
+def minify(text):
+    text = re.sub(r"<!--.*?-->", "", text, flags=re.S)
+    lines = (line.strip() for line in text.splitlines())
+    return "\n".join(line for line in lines if line)
+
+
+def symbol(path):
+    return "www_" + re.sub(r"[^0-9a-zA-Z]", "_", os.path.basename(path))
+
+
+def main():
+    if len(sys.argv) < 3:
+        sys.exit("usage: pack_www.py OUTPUT_HEADER PAGE...")
+    out_path, pages = sys.argv[1], sys.argv[2:]
+
+    out = [
+        "// Generated by tools/pack_www.py from main/www, do not edit",
+        "#pragma once",
+        "#include <stddef.h>",
+        "",
+        "typedef struct {",
+        "    const char *content_type;",
+        "    const unsigned char *data;  // gzip",
+        "    size_t len;",
+        "    const char *etag;",
+        "    const unsigned char *plain;  // Minified, not compressed",
+        "    size_t plain_len;",
+        "    const char *plain_etag;",
+        "} www_asset_t;",
+        "",
+    ]
+    for page in pages:
+        with open(page, encoding="utf-8") as f:
+            raw = f.read().encode("utf-8")
+        plain = minify(raw.decode("utf-8")).encode("utf-8")
+        packed = gzip.compress(plain, compresslevel=9, mtime=0)
+        etag = hashlib.sha1(packed).hexdigest()[:16]
+        plain_etag = hashlib.sha1(plain).hexdigest()[:16]
+        ctype = CONTENT_TYPES.get(os.path.splitext(page)[1], "application/octet-stream")
+        name = symbol(page)
+
+        out.append("// %s: %d bytes, %d minified, %d gzipped" % (os.path.basename(page), len(raw), len(plain),
+                                                                 len(packed)))
+        for suffix, data in (("gz", packed), ("plain", plain)):
+            out.append("static const unsigned char %s_%s[] = {" % (name, suffix))
+            for i in range(0, len(data), 16):
+                out.append("    " + ", ".join("0x%02x" % b for b in data[i:i + 16]) + ",")
+            out.append("};")
+        out.append('static const www_asset_t %s = {"%s", %s_gz, sizeof(%s_gz), "\\"%s\\"",'
+                   % (name, ctype, name, name, etag))
+        out.append('    %s_plain, sizeof(%s_plain), "\\"%s\\""};'
+                   % (name, name, plain_etag))
+        out.append("")
+
+    with open(out_path, "w", encoding="utf-8") as f:
+        f.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()